@@ -0,0 +1,562 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "apu.h"
+
+// Frame sequencer runs at 512Hz
+#define FRAME_STEP_PERIOD 8192
+#define LFSR15_PERIOD 32767
+#define LFSR7_PERIOD 127
+// Scales the mixed output (4 channels of -15..15, master volume up to 8) to 16 bits
+#define OUTPUT_SCALE 64
+#define PI 3.14159265358979f
+
+typedef enum {
+    CHANNEL_SQUARE_SWEEP,
+    CHANNEL_SQUARE,
+    CHANNEL_WAVE,
+    CHANNEL_NOISE
+}channel_index;
+
+// Each channel's registers are 5 apart, starting at NR10
+#define CHANNEL_REGISTERS(channel) (NR10 + (channel) * 5)
+
+static const uint8_t duty_table[4][8] = {
+        {0, 0, 0, 0, 0, 0, 0, 1}, // 12.5%
+        {1, 0, 0, 0, 0, 0, 0, 1}, // 25%
+        {1, 0, 0, 0, 0, 1, 1, 1}, // 50%
+        {0, 1, 1, 1, 1, 1, 1, 0}  // 75%
+};
+static const uint8_t noise_divisors[8] = {8, 16, 32, 48, 64, 80, 96, 112};
+static const uint16_t length_max[4] = {64, 64, 256, 64};
+
+// Bits that always read as 1 for NR10 to 0xFF2F. Write-only and unused bits
+// are set when the register is written, so reads can go straight to memory.
+static const uint8_t read_masks[WAVE_RAM - NR10] = {
+        0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10-NR14
+        0xFF, 0x3F, 0x00, 0xFF, 0xBF, // NR20-NR24
+        0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30-NR34
+        0xFF, 0xFF, 0x00, 0x00, 0xBF, // NR40-NR44
+        0x00, 0x00, 0x70, // NR50-NR52
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF // Unused
+};
+
+// Output bit of the noise LFSR after each step from the trigger state. The
+// 7-bit mode only depends on the low 7 bits, which form their own LFSR.
+static uint8_t lfsr15_table[LFSR15_PERIOD];
+static uint8_t lfsr7_table[LFSR7_PERIOD];
+
+__attribute__((constructor)) static void build_lfsr_tables(void) {
+    uint16_t lfsr = 0x7FFF;
+    for (uint16_t i = 0; i < LFSR15_PERIOD; i++) {
+        // The channel outputs the inverted low bit
+        lfsr15_table[i] = ~lfsr & 1;
+        uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+        lfsr = (lfsr >> 1) | (bit << 14);
+    }
+    lfsr = 0x7F;
+    for (uint16_t i = 0; i < LFSR7_PERIOD; i++) {
+        lfsr7_table[i] = ~lfsr & 1;
+        uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+        lfsr = (lfsr >> 1) | (bit << 6);
+    }
+}
+
+// T-cycles per duty/wave/LFSR step, 0 if the channel's timer never fires
+static int32_t channel_period(const apu_channel* ch, channel_index index, const uint8_t* memory) {
+    switch (index) {
+        case CHANNEL_WAVE:
+            return (2048 - ch->frequency) * 2;
+        case CHANNEL_NOISE: {
+            uint8_t shift = memory[NR43] >> 4;
+            if (shift >= 14) {
+                return 0;
+            }
+            return noise_divisors[memory[NR43] & 0x7] << shift;
+        }
+        default:
+            return (2048 - ch->frequency) * 4;
+    }
+}
+
+static uint16_t channel_steps(channel_index index, const uint8_t* memory) {
+    switch (index) {
+        case CHANNEL_WAVE:
+            return 32;
+        case CHANNEL_NOISE:
+            return (memory[NR43] & 0x8) ? LFSR7_PERIOD : LFSR15_PERIOD;
+        default:
+            return 8;
+    }
+}
+
+static void update_status(const apu_state* apu, uint8_t* memory) {
+    uint8_t status = (memory[NR52] & 0x80) | read_masks[NR52 - NR10];
+    for (uint8_t i = 0; i < 4; i++) {
+        if (apu->channels[i].enabled) {
+            status |= (1 << i);
+        }
+    }
+    memory[NR52] = status;
+}
+
+static void build_wave_table(apu_state* apu, const uint8_t* memory) {
+    // Output level 0 mutes, 1-3 shift right by 0-2
+    static const uint8_t shifts[4] = {4, 0, 1, 2};
+    uint8_t shift = shifts[(memory[NR32] >> 5) & 0x3];
+    for (uint8_t i = 0; i < 16; i++) {
+        uint8_t byte = memory[WAVE_RAM + i];
+        apu->wave_table[i * 2] = (byte >> 4) >> shift;
+        apu->wave_table[i * 2 + 1] = (byte & 0xF) >> shift;
+    }
+}
+
+// Next sweep frequency, disables channel 1 if it overflows
+static uint16_t sweep_calculate(apu_channel* ch, const uint8_t* memory) {
+    uint8_t shift = memory[NR10] & 0x7;
+    uint16_t delta = ch->sweep_frequency >> shift;
+    uint16_t frequency = (memory[NR10] & 0x8) ? ch->sweep_frequency - delta : ch->sweep_frequency + delta;
+    if (frequency > 2047) {
+        ch->enabled = false;
+    }
+    return frequency;
+}
+
+static void clock_length(apu_state* apu) {
+    for (uint8_t i = 0; i < 4; i++) {
+        apu_channel* ch = &apu->channels[i];
+        if (ch->length_enabled && ch->length != 0) {
+            ch->length--;
+            if (ch->length == 0) {
+                ch->enabled = false;
+            }
+        }
+    }
+}
+
+static void clock_sweep(apu_state* apu, uint8_t* memory) {
+    apu_channel* ch = &apu->channels[CHANNEL_SQUARE_SWEEP];
+    uint8_t period = (memory[NR10] >> 4) & 0x7;
+    if (--ch->sweep_timer != 0) {
+        return;
+    }
+    ch->sweep_timer = period ? period : 8;
+    if (!ch->sweep_enabled || period == 0) {
+        return;
+    }
+    uint16_t frequency = sweep_calculate(ch, memory);
+    if (frequency <= 2047 && (memory[NR10] & 0x7) != 0) {
+        ch->sweep_frequency = frequency;
+        ch->frequency = frequency;
+        // Checked again with the new frequency, but not written back
+        sweep_calculate(ch, memory);
+    }
+}
+
+static void clock_envelope(apu_state* apu, const uint8_t* memory) {
+    static const channel_index enveloped[3] = {CHANNEL_SQUARE_SWEEP, CHANNEL_SQUARE, CHANNEL_NOISE};
+    for (uint8_t i = 0; i < 3; i++) {
+        apu_channel* ch = &apu->channels[enveloped[i]];
+        uint8_t envelope = memory[CHANNEL_REGISTERS(enveloped[i]) + 2];
+        uint8_t period = envelope & 0x7;
+        if (period == 0 || --ch->envelope_timer != 0) {
+            continue;
+        }
+        ch->envelope_timer = period;
+        if ((envelope & 0x8) && ch->volume < 15) {
+            ch->volume++;
+        }
+        else if (!(envelope & 0x8) && ch->volume > 0) {
+            ch->volume--;
+        }
+    }
+}
+
+static void frame_sequencer_step(apu_state* apu, uint8_t* memory) {
+    // Length on even steps, sweep on 2 and 6, envelope on 7
+    if ((apu->frame_step & 1) == 0) {
+        clock_length(apu);
+    }
+    if (apu->frame_step == 2 || apu->frame_step == 6) {
+        clock_sweep(apu, memory);
+    }
+    if (apu->frame_step == 7) {
+        clock_envelope(apu, memory);
+    }
+    apu->frame_step = (apu->frame_step + 1) & 0x7;
+}
+
+static void flush(apu_state* apu) {
+    if (apu->sink != NULL && apu->buffered_frames != 0) {
+        apu->sink(apu->sink_user, apu->buffer, apu->buffered_frames);
+    }
+    apu->buffered_frames = 0;
+}
+
+static void output_frame(apu_state* apu, int16_t left, int16_t right) {
+    apu->buffer[apu->buffered_frames * 2] = left;
+    apu->buffer[apu->buffered_frames * 2 + 1] = right;
+    if (++apu->buffered_frames == APU_BUFFER_FRAMES) {
+        flush(apu);
+    }
+}
+
+static int16_t clamp_sample(float value) {
+    if (value > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (value < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t) lrintf(value);
+}
+
+// Takes one native sample, outputs however many resampled frames are due
+static void resample(apu_state* apu, int16_t left, int16_t right) {
+    apu_resampler* r = &apu->resampler;
+    r->history[0][r->index] = r->history[0][r->index + APU_RESAMPLER_TAPS] = left;
+    r->history[1][r->index] = r->history[1][r->index + APU_RESAMPLER_TAPS] = right;
+    r->index = (r->index + 1) % APU_RESAMPLER_TAPS;
+
+    // history[c][index..index+TAPS-1] now runs from oldest to newest
+    r->phase += r->output_rate;
+    while (r->phase >= 0) {
+        uint32_t p = (r->phase * APU_RESAMPLER_PHASES + r->output_rate / 2) / r->output_rate;
+        const float* kernel = r->kernel[p];
+        const float* history_left = &r->history[0][r->index];
+        const float* history_right = &r->history[1][r->index];
+        float sum_left = 0;
+        float sum_right = 0;
+        for (uint8_t k = 0; k < APU_RESAMPLER_TAPS; k++) {
+            sum_left += history_left[k] * kernel[k];
+            sum_right += history_right[k] * kernel[k];
+        }
+        output_frame(apu, clamp_sample(sum_left), clamp_sample(sum_right));
+        r->phase -= APU_NATIVE_RATE;
+    }
+}
+
+static void advance_channel(apu_channel* ch, int32_t period, uint16_t steps, int32_t cycles) {
+    if (period == 0) {
+        return;
+    }
+    ch->timer -= cycles;
+    if (ch->timer <= 0) {
+        // Skip every step in the batch at once instead of looping
+        int32_t elapsed = (-ch->timer) / period + 1;
+        ch->timer += elapsed * period;
+        ch->position = (ch->position + elapsed) % steps;
+    }
+}
+
+static void mix_sample(apu_state* apu, const uint8_t* memory) {
+    uint8_t digital[4] = {0};
+    const apu_channel* ch = apu->channels;
+    if (ch[CHANNEL_SQUARE_SWEEP].enabled) {
+        uint8_t duty = memory[NR11] >> 6;
+        digital[0] = duty_table[duty][ch[0].position] * ch[0].volume;
+    }
+    if (ch[CHANNEL_SQUARE].enabled) {
+        uint8_t duty = memory[NR21] >> 6;
+        digital[1] = duty_table[duty][ch[1].position] * ch[1].volume;
+    }
+    if (ch[CHANNEL_WAVE].enabled) {
+        digital[2] = apu->wave_table[ch[2].position];
+    }
+    if (ch[CHANNEL_NOISE].enabled) {
+        const uint8_t* lfsr = (memory[NR43] & 0x8) ? lfsr7_table : lfsr15_table;
+        digital[3] = lfsr[ch[3].position] * ch[3].volume;
+    }
+
+    int32_t left = 0;
+    int32_t right = 0;
+    uint8_t panning = memory[NR51];
+    for (uint8_t i = 0; i < 4; i++) {
+        if (!ch[i].dac_enabled) {
+            continue;
+        }
+        int32_t analog = digital[i] * 2 - 15;
+        if (panning & (0x10 << i)) {
+            left += analog;
+        }
+        if (panning & (0x01 << i)) {
+            right += analog;
+        }
+    }
+    left *= (((memory[NR50] >> 4) & 0x7) + 1) * OUTPUT_SCALE;
+    right *= ((memory[NR50] & 0x7) + 1) * OUTPUT_SCALE;
+
+    if (apu->resample) {
+        resample(apu, left, right);
+    }
+    else {
+        output_frame(apu, left, right);
+    }
+}
+
+// Runs the channels for a stretch without frame sequencer events in it
+static void synthesize(apu_state* apu, const uint8_t* memory, uint32_t cycles) {
+    int32_t periods[4];
+    uint16_t steps[4];
+    for (uint8_t i = 0; i < 4; i++) {
+        periods[i] = channel_period(&apu->channels[i], i, memory);
+        steps[i] = channel_steps(i, memory);
+        // The LFSR width can change while the position is past the 7-bit period
+        apu->channels[i].position %= steps[i];
+    }
+
+    while (cycles != 0) {
+        uint32_t run = cycles < apu->sample_countdown ? cycles : apu->sample_countdown;
+        for (uint8_t i = 0; i < 4; i++) {
+            advance_channel(&apu->channels[i], periods[i], steps[i], run);
+        }
+        cycles -= run;
+        apu->sample_countdown -= run;
+        if (apu->sample_countdown == 0) {
+            apu->sample_countdown = APU_SAMPLE_PERIOD;
+            if (memory[NR52] & 0x80) {
+                mix_sample(apu, memory);
+            }
+            else if (apu->resample) {
+                resample(apu, 0, 0);
+            }
+            else {
+                output_frame(apu, 0, 0);
+            }
+        }
+    }
+}
+
+void apu_catch_up(apu_state* apu, uint8_t* memory, uint64_t clock) {
+    uint64_t target = clock * 4;
+    while (apu->clock < target) {
+        uint64_t next = apu->next_frame_step < target ? apu->next_frame_step : target;
+        // Without synthesis, only the frame sequencer has visible effects
+        if (apu->synthesize) {
+            synthesize(apu, memory, next - apu->clock);
+        }
+        apu->clock = next;
+        if (apu->clock == apu->next_frame_step) {
+            if (memory[NR52] & 0x80) {
+                frame_sequencer_step(apu, memory);
+            }
+            apu->next_frame_step += FRAME_STEP_PERIOD;
+        }
+    }
+    update_status(apu, memory);
+}
+
+static void trigger(apu_state* apu, channel_index index, uint8_t* memory) {
+    apu_channel* ch = &apu->channels[index];
+    uint16_t registers = CHANNEL_REGISTERS(index);
+    ch->enabled = ch->dac_enabled;
+    if (ch->length == 0) {
+        ch->length = length_max[index];
+    }
+    ch->timer = channel_period(ch, index, memory);
+    if (index == CHANNEL_WAVE || index == CHANNEL_NOISE) {
+        ch->position = 0;
+    }
+    if (index != CHANNEL_WAVE) {
+        ch->volume = memory[registers + 2] >> 4;
+        ch->envelope_timer = memory[registers + 2] & 0x7;
+    }
+    if (index == CHANNEL_SQUARE_SWEEP) {
+        uint8_t period = (memory[NR10] >> 4) & 0x7;
+        uint8_t shift = memory[NR10] & 0x7;
+        ch->sweep_frequency = ch->frequency;
+        ch->sweep_timer = period ? period : 8;
+        ch->sweep_enabled = (period != 0 || shift != 0);
+        if (shift != 0) {
+            sweep_calculate(ch, memory);
+        }
+    }
+}
+
+static void power_off(apu_state* apu, uint8_t* memory) {
+    // Everything but wave RAM is cleared, and stays that way until power on
+    for (uint16_t address = NR10; address < NR52; address++) {
+        memory[address] = read_masks[address - NR10];
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        apu_channel empty = {0};
+        apu->channels[i] = empty;
+    }
+}
+
+void apu_write(apu_state* apu, uint8_t* memory, uint64_t clock, uint16_t address, uint8_t value) {
+    apu_catch_up(apu, memory, clock);
+
+    if (address >= WAVE_RAM) {
+        memory[address] = value;
+        build_wave_table(apu, memory);
+        return;
+    }
+    if (address == NR52) {
+        bool powered = memory[NR52] & 0x80;
+        if (powered && !(value & 0x80)) {
+            power_off(apu, memory);
+        }
+        else if (!powered && (value & 0x80)) {
+            apu->frame_step = 0;
+        }
+        memory[NR52] = value & 0x80;
+        update_status(apu, memory);
+        return;
+    }
+    if (address > NR52) {
+        // Unused, always reads 0xFF
+        return;
+    }
+
+    // Past NR44 are NR50 and NR51, no channel attached
+    uint8_t index = (address - NR10) / 5;
+    uint8_t offset = (address - NR10) % 5;
+    bool powered = memory[NR52] & 0x80;
+    if (!powered) {
+        // Only the length counters can be loaded while the APU is off
+        if (index < 4 && offset == 1) {
+            uint16_t mask = length_max[index] - 1;
+            apu->channels[index].length = length_max[index] - (value & mask);
+        }
+        return;
+    }
+
+    memory[address] = value | read_masks[address - NR10];
+    if (index >= 4) {
+        return;
+    }
+    apu_channel* ch = &apu->channels[index];
+    switch (offset) {
+        case 0:
+            if (index == CHANNEL_WAVE) {
+                ch->dac_enabled = value & 0x80;
+                ch->enabled &= ch->dac_enabled;
+            }
+            break;
+        case 1:
+            ch->length = length_max[index] - (value & (length_max[index] - 1));
+            break;
+        case 2:
+            if (index == CHANNEL_WAVE) {
+                build_wave_table(apu, memory);
+            }
+            else {
+                // Volume 0 decreasing turns the DAC off
+                ch->dac_enabled = (value & 0xF8) != 0;
+                ch->enabled &= ch->dac_enabled;
+            }
+            break;
+        case 3:
+            if (index != CHANNEL_NOISE) {
+                ch->frequency = (ch->frequency & 0x700) | value;
+            }
+            break;
+        case 4:
+            if (index != CHANNEL_NOISE) {
+                ch->frequency = (ch->frequency & 0xFF) | ((value & 0x7) << 8);
+            }
+            ch->length_enabled = value & 0x40;
+            if (value & 0x80) {
+                trigger(apu, index, memory);
+            }
+            break;
+    }
+    update_status(apu, memory);
+}
+
+void apu_end_frame(apu_state* apu, uint8_t* memory, uint64_t clock) {
+    apu_catch_up(apu, memory, clock);
+    flush(apu);
+}
+
+bool apu_status_changing(const apu_state* apu) {
+    const apu_channel* ch = apu->channels;
+    for (uint8_t i = 0; i < 4; i++) {
+        if (ch[i].enabled && ch[i].length_enabled) {
+            return true;
+        }
+    }
+    // The sweep can overflow and turn channel 1 off
+    return ch[CHANNEL_SQUARE_SWEEP].enabled && ch[CHANNEL_SQUARE_SWEEP].sweep_enabled;
+}
+
+void apu_reset(apu_state* apu, uint8_t* memory) {
+    for (uint8_t i = 0; i < 4; i++) {
+        apu_channel empty = {0};
+        apu->channels[i] = empty;
+    }
+    memset(apu->wave_table, 0, sizeof(apu->wave_table));
+    apu->clock = 0;
+    apu->next_frame_step = FRAME_STEP_PERIOD;
+    apu->frame_step = 0;
+    apu->sample_countdown = APU_SAMPLE_PERIOD;
+    apu->buffered_frames = 0;
+
+    // Powered off, with every register reading back its fixed bits
+    for (uint16_t address = NR10; address < WAVE_RAM; address++) {
+        memory[address] = read_masks[address - NR10];
+    }
+
+    apu_resampler* r = &apu->resampler;
+    memset(r->history, 0, sizeof(r->history));
+    r->index = 0;
+    // The first output frame lines up with the first native sample
+    r->phase = -(int64_t) r->output_rate;
+}
+
+void apu_apply_post_boot(apu_state* apu, uint8_t* memory) {
+    // The boot ROM powers the APU on and plays its chime on channel 1, which
+    // is left enabled with the envelope run down to silence
+    apu_write(apu, memory, 0, NR52, 0x80);
+    apu_write(apu, memory, 0, NR11, 0x80);
+    apu_write(apu, memory, 0, NR12, 0xF3);
+    apu_write(apu, memory, 0, NR51, 0xF3);
+    apu_write(apu, memory, 0, NR50, 0x77);
+    apu_write(apu, memory, 0, NR13, 0xC1);
+    apu_write(apu, memory, 0, NR14, 0x87);
+    apu->channels[CHANNEL_SQUARE_SWEEP].volume = 0;
+}
+
+void apu_set_output(apu_state* apu, apu_sample_sink sink, void* user, uint32_t output_rate) {
+    // Only downsampling is supported, the native rate is already higher than
+    // anything we'd want to play back
+    if (output_rate > APU_NATIVE_RATE) {
+        output_rate = APU_NATIVE_RATE;
+    }
+    apu->sink = sink;
+    apu->sink_user = user;
+    apu->synthesize = (sink != NULL);
+    apu->resample = (output_rate != APU_NATIVE_RATE);
+    apu_resampler* r = &apu->resampler;
+    r->output_rate = output_rate;
+    r->phase = -(int64_t) output_rate;
+    if (!apu->resample) {
+        return;
+    }
+
+    // Windowed sinc low-pass just under the output Nyquist frequency, one
+    // row for each fractional position of an output sample between inputs
+    float cutoff = 0.45f * output_rate / APU_NATIVE_RATE;
+    if (cutoff > 0.45f) {
+        cutoff = 0.45f;
+    }
+    for (uint8_t p = 0; p <= APU_RESAMPLER_PHASES; p++) {
+        float sum = 0;
+        for (uint8_t k = 0; k < APU_RESAMPLER_TAPS; k++) {
+            float u = k + (float) p / APU_RESAMPLER_PHASES;
+            float x = u - APU_RESAMPLER_TAPS / 2;
+            float sinc = (x == 0) ? 2 * cutoff : sinf(2 * PI * cutoff * x) / (PI * x);
+            float window = 0.42f - 0.5f * cosf(2 * PI * u / APU_RESAMPLER_TAPS)
+                    + 0.08f * cosf(4 * PI * u / APU_RESAMPLER_TAPS);
+            r->kernel[p][k] = sinc * window;
+            sum += r->kernel[p][k];
+        }
+        // Unity gain at DC for every phase
+        for (uint8_t k = 0; k < APU_RESAMPLER_TAPS; k++) {
+            r->kernel[p][k] /= sum;
+        }
+    }
+}
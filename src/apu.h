@@ -0,0 +1,135 @@
+// Audio processing unit with the four DMG channels. Nothing is stepped per
+// cycle, the APU is caught up in batches right before a sound register is
+// written and at the end of each frame. Within a batch the channels are only
+// sampled once per native sample period.
+//
+// Sound registers are kept in console memory with their unreadable bits
+// already set, so reads don't need the APU. Samples are only synthesized when
+// something consumes them. Otherwise catching up just runs the frame
+// sequencer (length, sweep and envelope) so NR52 still reads correctly.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// One native sample every 32 T-cycles, 131072Hz
+#define APU_SAMPLE_PERIOD 32
+#define APU_NATIVE_RATE (4194304 / APU_SAMPLE_PERIOD)
+// Stereo frames buffered before they're handed to the sink
+#define APU_BUFFER_FRAMES 4096
+
+// Band-limited resampler kernel size
+#define APU_RESAMPLER_TAPS 32
+#define APU_RESAMPLER_PHASES 64
+
+typedef enum {
+    NR10 = 0xFF10, // Channel 1 sweep
+    NR11 = 0xFF11, // Channel 1 duty and length
+    NR12 = 0xFF12, // Channel 1 envelope
+    NR13 = 0xFF13, // Channel 1 frequency low bits
+    NR14 = 0xFF14, // Channel 1 trigger, length enable and frequency high bits
+    NR21 = 0xFF16,
+    NR22 = 0xFF17,
+    NR23 = 0xFF18,
+    NR24 = 0xFF19,
+    NR30 = 0xFF1A, // Channel 3 DAC enable
+    NR31 = 0xFF1B,
+    NR32 = 0xFF1C, // Channel 3 output level
+    NR33 = 0xFF1D,
+    NR34 = 0xFF1E,
+    NR41 = 0xFF20,
+    NR42 = 0xFF21,
+    NR43 = 0xFF22, // Channel 4 clock shift, LFSR width and divisor
+    NR44 = 0xFF23,
+    NR50 = 0xFF24, // Master volume
+    NR51 = 0xFF25, // Panning
+    NR52 = 0xFF26, // Power and channel status
+    WAVE_RAM = 0xFF30,
+    WAVE_RAM_END = 0xFF3F,
+    APU_FIRST_REGISTER = NR10,
+    APU_LAST_REGISTER = WAVE_RAM_END
+}apu_registers;
+
+typedef struct {
+    bool enabled; // Shows up in NR52
+    bool dac_enabled;
+    bool length_enabled;
+    uint16_t length; // Length counter, the channel stops when it hits 0
+    uint16_t frequency; // 11-bit frequency register
+
+    int32_t timer; // T-cycles until the next duty/wave/LFSR step
+    uint16_t position; // Duty step, wave sample or LFSR table index
+
+    // Volume envelope, unused by the wave channel
+    uint8_t volume;
+    uint8_t envelope_timer;
+
+    // Frequency sweep, channel 1 only
+    bool sweep_enabled;
+    uint16_t sweep_frequency; // Shadow frequency
+    uint8_t sweep_timer;
+}apu_channel;
+
+// Converts between sample rates with a windowed sinc, keeping enough history
+// for one kernel. Only used when the output rate isn't the native rate.
+typedef struct {
+    float kernel[APU_RESAMPLER_PHASES + 1][APU_RESAMPLER_TAPS];
+    float history[2][APU_RESAMPLER_TAPS * 2]; // Doubled so a kernel's worth is always contiguous
+    uint32_t index;
+    int64_t phase; // Time of the next output sample relative to the newest input, scaled by the output rate
+    uint32_t output_rate;
+}apu_resampler;
+
+// Receives finished stereo frames, interleaved left/right.
+typedef void (*apu_sample_sink)(void* user, const int16_t* samples, uint32_t frame_count);
+
+typedef struct {
+    apu_channel channels[4];
+    uint8_t wave_table[32]; // Wave RAM samples with the NR32 volume shift applied
+
+    uint64_t clock; // T-cycle the APU has been caught up to
+    uint64_t next_frame_step; // T-cycle of the next frame sequencer step
+    uint8_t frame_step;
+    uint8_t sample_countdown; // T-cycles until the next native sample
+
+    // Output, kept across resets
+    bool synthesize; // Off when there's no sink, only register behavior is emulated
+    apu_sample_sink sink;
+    void* sink_user;
+    bool resample;
+    apu_resampler resampler;
+
+    int16_t buffer[APU_BUFFER_FRAMES * 2];
+    uint32_t buffered_frames;
+}apu_state;
+
+/// Puts the APU in its power on state. The output settings are kept.
+/// \param memory Console address space, the sound registers are reset too
+void apu_reset(apu_state* apu, uint8_t* memory);
+
+// Puts the sound registers and channels where the DMG boot ROM leaves them.
+// Called right after apu_reset(), at clock 0.
+void apu_apply_post_boot(apu_state* apu, uint8_t* memory);
+
+/// Sets where samples go.
+/// \param sink Called with every batch of samples. NULL turns synthesis off.
+/// \param output_rate APU_NATIVE_RATE, or a lower rate to resample to
+void apu_set_output(apu_state* apu, apu_sample_sink sink, void* user, uint32_t output_rate);
+
+/// Runs the APU up to the given time.
+/// \param memory Console address space, holding the sound registers
+/// \param clock Machine clock in M-cycles
+void apu_catch_up(apu_state* apu, uint8_t* memory, uint64_t clock);
+
+/// Handles a write to a sound register or wave RAM. The APU is caught up
+/// first so the old settings apply to everything before the write.
+/// \param memory Console address space, holding the sound registers
+/// \param clock Machine clock in M-cycles
+void apu_write(apu_state* apu, uint8_t* memory, uint64_t clock, uint16_t address, uint8_t value);
+
+// Returns true if NR52's channel bits can change without a register write,
+// so reading it needs a catch-up first.
+bool apu_status_changing(const apu_state* apu);
+
+// Catches up and hands everything generated so far to the sink.
+void apu_end_frame(apu_state* apu, uint8_t* memory, uint64_t clock);
@@ -0,0 +1,134 @@
+// Benchmark for the interpreter cores. Runs each ROM headless and uncapped
+// for a fixed number of frames on every core, and reports guest throughput
+// together with host counters attributed per frame (see perf_counters.h), so
+// work on the cores and the bus can be compared with hard numbers.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "file.h"
+
+#include "machine.h"
+#include "cpu.h"
+#include "perf_counters.h"
+
+#define DEFAULT_BENCH_FRAMES 3600
+
+static void print_instructions() {
+    LOG_MSG(info, "Usage: dmgem-bench [options] ROM...\n");
+    LOG_MSG(info, "  --frames N  Frames to run each ROM for (default %d)\n", DEFAULT_BENCH_FRAMES);
+    LOG_MSG(info, "  --core C    Only run core C, switch or decoded (default all)\n");
+}
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Runs a ROM on one core and logs the results
+// \return false if the machine couldn't be set up
+static bool bench_core(const uint8_t* rom_data, uint32_t rom_size, cpu_core core, uint32_t frames) {
+    machine_state machine = {.core = core};
+    if (!machine_init(&machine, rom_data, rom_size)) {
+        machine_free(&machine);
+        return false;
+    }
+
+    perf_counters perf = {0};
+    bool measuring = perf_counters_open(&perf);
+    struct timespec start = {0};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    bool running = true;
+    uint64_t next_frame = MACHINE_CYCLES_PER_FRAME;
+    for (uint32_t frame = 0; frame < frames && running; frame++) {
+        while (running && machine.clock < next_frame) {
+            running = cpu_step(&machine) != 0;
+        }
+        next_frame += MACHINE_CYCLES_PER_FRAME;
+        if (measuring) {
+            perf_counters_frame(&perf);
+        }
+    }
+
+    double seconds = elapsed_seconds(&start);
+    if (measuring) {
+        perf_counters_close(&perf);
+    }
+    double emulated = (double) machine.clock / MACHINE_CYCLES_PER_SECOND;
+    LOG_MSG(info, "%s core: %.2fs emulated in %.3fs, %.2fx real time, %.2f million guest instructions per second%s\n",
+            cpu_core_names[core], emulated, seconds, emulated / seconds, machine.stats.instructions / seconds / 1e6,
+            running ? "" : ", CPU stopped early");
+    if (measuring) {
+        perf_counters_report(&perf, cpu_core_names[core], machine.stats.instructions);
+    }
+    machine_free(&machine);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t frames = DEFAULT_BENCH_FRAMES;
+    int core_filter = -1;
+    char** rom_paths = calloc(argc, sizeof(*rom_paths));
+    if (rom_paths == NULL) {
+        LOG_MSG(error, "Failed to allocate the ROM list\n");
+        return 1;
+    }
+    int rom_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--core") == 0 && i + 1 < argc) {
+            i++;
+            for (uint8_t core = 0; core < CPU_CORE_COUNT; core++) {
+                if (strcmp(argv[i], cpu_core_names[core]) == 0) {
+                    core_filter = core;
+                }
+            }
+            if (core_filter == -1) {
+                LOG_MSG(error, "Unknown core %s\n", argv[i]);
+                free(rom_paths);
+                return 1;
+            }
+        }
+        else {
+            rom_paths[rom_count++] = argv[i];
+        }
+    }
+    if (rom_count == 0) {
+        LOG_MSG(error, "No ROM file provided.\n");
+        print_instructions();
+        free(rom_paths);
+        return 1;
+    }
+
+    int failures = 0;
+    for (int i = 0; i < rom_count; i++) {
+        uint32_t rom_size = 0;
+        uint8_t* rom_data = file_load(rom_paths[i], &rom_size);
+        if (rom_data == NULL) {
+            failures++;
+            continue;
+        }
+        LOG_MSG(info, "%s, %u frames\n", rom_paths[i], frames);
+        for (uint8_t core = 0; core < CPU_CORE_COUNT; core++) {
+            if (core_filter != -1 && core != core_filter) {
+                continue;
+            }
+            if (!bench_core(rom_data, rom_size, core, frames)) {
+                LOG_MSG(error, "Failed to initialize the machine\n");
+                failures++;
+                break;
+            }
+        }
+        free(rom_data);
+    }
+    free(rom_paths);
+    return (failures != 0);
+}
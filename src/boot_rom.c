@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "logging.h"
+#include "file.h"
+
+#include "boot_rom.h"
+#include "bus.h"
+#include "serial.h"
+
+// Where the boot ROM draws the logo from the cartridge header
+#define LOGO_HEADER_ADDRESS 0x104
+#define LOGO_SIZE 48
+#define LOGO_TILES 0x8010
+#define LOGO_MAP_TOP 0x9904
+#define LOGO_MAP_BOTTOM 0x9924
+#define LOGO_TILES_PER_ROW 12
+#define REGISTERED_TILE 0x19
+#define REGISTERED_MAP 0x9910
+#define HEADER_CHECKSUM_ADDRESS 0x14D
+
+// The (R) next to the logo, stored in the boot ROM itself
+static const uint8_t registered_tile[8] = {0x3C, 0x42, 0xB9, 0xA5, 0xB9, 0xA5, 0x42, 0x3C};
+
+// I/O registers the boot ROM leaves in a state that isn't their power on
+// one, and that the components don't set themselves
+static const struct {
+    uint16_t address;
+    uint8_t value;
+}post_boot_io[] = {
+    {SERIAL_CONTROL, 0x7E},
+    {0xFF04, 0xAB}, // DIV
+    {0xFF07, 0xF8}, // TAC
+    {INTERRUPT_REQUEST, 0xE1},
+    {OAM_DMA, 0xFF},
+    {OBP0, 0xFF},
+    {OBP1, 0xFF},
+    {BOOT_ROM_DISABLE, 0xFF}
+};
+
+// Doubles each of the top 4 bits of a nibble, 0b1010 becomes 0b11001100
+static uint8_t stretch_nibble(uint8_t nibble) {
+    uint8_t stretched = 0;
+    for (uint8_t bit = 0; bit < 4; bit++) {
+        if (nibble & (0x8 >> bit)) {
+            stretched |= 0xC0 >> (2 * bit);
+        }
+    }
+    return stretched;
+}
+
+// The logo in the header is 1 bit per pixel at half size. Every nibble is a
+// row of 4 pixels, drawn twice as wide and twice as tall into the low bit
+// plane of tiles 1-24. The (R) is tile 25.
+static void draw_logo(machine_state* machine) {
+    uint8_t* memory = machine->console_memory;
+    const uint8_t* logo = machine->cartridge_rom + LOGO_HEADER_ADDRESS;
+    uint8_t* row = memory + LOGO_TILES;
+    for (uint8_t i = 0; i < LOGO_SIZE; i++) {
+        uint8_t nibbles[2] = {logo[i] >> 4, logo[i] & 0xF};
+        for (uint8_t n = 0; n < 2; n++) {
+            row[0] = stretch_nibble(nibbles[n]);
+            row[2] = row[0];
+            row += 4;
+        }
+    }
+    uint8_t* registered = memory + LOGO_TILES + (REGISTERED_TILE - 1) * 16;
+    for (uint8_t i = 0; i < sizeof(registered_tile); i++) {
+        registered[i * 2] = registered_tile[i];
+    }
+
+    for (uint8_t tile = 0; tile < LOGO_TILES_PER_ROW; tile++) {
+        memory[LOGO_MAP_TOP + tile] = tile + 1;
+        memory[LOGO_MAP_BOTTOM + tile] = tile + 1 + LOGO_TILES_PER_ROW;
+    }
+    memory[REGISTERED_MAP] = REGISTERED_TILE;
+}
+
+void boot_rom_skip(machine_state* machine) {
+    uint8_t* memory = machine->console_memory;
+    cpu_state* cpu = &machine->cpu;
+    // Half carry and carry are only set if the header checksum isn't 0
+    bool checksum = machine->rom_size > HEADER_CHECKSUM_ADDRESS && machine->cartridge_rom[HEADER_CHECKSUM_ADDRESS] != 0;
+    cpu->AF = 0x0100 | FLAG_ZERO | (checksum ? FLAG_HALF_CARRY | FLAG_CARRY : 0);
+    cpu->BC = 0x0013;
+    cpu->DE = 0x00D8;
+    cpu->HL = 0x014D;
+    cpu->SP = 0xFFFE;
+    cpu->PC = 0x0100;
+    cpu->IME = 0;
+
+    if (machine->rom_size >= LOGO_HEADER_ADDRESS + LOGO_SIZE) {
+        draw_logo(machine);
+    }
+    for (uint8_t i = 0; i < sizeof(post_boot_io) / sizeof(post_boot_io[0]); i++) {
+        memory[post_boot_io[i].address] = post_boot_io[i].value;
+    }
+    // Both groups were selected last, when it read the buttons
+    joypad_write(&machine->joypad, memory, 0);
+    apu_apply_post_boot(&machine->apu, memory);
+    memory[BGP] = 0xFC;
+    // LCD and background on, tile data at 0x8000
+    ppu_write(&machine->ppu, memory, machine->clock, LCDC, 0x91);
+}
+
+bool boot_rom_load(machine_state* machine, const char* path) {
+    uint32_t size = 0;
+    uint8_t* data = file_load(path, &size);
+    if (data == NULL) {
+        return false;
+    }
+    bool loaded = machine_set_boot_rom(machine, data, size);
+    free(data);
+    if (loaded) {
+        LOG_MSG(debug, "Running boot ROM %s\n", path);
+    }
+    return loaded;
+}
+
+void boot_rom_write(machine_state* machine, uint8_t value) {
+    if (!machine->boot_rom_mapped || !(value & 1)) {
+        return;
+    }
+    machine->boot_rom_mapped = false;
+    machine->console_memory[BOOT_ROM_DISABLE] = 0xFF;
+    bus_map_cartridge_pages(machine);
+}
@@ -0,0 +1,29 @@
+// DMG boot ROM. A machine either runs a boot ROM supplied by the user, mapped
+// over 0x0000-0x00FF until a write to 0xFF50 unmaps it for good, or skips it
+// and starts in the state the boot ROM hands over in: registers, I/O and the
+// logo it leaves in VRAM. Skipping is a handful of writes at reset, so it's
+// the default.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "machine.h"
+
+#define BOOT_ROM_SIZE 0x100
+
+typedef enum {
+    BOOT_ROM_DISABLE = 0xFF50 // Writing a value with bit 0 set unmaps the boot ROM
+}boot_rom_registers;
+
+/// Puts the machine where the DMG boot ROM leaves it, with PC at the
+/// cartridge entry point.
+/// \param machine Machine in its power on state, at clock 0
+void boot_rom_skip(machine_state* machine);
+
+/// Loads a boot ROM file into a machine and resets it to run from 0.
+/// \return false if the file couldn't be read or isn't BOOT_ROM_SIZE bytes
+bool boot_rom_load(machine_state* machine, const char* path);
+
+// Handles a write to BOOT_ROM_DISABLE.
+void boot_rom_write(machine_state* machine, uint8_t value);
@@ -1,7 +1,14 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "bus.h"
 #include "memory_controllers.h"
+#include "serial.h"
+#include "debugger.h"
+#include "heatmap.h"
+#include "joypad.h"
+#include "determinism.h"
+#include "boot_rom.h"
 
 bool bus_address_in_rom(uint16_t address) {
     return (address <= 0x7FFF);
@@ -11,7 +18,176 @@ bool bus_address_in_external_ram(uint16_t address) {
     return (address >= 0xA000 && address <= 0xBFFF);
 }
 
-uint8_t* bus_read(uint16_t address, const machine_state* machine) {
+bool bus_address_in_io(uint16_t address) {
+    return (address >= 0xFF00 && address <= 0xFF7F);
+}
+
+// What the CPU sees while the bus is blocked
+static const uint8_t open_bus = 0xFF;
+
+// I/O and HRAM are read directly unless NR52 is about to change on its own,
+// in which case reads go through the slow path to catch the APU up
+static void map_io_page(machine_state* machine) {
+    uint8_t page = 0xFF00 >> BUS_PAGE_SHIFT;
+    bool changing = apu_status_changing(&machine->apu) || (machine->watched_pages[page] & WATCH_READ) ||
+                    machine->heatmap != NULL;
+    machine->read_pages[page] = changing ? NULL : machine->console_memory + 0xFF00;
+}
+
+// Pages with a debugger watchpoint are left to the slow path, which is the
+// only place accesses get checked. Nothing else pays for watchpoints. A
+// heatmap needs to see every access, so it unmaps everything. A state hasher
+// write protects whatever is still mapped after that.
+static void unmap_watched_pages(machine_state* machine, uint16_t first_page, uint16_t last_page) {
+    if (machine->heatmap != NULL) {
+        for (uint16_t page = first_page; page <= last_page; page++) {
+            machine->read_pages[page] = NULL;
+            machine->write_pages[page] = NULL;
+        }
+    }
+    else if (machine->debugger != NULL) {
+        for (uint16_t page = first_page; page <= last_page; page++) {
+            if (machine->watched_pages[page] & WATCH_READ) {
+                machine->read_pages[page] = NULL;
+            }
+            if (machine->watched_pages[page] & WATCH_WRITE) {
+                machine->write_pages[page] = NULL;
+            }
+        }
+    }
+    if (machine->hasher != NULL) {
+        state_hasher_protect(machine->hasher, first_page, last_page);
+    }
+}
+
+// Routes everything below the I/O page through the slow path, which rejects
+// it until the OAM DMA transfer is over
+static void block_pages_for_dma(machine_state* machine) {
+    for (uint16_t page = 0; page < (0xFF00 >> BUS_PAGE_SHIFT); page++) {
+        machine->read_pages[page] = NULL;
+        machine->write_pages[page] = NULL;
+    }
+}
+
+// Registers with side effects on write are forwarded to their component
+static void io_write(uint16_t address, uint8_t value, machine_state* machine) {
+    switch (address) {
+        case SERIAL_CONTROL:
+            serial_write_control(&machine->serial, machine->console_memory, value);
+            break;
+        case LCDC:
+        case STAT:
+        case LY:
+        case LYC:
+            ppu_write(&machine->ppu, machine->console_memory, machine->clock, address, value);
+            break;
+        case JOYP:
+            joypad_write(&machine->joypad, machine->console_memory, value);
+            break;
+        case BOOT_ROM_DISABLE:
+            boot_rom_write(machine, value);
+            break;
+        case OAM_DMA:
+            // The register reads back the last value written
+            machine->console_memory[address] = value;
+            bus_start_dma(machine, value);
+            break;
+        default:
+            if (address >= APU_FIRST_REGISTER && address <= APU_LAST_REGISTER) {
+                apu_write(&machine->apu, machine->console_memory, machine->clock, address, value);
+                map_io_page(machine);
+                break;
+            }
+            machine->console_memory[address] = value;
+            break;
+    }
+}
+
+// The boot ROM covers the first page of the cartridge until it's unmapped
+static void map_boot_rom(machine_state* machine) {
+    if (machine->boot_rom_mapped) {
+        machine->read_pages[0] = machine->boot_rom;
+    }
+}
+
+void bus_map_cartridge_pages(machine_state* machine) {
+    uint8_t first_ram_page = 0xA000 >> BUS_PAGE_SHIFT;
+    uint8_t last_ram_page = 0xBFFF >> BUS_PAGE_SHIFT;
+    uint8_t last_rom_page = 0x7FFF >> BUS_PAGE_SHIFT;
+
+    if (machine->memory_controller == NONE) {
+        // The ROM is copied into console memory and can't be written.
+        // External RAM writes have nowhere to go either.
+        for (uint16_t page = 0; page <= last_rom_page; page++) {
+            machine->read_pages[page] = machine->console_memory + (page << BUS_PAGE_SHIFT);
+            machine->write_pages[page] = NULL;
+        }
+        for (uint16_t page = first_ram_page; page <= last_ram_page; page++) {
+            machine->read_pages[page] = machine->console_memory + (page << BUS_PAGE_SHIFT);
+            machine->write_pages[page] = NULL;
+        }
+        map_boot_rom(machine);
+        unmap_watched_pages(machine, 0, last_ram_page);
+        return;
+    }
+
+    // A page never crosses a bank boundary, so the controller's answer for
+    // the first byte holds for the whole page. Writes to ROM are controller
+    // registers, so they always take the slow path.
+    for (uint16_t page = 0; page <= last_rom_page; page++) {
+        machine->read_pages[page] = controller_read(page << BUS_PAGE_SHIFT, machine);
+        machine->write_pages[page] = NULL;
+    }
+    bool ram_mapped = machine->controller.ram_enabled && machine->ram_bank_count != 0;
+    for (uint16_t page = first_ram_page; page <= last_ram_page; page++) {
+        uint8_t* target = NULL;
+        if (ram_mapped) {
+            target = controller_read(page << BUS_PAGE_SHIFT, machine);
+        }
+        // Writes still take the slow path, which counts them in stats
+        machine->read_pages[page] = target;
+        machine->write_pages[page] = NULL;
+    }
+    map_boot_rom(machine);
+    unmap_watched_pages(machine, 0, last_ram_page);
+}
+
+void bus_map_pages(machine_state* machine) {
+    for (uint16_t page = 0; page < BUS_PAGE_COUNT; page++) {
+        uint8_t* target = machine->console_memory + (page << BUS_PAGE_SHIFT);
+        machine->read_pages[page] = target;
+        machine->write_pages[page] = target;
+    }
+    // I/O registers have side effects on write
+    machine->write_pages[0xFF00 >> BUS_PAGE_SHIFT] = NULL;
+    map_io_page(machine);
+    // That takes care of its own pages
+    bus_map_cartridge_pages(machine);
+    unmap_watched_pages(machine, (0xBFFF >> BUS_PAGE_SHIFT) + 1, BUS_PAGE_COUNT - 1);
+    if (machine->dma_remaining_cycles != 0) {
+        block_pages_for_dma(machine);
+    }
+}
+
+uint8_t* bus_read_slow(uint16_t address, machine_state* machine) {
+    machine->stats.slow_reads++;
+    // Only I/O and HRAM are reachable while OAM DMA owns the bus
+    if (machine->dma_remaining_cycles != 0 && address < 0xFF00) {
+        return (uint8_t*) &open_bus;
+    }
+    if (machine->watched_pages[address >> BUS_PAGE_SHIFT] & WATCH_READ) {
+        debugger_check_access(machine->debugger, address, WATCH_READ);
+    }
+    if (machine->heatmap != NULL) {
+        heatmap_count(machine->heatmap, address, HEATMAP_READ);
+    }
+    if (address == NR52) {
+        apu_catch_up(&machine->apu, machine->console_memory, machine->clock);
+        map_io_page(machine);
+    }
+    if (machine->boot_rom_mapped && address < BOOT_ROM_SIZE) {
+        return &machine->boot_rom[address];
+    }
     // These are handled by the memory controller
     if ((bus_address_in_rom(address) || bus_address_in_external_ram(address))) {
         // Extra if statement keeps code horizontally short
@@ -19,21 +195,56 @@ uint8_t* bus_read(uint16_t address, const machine_state* machine) {
             return controller_read(address, machine);
         }
     }
-    else {
-        // Normal memory read, return address of the target byte
-        return &machine->console_memory[address];
+    // Normal memory read, return address of the target byte. Carts without a
+    // controller have their ROM copied here by machine_init().
+    return &machine->console_memory[address];
+}
+
+const uint8_t* bus_peek(const machine_state* machine, uint16_t address) {
+    const uint8_t* page = machine->read_pages[address >> BUS_PAGE_SHIFT];
+    if (page != NULL) {
+        return &page[address & BUS_PAGE_MASK];
+    }
+    if (machine->dma_remaining_cycles != 0 && address < 0xFF00) {
+        return NULL;
+    }
+    if (machine->boot_rom_mapped && address < BOOT_ROM_SIZE) {
+        return &machine->boot_rom[address];
     }
-    return NULL; // Oh well.
+    if ((bus_address_in_rom(address) || bus_address_in_external_ram(address)) && machine->memory_controller != NONE) {
+        return controller_read(address, machine);
+    }
+    return &machine->console_memory[address];
 }
 
-void bus_write_8_bit(uint16_t address, uint8_t value, const machine_state* machine) {
+void bus_write_slow(uint16_t address, uint8_t value, machine_state* machine) {
+    machine->stats.slow_writes++;
+    if (machine->dma_remaining_cycles != 0 && address < 0xFF00) {
+        return;
+    }
+    if (machine->hasher != NULL) {
+        state_hasher_write(machine->hasher, address);
+    }
+    if (machine->watched_pages[address >> BUS_PAGE_SHIFT] & WATCH_WRITE) {
+        debugger_check_access(machine->debugger, address, WATCH_WRITE);
+    }
+    if (machine->heatmap != NULL) {
+        heatmap_count(machine->heatmap, address, HEATMAP_WRITE);
+    }
     // These are handled by the memory controller
     if ((bus_address_in_rom(address) || bus_address_in_external_ram(address))) {
         // Extra if statement keeps code horizontally short
         if (machine->memory_controller != NONE) {
             controller_write_8_bit(address, value, machine);
+            // Banks or RAM enable might have changed
+            if (bus_address_in_rom(address)) {
+                bus_map_cartridge_pages(machine);
+            }
         }
     }
+    else if (bus_address_in_io(address)) {
+        io_write(address, value, machine);
+    }
     else {
         if (!bus_address_in_rom(address)) {
             // Normal memory read, return address of the target byte
@@ -41,10 +252,65 @@ void bus_write_8_bit(uint16_t address, uint8_t value, const machine_state* machi
         }
     }
 }
-void bus_write_16_bit(uint16_t address, uint16_t value, const machine_state* machine) {
+
+void bus_start_dma(machine_state* machine, uint8_t source_page) {
+    // Sources past work RAM read from its echo
+    if (source_page >= 0xE0) {
+        source_page -= 0x20;
+    }
+    // A restarted transfer still copies the source, not the open bus a
+    // blocked read returns. Its pages stay unmapped until the new one ends.
+    machine->dma_remaining_cycles = 0;
+    uint8_t* oam = machine->console_memory + OAM_ADDRESS;
+    const uint8_t* source = machine->read_pages[source_page];
+    if (source != NULL) {
+        memcpy(oam, source, OAM_SIZE);
+    }
+    else {
+        // Disabled cartridge RAM, or a transfer started while another one
+        // is blocking the bus
+        for (uint8_t i = 0; i < OAM_SIZE; i++) {
+            oam[i] = *bus_read_slow((source_page << BUS_PAGE_SHIFT) | i, machine);
+        }
+    }
+
+    machine->dma_remaining_cycles = OAM_DMA_CYCLES;
+    block_pages_for_dma(machine);
+}
+
+void bus_advance_dma(machine_state* machine, uint8_t cycles) {
+    if (cycles < machine->dma_remaining_cycles) {
+        machine->dma_remaining_cycles -= cycles;
+        return;
+    }
+    machine->dma_remaining_cycles = 0;
+    bus_map_pages(machine);
+}
+
+uint16_t bus_read_16_bit(uint16_t address, machine_state* machine) {
+    const uint8_t* page = machine->read_pages[address >> BUS_PAGE_SHIFT];
+    uint8_t offset = address & BUS_PAGE_MASK;
+    if (page != NULL && offset != BUS_PAGE_MASK) {
+        // Both bytes are in the same plain memory page. memcpy() compiles to
+        // a single unaligned load.
+        uint16_t value = 0;
+        memcpy(&value, page + offset, sizeof(value));
+        return value;
+    }
+    uint8_t low = *bus_read(address, machine);
+    uint8_t high = *bus_read(address + 1, machine);
+    return (high << 8) | low;
+}
+
+void bus_write_16_bit(uint16_t address, uint16_t value, machine_state* machine) {
+    uint8_t* page = machine->write_pages[address >> BUS_PAGE_SHIFT];
+    uint8_t offset = address & BUS_PAGE_MASK;
+    if (page != NULL && offset != BUS_PAGE_MASK) {
+        memcpy(page + offset, &value, sizeof(value));
+        return;
+    }
     uint16_t high = (value & 0xFF00) >> 8;
     uint16_t low = value & 0x00FF;
     bus_write_8_bit(address, low, machine);
     bus_write_8_bit(address + 1, high, machine);
 }
-
@@ -1,15 +1,53 @@
 // Memory bus module that takes addresses from the CPU and forwards them to the
 // appropriate module for read/write
 
+#pragma once
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "machine.h"
 
+typedef enum {
+    OAM_DMA = 0xFF46, // Writing XX starts copying XX00-XX9F to OAM
+    OAM_ADDRESS = 0xFE00,
+    OAM_SIZE = 0xA0,
+    OAM_DMA_CYCLES = 160 // One byte per M-cycle
+}oam_dma_constants;
+
 // Returns true if address is in the range of the external cartridge RAM bank
 bool bus_address_in_external_ram(uint16_t address);
 // Returns true if address is in ROM
 bool bus_address_in_rom(uint16_t address);
+// Returns true if address is an I/O register
+bool bus_address_in_io(uint16_t address);
+
+/// Fills the page tables for the whole address space. Pages that are plain
+/// memory point straight at it, anything with side effects is left NULL so
+/// accesses go through the slow path. Everything below the I/O page stays
+/// unmapped while OAM DMA is running.
+void bus_map_pages(machine_state* machine);
+
+// Refreshes the ROM and external RAM pages after a bank switch.
+void bus_map_cartridge_pages(machine_state* machine);
+
+/// Starts an OAM DMA transfer. The data is copied to OAM right away in one
+/// block, then everything but I/O and HRAM reads 0xFF and ignores writes
+/// until the transfer would have finished on hardware.
+/// \param source_page High byte of the source address
+void bus_start_dma(machine_state* machine, uint8_t source_page);
+
+// Counts down a running OAM DMA transfer and unblocks the bus once it's done.
+void bus_advance_dma(machine_state* machine, uint8_t cycles);
+
+/// Finds the byte the CPU would read at an address, without any side effects
+/// or watchpoint checks. For disassemblers and debuggers.
+/// \return NULL if the bus is blocked by OAM DMA
+const uint8_t* bus_peek(const machine_state* machine, uint16_t address);
+
+// Full address decoding for pages that aren't mapped directly.
+uint8_t* bus_read_slow(uint16_t address, machine_state* machine);
+void bus_write_slow(uint16_t address, uint8_t value, machine_state* machine);
 
 /// Allows data to be read from several multi-bank sources, such as cartridge
 /// ROM/RAM. If trying to read from a section that uses banking, the cartridge
@@ -17,10 +55,27 @@ bool bus_address_in_rom(uint16_t address);
 /// the appropriate bank.
 /// \param address Address to read
 /// \param machine Pointer to the emulator state
-/// \return Pointer to the data the CPU is trying to read. Cast this to a
-/// u16* to read 2 bytes from the address.
-uint8_t* bus_read(uint16_t address, const machine_state* machine);
+/// \return Pointer to the data the CPU is trying to read. Only the byte at
+/// the pointer is valid, use bus_read_16_bit() to read 2 bytes.
+static inline uint8_t* bus_read(uint16_t address, machine_state* machine) {
+    uint8_t* page = machine->read_pages[address >> BUS_PAGE_SHIFT];
+    if (page != NULL) {
+        return &page[address & BUS_PAGE_MASK];
+    }
+    return bus_read_slow(address, machine);
+}
 
-void bus_write_8_bit(uint16_t address, uint8_t value, const machine_state* machine);
-void bus_write_16_bit(uint16_t address, uint16_t value, const machine_state* machine);
+static inline void bus_write_8_bit(uint16_t address, uint8_t value, machine_state* machine) {
+    uint8_t* page = machine->write_pages[address >> BUS_PAGE_SHIFT];
+    if (page != NULL) {
+        page[address & BUS_PAGE_MASK] = value;
+        return;
+    }
+    bus_write_slow(address, value, machine);
+}
 
+/// Reads a little endian 16-bit value. This is a single load when both bytes
+/// are in the same plain memory page, and two byte reads when the value
+/// crosses into another page, bank or I/O register.
+uint16_t bus_read_16_bit(uint16_t address, machine_state* machine);
+void bus_write_16_bit(uint16_t address, uint16_t value, machine_state* machine);
@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+#include "file.h"
+
+#include "coverage.h"
+#include "opcode_info.h"
+#include "bus.h"
+#include "cpu.h"
+
+static const char coverage_magic[8] = "DMGCOV1";
+#define COVERAGE_HEADER_SIZE 16
+
+// Offset in the ROM of the byte the CPU sees at an address, or -1 if it
+// isn't ROM
+static int64_t rom_offset(const machine_state* machine, uint16_t address) {
+    const uint8_t* byte = bus_peek(machine, address);
+    if (byte == NULL) {
+        return -1;
+    }
+    if (byte >= machine->cartridge_rom && byte < machine->cartridge_rom + machine->rom_size) {
+        return byte - machine->cartridge_rom;
+    }
+    // Carts without a controller run from the copy in console memory
+    if (machine->memory_controller == NONE && bus_address_in_rom(address) && byte == machine->console_memory + address) {
+        return address;
+    }
+    return -1;
+}
+
+static void mark(coverage_map* coverage, coverage_kind kind, const machine_state* machine, uint16_t address) {
+    int64_t offset = rom_offset(machine, address);
+    if (offset >= 0) {
+        coverage->bitmaps[kind][offset >> 3] |= 1 << (offset & 7);
+    }
+}
+
+static uint8_t peek_byte(const machine_state* machine, uint16_t address) {
+    const uint8_t* byte = bus_peek(machine, address);
+    return (byte != NULL) ? *byte : 0xFF;
+}
+
+bool coverage_init(coverage_map* coverage, const machine_state* machine) {
+    memset(coverage, 0, sizeof(*coverage));
+    coverage->rom_size = machine->rom_size;
+    coverage->rom_crc = machine->rom_crc;
+    for (uint8_t kind = 0; kind < COVERAGE_KINDS; kind++) {
+        coverage->bitmaps[kind] = calloc((machine->rom_size + 7) / 8, 1);
+        if (coverage->bitmaps[kind] == NULL) {
+            LOG_MSG(error, "Failed to allocate coverage bitmaps\n");
+            coverage_free(coverage);
+            return false;
+        }
+    }
+    return true;
+}
+
+void coverage_free(coverage_map* coverage) {
+    for (uint8_t kind = 0; kind < COVERAGE_KINDS; kind++) {
+        free(coverage->bitmaps[kind]);
+        coverage->bitmaps[kind] = NULL;
+    }
+}
+
+void coverage_record(coverage_map* coverage, const machine_state* machine) {
+    if (!cpu_executes_next(machine)) {
+        return;
+    }
+    const cpu_state* cpu = &machine->cpu;
+    uint16_t pc = cpu->PC;
+    uint8_t opcode = peek_byte(machine, pc);
+    const opcode_info* info = &unprefixed_opcode_info[opcode];
+    if (opcode == 0xCB) {
+        info = &prefixed_opcode_info[peek_byte(machine, pc + 1)];
+    }
+    for (uint8_t i = 0; i < info->length; i++) {
+        mark(coverage, COVERAGE_EXECUTED, machine, pc + i);
+    }
+
+    // Stack and 0xFF00 page accesses can't be ROM
+    if ((info->memory & MEMORY_READ_WRITE) == 0 || (info->memory & (MEMORY_STACK | MEMORY_HIGH)) != 0) {
+        return;
+    }
+    // Everything else with a data access goes through BC, DE, a u16 operand
+    // or HL, which the registers before the instruction still tell
+    uint16_t address = cpu->HL;
+    if (opcode == 0x02 || opcode == 0x0A) {
+        address = cpu->BC;
+    }
+    else if (opcode == 0x12 || opcode == 0x1A) {
+        address = cpu->DE;
+    }
+    else if (info->length == 3) {
+        address = peek_byte(machine, pc + 1) | (peek_byte(machine, pc + 2) << 8);
+    }
+    if (info->memory & MEMORY_READ) {
+        mark(coverage, COVERAGE_READ, machine, address);
+    }
+    if (info->memory & MEMORY_WRITE) {
+        mark(coverage, COVERAGE_WRITTEN, machine, address);
+    }
+}
+
+static uint32_t count_bits(const uint8_t* bitmap, uint32_t size) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        count += __builtin_popcount(bitmap[i]);
+    }
+    return count;
+}
+
+static void write_u32(uint8_t* out, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++) {
+        out[i] = value >> (8 * i);
+    }
+}
+
+static uint32_t read_u32(const uint8_t* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+bool coverage_save(const coverage_map* coverage, const char* dir) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        LOG_MSG(error, "Failed to create %s\n", dir);
+        return false;
+    }
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%08x.cov", dir, coverage->rom_crc);
+
+    uint32_t bitmap_size = (coverage->rom_size + 7) / 8;
+    uint32_t size = COVERAGE_HEADER_SIZE + COVERAGE_KINDS * bitmap_size;
+    uint8_t* file = NULL;
+    if (file_exists(path)) {
+        uint32_t existing_size = 0;
+        file = file_load(path, &existing_size);
+        bool same_rom = file != NULL && existing_size == size && memcmp(file, coverage_magic, sizeof(coverage_magic)) == 0 &&
+                        read_u32(file + 8) == coverage->rom_size && read_u32(file + 12) == coverage->rom_crc;
+        if (!same_rom) {
+            LOG_MSG(warning, "%s isn't coverage of this ROM, replacing it\n", path);
+            free(file);
+            file = NULL;
+        }
+    }
+    if (file == NULL) {
+        file = calloc(size, 1);
+        if (file == NULL) {
+            LOG_MSG(error, "Failed to allocate memory for %s\n", path);
+            return false;
+        }
+        memcpy(file, coverage_magic, sizeof(coverage_magic));
+        write_u32(file + 8, coverage->rom_size);
+        write_u32(file + 12, coverage->rom_crc);
+    }
+
+    uint32_t counts[COVERAGE_KINDS] = {0};
+    for (uint8_t kind = 0; kind < COVERAGE_KINDS; kind++) {
+        uint8_t* merged = file + COVERAGE_HEADER_SIZE + kind * bitmap_size;
+        for (uint32_t i = 0; i < bitmap_size; i++) {
+            merged[i] |= coverage->bitmaps[kind][i];
+        }
+        counts[kind] = count_bits(merged, bitmap_size);
+    }
+
+    FILE* out = fopen(path, "wb");
+    bool written = out != NULL && fwrite(file, size, 1, out) == 1;
+    if (out != NULL) {
+        written = (fclose(out) == 0) && written;
+    }
+    free(file);
+    if (!written) {
+        LOG_MSG(error, "Failed to write %s\n", path);
+        return false;
+    }
+    LOG_MSG(info, "Coverage in %s: %u of %u ROM bytes executed (%.1f%%), %u read, %u written\n",
+            path, counts[COVERAGE_EXECUTED], coverage->rom_size,
+            100.0 * counts[COVERAGE_EXECUTED] / coverage->rom_size, counts[COVERAGE_READ], counts[COVERAGE_WRITTEN]);
+    return true;
+}
@@ -0,0 +1,44 @@
+// Guest code coverage. Every ROM byte across all banks has a bit for being
+// executed as part of an instruction, one for being read as data and one for
+// being written, which for ROM means a memory controller register write.
+// Recording is a few bit sets per instruction, worked out from opcode_info
+// before the instruction runs, so it can stay on for whole test sweeps.
+//
+// Coverage files are the three bitmaps behind a small header, and saving ORs
+// in whatever an earlier run of the same ROM saved:
+//   "DMGCOV1\0", ROM size (u32 LE), ROM CRC32C (u32 LE),
+//   executed, read and written bitmaps of ROM size / 8 bytes each,
+//   with the bit for ROM offset n at byte n / 8, bit n % 8.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "machine.h"
+
+typedef enum {
+    COVERAGE_EXECUTED,
+    COVERAGE_READ,
+    COVERAGE_WRITTEN,
+    COVERAGE_KINDS
+}coverage_kind;
+
+typedef struct {
+    uint32_t rom_size;
+    uint32_t rom_crc; // Files from other ROMs aren't merged
+    uint8_t* bitmaps[COVERAGE_KINDS]; // A bit per ROM byte each
+}coverage_map;
+
+/// Sets up empty bitmaps for the machine's ROM.
+/// \return false if allocation failed
+bool coverage_init(coverage_map* coverage, const machine_state* machine);
+void coverage_free(coverage_map* coverage);
+
+// Records the instruction at PC and its data access, unless the next step
+// only dispatches an interrupt or idles in HALT. Call before cpu_step().
+void coverage_record(coverage_map* coverage, const machine_state* machine);
+
+/// Saves the bitmaps to DIR/<ROM CRC32C>.cov, merged with the file already
+/// there if it's for the same ROM.
+/// \return false if the file couldn't be written
+bool coverage_save(const coverage_map* coverage, const char* dir);
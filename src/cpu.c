@@ -8,6 +8,8 @@
 #include "bus.h"
 #include "machine.h"
 #include "sm83_operations.h"
+#include "opcode_info.h"
+#include "decoder.h"
 
 typedef struct {
     uint8_t unused: 4;
@@ -18,49 +20,26 @@ typedef struct {
     bool vblank: 1;
 }interrupt_flags;
 
-static uint8_t get_execution_time(const machine_state* machine, const cpu_state* cpu) {
-    uint16_t opcode = *bus_read(cpu->PC, machine);
-    switch (opcode) {
-        // These instructions have variable execution times depending on the
-        // state of the CPU. If they don't need to take the slower path, the
-        // value can just be fetched from the table.
-        case JP_Z_U16:
-        case CALL_Z_U16:
-        case JP_C_U16:
-        case CALL_C_U16:
-            LOG_MSG(warning, "Instruction encountered at $%04x needs special logic to determine its execution time. Defaulting to best-case execution time...\n", cpu->PC);
-        case JP_NC_U16:
-            if (!cpu->F.carry) { return 4; }
-        case JP_NZ_U16:
-            if (!cpu->F.zero) { return 4; }
-        case CALL_NC_U16:
-            if (!cpu->F.carry) { return 6; }
-        case CALL_NZ_U16:
-            if (!cpu->F.zero) { return 6; }
-        case JR_Z_i8:
-            if (cpu->F.zero) { return 3; }
-        case JR_NZ_i8:
-            if (!cpu->F.zero) { return 3; }
-        case JR_C_i8:
-            if (cpu->F.carry) { return 3; }
-        case JR_NC_i8:
-            if (!cpu->F.carry) { return 3; }
+// Opcode bytes are peeked, since the core fetches them again and only that
+// fetch should show up in heatmaps and stats. DMA blocks the bus with 0xFF.
+static uint8_t peek_opcode(const machine_state* machine, uint16_t address) {
+    const uint8_t* byte = bus_peek(machine, address);
+    return byte != NULL ? *byte : 0xFF;
+}
 
-        case RET_C:
-            if (cpu->F.carry) { return 5; }
-        case RET_NC:
-            if (!cpu->F.carry) { return 5; }
-        case RET_Z:
-            if (cpu->F.zero) { return 5; }
-        case RET_NZ:
-            if (!cpu->F.zero) { return 5; }
-        default:
-            return opcode_cycles[opcode];
+// Conditional instructions pick their timing from the flags without branching.
+// The only branch is choosing the opcode map.
+static uint8_t get_execution_time(const machine_state* machine, const cpu_state* cpu) {
+    uint8_t opcode = peek_opcode(machine, cpu->PC);
+    const opcode_info* info = &unprefixed_opcode_info[opcode];
+    if (opcode == PREFIX) {
+        info = &prefixed_opcode_info[peek_opcode(machine, cpu->PC + 1)];
     }
+    return opcode_execution_time(info, cpu->AF & 0xFF);
 }
 
 // Used to handle opcodes prefixed with 0xCB.
-static bool execute_prefix(cpu_state* cpu, const machine_state* machine) {
+static bool execute_prefix(cpu_state* cpu, machine_state* machine) {
     uint8_t opcode = *bus_read(cpu->PC, machine);
     switch (opcode) {
         case RR_B:
@@ -145,17 +124,18 @@ static bool execute_prefix(cpu_state* cpu, const machine_state* machine) {
     return true;
 }
 
-static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
-    cpu->executing = false;
+static bool execute_switch(cpu_state* cpu, machine_state* machine) {
     uint8_t opcode = *bus_read(cpu->PC, machine);
+#ifdef DMGEM_TRACE
     // Program counter before execution so the right address is printed at the end
     uint16_t opcode_pc = cpu->PC;
+#endif
     cpu->PC++; // Increment PC to save a line of code on all single-byte opcodes
     switch (opcode) {
         case NOP:
             break;
         case LD_BC_U16:
-            cpu->BC = *(uint16_t*) bus_read(cpu->PC, machine);
+            cpu->BC = bus_read_16_bit(cpu->PC, machine);
             cpu->PC += 2;
             break;
         case INC_BC:
@@ -176,7 +156,7 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
         case LD_U16_SP:
             // Scope lets us declare this variable without compiler warnings
             {
-                uint16_t address_0x08 = *(uint16_t*) bus_read(cpu->PC, machine);
+                uint16_t address_0x08 = bus_read_16_bit(cpu->PC, machine);
                 bus_write_16_bit(address_0x08, cpu->SP, machine);
             }
             cpu->PC += 2;
@@ -195,12 +175,11 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
             break;
         case STOP:
             // TODO: This needs to do a lot more interrupt handling and stuff
-            cpu->executing = false;
-            cpu->PC++;
+                    cpu->PC++;
             return false;
             break;
         case LD_DE_U16:
-            cpu->DE = *(uint16_t*) bus_read(cpu->PC, machine);
+            cpu->DE = bus_read_16_bit(cpu->PC, machine);
             cpu->PC += 2;
             break;
         case LD_DE_A:
@@ -249,7 +228,7 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
             }
             break;
         case LD_HL_U16:
-            cpu->HL = *(uint16_t*) bus_read(cpu->PC, machine);
+            cpu->HL = bus_read_16_bit(cpu->PC, machine);
             cpu->PC += 2;
             break;
         case LDI_HL_A:
@@ -302,7 +281,7 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
             }
             break;
         case LD_SP_U16:
-            cpu->SP = *(uint16_t*) bus_read(cpu->PC, machine);
+            cpu->SP = bus_read_16_bit(cpu->PC, machine);
             cpu->PC += 2;
             break;
         case LDD_HL_A:
@@ -314,7 +293,7 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
         case INC_HL_8:
             // Scope lets us declare this variable without compiler warnings
             {
-                uint16_t address = *(uint16_t*)bus_read(cpu->PC, machine);
+                uint16_t address = bus_read_16_bit(cpu->PC, machine);
                 cpu->PC += 2;
                 register8 value = *bus_read(address, machine);
                 value = sm83_add8(value, 1, cpu);
@@ -324,7 +303,7 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
         case DEC_HL_8:
             // Scope lets us declare this variable without compiler warnings
             {
-                uint16_t address = *(uint16_t*)bus_read(cpu->PC, machine);
+                uint16_t address = bus_read_16_bit(cpu->PC, machine);
                 cpu->PC += 2;
                 register8 value = *bus_read(address, machine);
                 value = sm83_sub8(value, 1, cpu);
@@ -351,6 +330,7 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
             break;
         case LD_B_B:
             cpu->B = cpu->B; // NOP, probably optimized out
+            cpu->software_breakpoint = true;
             break;
         case LD_B_C:
             cpu->B = cpu->C;
@@ -710,29 +690,29 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
             break;
         case RET_NZ:
             if (!cpu->F.zero) {
-                cpu->PC = *(uint16_t*) bus_read(cpu->SP, machine);
+                cpu->PC = bus_read_16_bit(cpu->SP, machine);
                 cpu->SP += 2;
             }
             break;
         case POP_BC:
-            cpu->BC = *(uint16_t*) bus_read(cpu->SP, machine);
+            cpu->BC = bus_read_16_bit(cpu->SP, machine);
             cpu->SP += 2;
             break;
         case JP_NZ_U16:
             if (!cpu->F.zero) {
-                cpu->PC = *(uint16_t*) bus_read(cpu->PC, machine);
+                cpu->PC = bus_read_16_bit(cpu->PC, machine);
             }
             break;
         case JP_16:
             // Jump to target address
             // PC was incremented before execution, so this accesses the
             // byte(s) directly after the opcode
-            cpu->PC = *(uint16_t*) bus_read(cpu->PC, machine);
+            cpu->PC = bus_read_16_bit(cpu->PC, machine);
             break;
         case CALL_NZ_U16:
             // Scope allows us to declare this variable without compiler warnings
             {
-                uint16_t func_addr_0xC4 = *(uint16_t*) bus_read(cpu->PC, machine);
+                uint16_t func_addr_0xC4 = bus_read_16_bit(cpu->PC, machine);
                 cpu->PC += 2; // Move PC to next opcode
                 if (!cpu->F.zero) {
                     cpu->SP -= 2; // Push return address onto the stack
@@ -756,13 +736,21 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
             // This might help reduce code repetition, and break down more
             // complex operations.
             if (cpu->F.zero) {
-                cpu->PC = *(uint16_t*) bus_read(cpu->SP, machine);
+                cpu->PC = bus_read_16_bit(cpu->SP, machine);
                 cpu->SP += 2;
             }
             break;
         case RET:
-            cpu->PC = *(uint16_t*) bus_read(cpu->SP, machine);
+            cpu->PC = bus_read_16_bit(cpu->SP, machine);
+            cpu->SP += 2;
+            break;
+        case RETI:
+            cpu->PC = bus_read_16_bit(cpu->SP, machine);
             cpu->SP += 2;
+            cpu->IME = 0b11111111;
+            break;
+        case HALT:
+            cpu->halted = true;
             break;
         case PREFIX:
             if (!execute_prefix(cpu, machine)) {
@@ -773,7 +761,7 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
         case CALL_U16:
             // Scope allows us to declare this variable without compiler warnings
             {
-                uint16_t func_addr = *(uint16_t*) bus_read(cpu->PC, machine);
+                uint16_t func_addr = bus_read_16_bit(cpu->PC, machine);
                 cpu->PC += 2; // Move PC to next opcode
 
                 // Push return address onto the stack
@@ -789,18 +777,18 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
             break;
         case RET_NC:
             if (!cpu->F.carry) {
-                cpu->PC = *(uint16_t*) bus_read(cpu->SP, machine);
+                cpu->PC = bus_read_16_bit(cpu->SP, machine);
                 cpu->SP += 2;
             }
             break;
         case POP_DE:
-            cpu->DE = *(uint16_t*) bus_read(cpu->SP, machine);
+            cpu->DE = bus_read_16_bit(cpu->SP, machine);
             cpu->SP += 2;
             break;
         case CALL_NC_U16:
             // Scope allows us to declare this variable without compiler warnings
             {
-                uint16_t func_addr_0xD4 = *(uint16_t*) bus_read(cpu->PC, machine);
+                uint16_t func_addr_0xD4 = bus_read_16_bit(cpu->PC, machine);
                 cpu->PC += 2; // Move PC to next opcode
                 if (!cpu->F.carry) {
                     cpu->SP -= 2; // Push return address onto the stack
@@ -822,7 +810,7 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
             break;
         case RET_C:
             if (cpu->F.carry) {
-                cpu->PC = *(uint16_t*) bus_read(cpu->SP, machine);
+                cpu->PC = bus_read_16_bit(cpu->SP, machine);
                 cpu->SP += 2;
             }
             break;
@@ -834,7 +822,7 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
             }
             break;
         case POP_HL:
-            cpu->HL = *(uint16_t*) bus_read(cpu->SP, machine);
+            cpu->HL = bus_read_16_bit(cpu->SP, machine);
             cpu->SP += 2;
             break;
         case PUSH_HL:
@@ -850,7 +838,7 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
         case LD_U16_A:
             // Scope allows us to declare this variable without compiler warnings
             {
-                uint16_t addr = *(uint16_t*) bus_read(cpu->PC, machine);
+                uint16_t addr = bus_read_16_bit(cpu->PC, machine);
                 bus_write_8_bit(addr, cpu->A, machine);
             }
             cpu->PC += 2;
@@ -866,11 +854,12 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
             }
             break;
         case POP_AF:
-            cpu->AF = *(uint16_t*) bus_read(cpu->SP, machine);
+            cpu->AF = bus_read_16_bit(cpu->SP, machine);
             cpu->SP += 2;
             break;
         case DI:
             cpu->IME = 0;
+            cpu->ime_pending = false;
             break;
         case PUSH_AF:
             cpu->SP -= 2;
@@ -889,13 +878,13 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
         case LD_A_U16:
             // Scope allows us to declare this variable without compiler warnings
             {
-                uint16_t addr = *(uint16_t*) bus_read(cpu->PC, machine);
+                uint16_t addr = bus_read_16_bit(cpu->PC, machine);
                 cpu->PC += 2;
                 cpu->A = *bus_read(addr, machine);
             }
             break;
         case EI:
-            cpu->IME = 0b11111111; // 0xFF
+            cpu->ime_pending = true;
             break;
         case CP_A_U8:
             // Scope allows us to declare this variable without compiler warnings
@@ -913,195 +902,94 @@ static bool execute_switch(cpu_state* cpu, const machine_state* machine) {
             LOG_MSG(error, "Illegal or unimplemented instruction 0x%02x at $%04x, exiting.\n", opcode, cpu->PC - 1);
             return false;
     }
+#ifdef DMGEM_TRACE
     LOG_MSG(debug, "Executed instruction opcode 0x%02x at $%04x\n",opcode, opcode_pc);
+#endif
     return true;
 }
 
-// 0 0   0 0  0   0 0 0
-//  x       y       z
-//        p   q
-
-// See https://gb-archive.github.io/salvage/decoding_gbz80_opcodes/Decoding%20Gamboy%20Z80%20Opcodes.html for more information
-
-// This decodes instructions by patterns in their binary opcodes, rather than
-// hardcoding a behaviour for each case. This is (theoretically) simpler, but
-// in practice the code is much more confusing.
-//
-// The idea is that we only need to implement each operation once, and it will
-// handle every possible combination of registers that might use the operation.
-// So instead of a ton of cases for every possible register OR operation, we
-// would implement OR between registers once and use the binary opcode to 
-// figure out which registers to use.
-static bool execute_decode(cpu_state* cpu, const machine_state* machine) {
-    cpu->executing = false;
-    uint8_t opcode = *bus_read(cpu->PC, machine);
-    uint8_t x = (opcode & 0b11000000) >> 6;
-    uint8_t y = (opcode & 0b00111000) >> 3;
-    uint8_t p = (opcode & 0b00110000) >> 4;
-    uint8_t q = (opcode & 0b00001000) >> 3;
-    uint8_t z = (opcode & 0b00000111);
-
-    uint8_t cc[4] = {
-            !cpu->F.zero,
-            cpu->F.zero,
-            !cpu->F.carry,
-            cpu->F.carry,
-    };
-
-    register16* register_pairs[4] = {
-            &cpu->BC,
-            &cpu->DE,
-            &cpu->HL,
-            &cpu->SP
-    };
-
-    // The NULL is (HL), to cause crashes if we try to access it without using the bus module
-    register8* registers[8] = {
-            &cpu->B, &cpu->C, &cpu->D, &cpu->E, &cpu->H, &cpu->L, NULL, &cpu->A
-    };
+void cpu_init(cpu_state* cpu) {
+    cpu_state initial = {0};
+    *cpu = initial;
+}
 
-    switch (x) {
-    case 0:
-        switch (z) {
-            case 0:
-                // NOP (0x00)
-                if (y == 0) {
-                    return true;
-                }
-                // LD (nn), SP (0x08)
-                else if (y == 1) {
-                    uint16_t address = *(uint16_t*) bus_read(cpu->PC, machine);
-                    cpu->PC += 2;
-                    bus_write_16_bit(address, cpu->SP, machine);
-                }
-                // STOP (0x10)
-                else if (y == 2) {
-                    cpu->PC++;
-                }
-                // JR i8 (0x18) and JR cc[y-4], d (0x20, 0x28, 0x30, 0x38)
-                else if ((y == 3) || (cc[y - 4])) {
-                    cpu->PC += *(int8_t*) bus_read(cpu->PC, machine);
-                }
-                break;
-            case 1:
-                // LD register_pairs[p], nn (0x01, 0x11, 0x21, 0x31)
-                if (q == 0) {
-                    uint16_t value = *(uint16_t*) bus_read(cpu->PC, machine);
-                    cpu->PC += 2;
-                    *register_pairs[p] = value;
-                }
-                // ADD HL, register_pairs[p]
-                else {
-                    // q is 1 bit, so this is equivalent to else if (q == 1)
-                    cpu->HL = sm83_add16(cpu->HL, *register_pairs[p], cpu);
-                }
-                break;
-            case 2:
-                if (q == 0) {
-                    // LD (BC), A & LD (DE), A (0x02, 0x12)
-                    if (p == 0 || p == 1) {
-                        bus_write_8_bit(*register_pairs[p], cpu->A, machine);
-                    }
-                    // LD (HL+), A (0x22)
-                    else if (p == 2) {
-                        bus_write_8_bit(cpu->HL++, cpu->A, machine);
-                    }
-                    // LD (HL-), A (0x32)
-                    else if (p == 3) {
-                        bus_write_8_bit(cpu->HL--, cpu->A, machine);
-                    }
-                }
-                else
-                {
-                    // LD A, (BC) & LD A, (DE) (0x0A, 0x1A)
-                    if (p == 0 || p == 1) {
-                        cpu->A = *bus_read(*register_pairs[p], machine);
-                    }
-                        // LD A, (HL+) (0x2A)
-                    else if (p == 2) {
-                        cpu->A = *bus_read(cpu->HL++, machine);
-                    }
-                        // LD A, (HL-) (0x3A)
-                    else if (p == 3) {
-                        cpu->A = *bus_read(cpu->HL--, machine);
-                    }
-                }
-                break;
-            case 3:
-                // INC rp[p] (0x03, 0x13, 0x23, 0x33)
-                if (q == 0) {
-                    *register_pairs[p] += 1;
-                }
-                // DEC rp[p] (0x0B, 0x1B, 0x2B, 0x3B)
-                else {
-                    *register_pairs[p] -= 1;
-                }
-                break;
-            case 4:
-                // INC (HL) 0x34)
-                if (y == 6) {
-                    uint8_t value = *bus_read(cpu->HL, machine);
-                    value = sm83_add8(value, 1, cpu);
-                    bus_write_8_bit(cpu->HL, value, machine);
-                }
-                // INC r[y] (0x04, 0x0C, 0x14, 0x1C, 0x24, 0x2C, 0x3C)
-                else {
-                    *registers[y] = sm83_add8(*registers[y], 1, cpu);
-                }
-                break;
-            case 5:
-                // DEC (HL) (0x35)
-                if (y == 6) {
-                    uint8_t value = *bus_read(cpu->HL, machine);
-                    value = sm83_sub8(value, 1, cpu);
-                    bus_write_8_bit(cpu->HL, value, machine);
-                }
-                // DEC r[y] (0x05, 0x0D, 0x15, 0x1D, 0x25, 0x2D, 0x3D)
-                else {
-                    *registers[y] = sm83_sub8(*registers[y], 1, cpu);
-                }
-                break;
-            case 6:
-                // LD (HL), n (0x36)
-                if (y == 6) {
-                    bus_write_8_bit(cpu->HL, *bus_read(cpu->PC++, machine), machine);
-                }
-                // LD r[y], n (0x06, 0x0E, 0x16, 0x1E, 0x26, 0x2E, 0x3E)
-                else {
-                    *registers[y] = *bus_read(cpu->PC++, machine);
-                }
-                break;
-        }
-        break;
+// Jumps to the handler of the highest priority pending interrupt. Returns the
+// cycles it took, or 0 if nothing was dispatched.
+static uint8_t service_interrupts(cpu_state* cpu, machine_state* machine) {
+    uint8_t* memory = machine->console_memory;
+    uint8_t pending = memory[INTERRUPT_ENABLE] & memory[INTERRUPT_REQUEST] & INTERRUPT_ALL;
+    if (pending == 0) {
+        return 0;
     }
-    return true;
+    // Any pending interrupt ends HALT, even if it isn't serviced
+    cpu->halted = false;
+    if (!cpu->IME) {
+        return 0;
+    }
+    machine->stats.interrupts++;
+    uint8_t source = __builtin_ctz(pending);
+    memory[INTERRUPT_REQUEST] &= ~(1 << source);
+    cpu->IME = 0;
+    cpu->SP -= 2;
+    bus_write_16_bit(cpu->SP, cpu->PC, machine);
+    // Handlers are 8 bytes apart starting at 0x40, in priority order
+    cpu->PC = 0x40 + source * 8;
+    return 5;
 }
 
-bool tick(const machine_state* machine) {
-    static cpu_state cpu = {
-            .PC = 0x100, // Initialize program counter to ROM entry point
-            .IME = 0b11111111
-    };
+// Mirrors the checks service_interrupts() and cpu_step() make
+bool cpu_executes_next(const machine_state* machine) {
+    const uint8_t* memory = machine->console_memory;
+    uint8_t pending = memory[INTERRUPT_ENABLE] & memory[INTERRUPT_REQUEST] & INTERRUPT_ALL;
+    if (pending != 0) {
+        return !machine->cpu.IME;
+    }
+    return !machine->cpu.halted;
+}
 
-    if (!cpu.executing) {
-        cpu.remaining_execution_cycles = get_execution_time(machine, &cpu);
-        cpu.executing = true;
+// Everything else in the machine that runs on the CPU's clock
+static void advance_components(machine_state* machine, uint8_t cycles, bool dma_running) {
+    if (dma_running) {
+        bus_advance_dma(machine, cycles);
     }
-    cpu.remaining_execution_cycles--; // Update every cycle
+    ppu_catch_up(&machine->ppu, machine->console_memory, machine->clock);
+}
 
-    if (cpu.remaining_execution_cycles == 0) {
+uint8_t cpu_step(machine_state* machine) {
+    cpu_state* cpu = &machine->cpu;
+    // A transfer started by this step begins counting after it
+    bool dma_running = machine->dma_remaining_cycles != 0;
 
-        // Serial output for printing??
-        if(*bus_read(0xFF02, machine) == 0x81) {
-            char* c = (char*) bus_read(0xFF01, machine);
-            printf("%c\n\n", c);
-            bus_write_8_bit(0xFF02, 0x00, machine);
+    uint8_t cycles = service_interrupts(cpu, machine);
+    if (cycles == 0 && cpu->halted) {
+        // Nothing changes until the next interrupt, so skip ahead to the
+        // PPU's next event instead of idling one cycle at a time
+        cycles = 1;
+        if (machine->ppu.next_event > machine->clock && machine->ppu.next_event - machine->clock < PPU_LINE_CYCLES) {
+            cycles = machine->ppu.next_event - machine->clock;
         }
-        return execute_switch(&cpu, machine);
+        machine->clock += cycles;
+        machine->stats.halt_cycles += cycles;
+        advance_components(machine, cycles, dma_running);
+        return cycles;
     }
-    // Copy IME byte to interrupt flag
-    bus_write_8_bit(0xFFFF, cpu.IME, machine);
-
-    return true;
+    if (cycles == 0) {
+        bool enable_interrupts = cpu->ime_pending;
+        cycles = get_execution_time(machine, cpu);
+        machine->clock += cycles;
+        bool running = (machine->core == CPU_CORE_DECODED) ? decoder_execute(cpu, machine) : execute_switch(cpu, machine);
+        if (!running) {
+            return 0;
+        }
+        machine->stats.instructions++;
+        if (enable_interrupts) {
+            cpu->IME = 0b11111111;
+            cpu->ime_pending = false;
+        }
+    }
+    else {
+        machine->clock += cycles;
+    }
+    advance_components(machine, cycles, dma_running);
+    return cycles;
 }
-
@@ -3,9 +3,7 @@
 #include <stdbool.h>
 
 #include "machine.h"
-
-typedef uint8_t register8;
-typedef uint16_t register16;
+#include "registers.h"
 
 typedef enum {
     NOP         = 0x00,
@@ -357,69 +355,18 @@ typedef enum {
     SRL_A   = 0x3F
 }prefixed_opcode;
 
-// The number of CPU cycles that each instruction takes.
-static const uint8_t opcode_cycles[] = {
-    1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
-    1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
-    2, 3, 2, 2, 1, 1, 2, 1, 2, 2, 2, 2, 1, 1, 2, 1,
-    2, 3, 2, 2, 3, 3, 3, 1, 2, 2, 2, 2, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    2, 2, 2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
-    2, 3, 3, 4, 3, 4, 2, 3, 2, 4, 3, 1, 3, 6, 2, 4,
-    2, 3, 3, 1, 3, 4, 2, 4, 2, 4, 3, 1, 3, 1, 2, 4,
-    3, 3, 2, 1, 1, 4, 2, 4, 4, 1, 4, 1, 1, 1, 2, 4,
-    3, 3, 2, 1, 1, 4, 2, 4, 3, 2, 4, 1, 1, 1, 2, 4
-};
-
-typedef struct {
-    union {
-        register16 AF;
-        struct {
-            struct {
-                uint8_t zero: 1;
-                uint8_t subtraction: 1;
-                uint8_t half_carry: 1;
-                uint8_t carry: 1;
-                uint8_t unused: 4;
-            }F;
-            register8 A;
-        };
-    };
-    union {
-        register16 BC;
-        struct {
-            register8 C;
-            register8 B;
-        };
-    };
-    union {
-        register16 DE;
-        struct {
-            register8 E;
-            register8 D;
-        };
-    };
-    union {
-        register16 HL;
-        struct {
-            register8 L;
-            register8 H;
-        };
-    };
-    register16 SP;
-    register16 PC;
-    register8 IME;
-    bool executing;
+/// Sets the registers to their power on state, where the boot ROM starts.
+/// See boot_rom_skip() for the state at the ROM entry point.
+void cpu_init(cpu_state* cpu);
 
-    // Number of machine cycles left until the current operation executes
-    uint8_t remaining_execution_cycles;
-}cpu_state;
+/// Executes the whole instruction at PC at once, or dispatches a pending
+/// interrupt, then catches the rest of the machine up to the new clock.
+/// While halted, skips ahead to the next PPU event.
+/// \return The number of machine cycles the step took, or 0 if the CPU
+/// stopped.
+uint8_t cpu_step(machine_state* machine);
 
-bool tick(const machine_state* machine);
+/// Whether the next cpu_step() executes the instruction at PC, rather than
+/// dispatching an interrupt or idling in HALT.
+bool cpu_executes_next(const machine_state* machine);
 
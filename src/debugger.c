@@ -0,0 +1,156 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+
+#include "debugger.h"
+#include "cpu.h"
+#include "bus.h"
+
+// Bit in the breakpoint bitmap for the byte the CPU sees at an address, or
+// -1 for open bus
+static int64_t breakpoint_bit(const debugger* dbg, uint16_t address) {
+    const machine_state* machine = dbg->machine;
+    const uint8_t* byte = bus_peek(machine, address);
+    if (byte == NULL || byte < machine->arena || byte >= machine->arena + machine->arena_size) {
+        return -1;
+    }
+    return byte - machine->arena;
+}
+
+bool debugger_attach(debugger* dbg, machine_state* machine) {
+    memset(dbg, 0, sizeof(*dbg));
+    dbg->machine = machine;
+    dbg->breakpoint_words = (machine->arena_size + 63) / 64;
+    dbg->breakpoints = calloc(dbg->breakpoint_words, sizeof(*dbg->breakpoints));
+    if (dbg->breakpoints == NULL) {
+        LOG_MSG(error, "Failed to allocate the breakpoint bitmap\n");
+        return false;
+    }
+    machine->debugger = dbg;
+    memset(machine->watched_pages, 0, sizeof(machine->watched_pages));
+    return true;
+}
+
+// Recomputes which pages are watched and remaps them
+static void update_watched_pages(debugger* dbg) {
+    machine_state* machine = dbg->machine;
+    memset(machine->watched_pages, 0, sizeof(machine->watched_pages));
+    for (uint8_t i = 0; i < dbg->watchpoint_count; i++) {
+        const watchpoint* watch = &dbg->watchpoints[i];
+        uint32_t last = watch->address + watch->length - 1;
+        if (last > 0xFFFF) {
+            last = 0xFFFF;
+        }
+        for (uint32_t page = watch->address >> BUS_PAGE_SHIFT; page <= (last >> BUS_PAGE_SHIFT); page++) {
+            machine->watched_pages[page] |= watch->kind;
+        }
+    }
+    // OAM DMA has every page unmapped already, and maps them again when
+    // it's done
+    if (machine->dma_remaining_cycles == 0) {
+        bus_map_pages(machine);
+    }
+}
+
+void debugger_detach(debugger* dbg) {
+    if (dbg->machine != NULL) {
+        dbg->watchpoint_count = 0;
+        update_watched_pages(dbg);
+        dbg->machine->debugger = NULL;
+    }
+    free(dbg->breakpoints);
+    memset(dbg, 0, sizeof(*dbg));
+}
+
+bool debugger_set_breakpoint(debugger* dbg, uint16_t address, bool enabled) {
+    int64_t bit = breakpoint_bit(dbg, address);
+    if (bit < 0) {
+        return false;
+    }
+    uint64_t mask = 1ull << (bit & 63);
+    uint64_t* word = &dbg->breakpoints[bit >> 6];
+    bool was_enabled = (*word & mask) != 0;
+    if (enabled && !was_enabled) {
+        *word |= mask;
+        dbg->breakpoint_count++;
+    }
+    else if (!enabled && was_enabled) {
+        *word &= ~mask;
+        dbg->breakpoint_count--;
+    }
+    return true;
+}
+
+bool debugger_has_breakpoint(const debugger* dbg, uint16_t address) {
+    int64_t bit = breakpoint_bit(dbg, address);
+    return bit >= 0 && (dbg->breakpoints[bit >> 6] & (1ull << (bit & 63)));
+}
+
+bool debugger_add_watchpoint(debugger* dbg, uint16_t address, uint16_t length, watch_kind kind) {
+    if (dbg->watchpoint_count == DEBUGGER_MAX_WATCHPOINTS) {
+        return false;
+    }
+    watchpoint watch = {.address = address, .length = (length != 0) ? length : 1, .kind = kind};
+    dbg->watchpoints[dbg->watchpoint_count++] = watch;
+    update_watched_pages(dbg);
+    return true;
+}
+
+bool debugger_remove_watchpoint(debugger* dbg, uint16_t address, uint16_t length, watch_kind kind) {
+    length = (length != 0) ? length : 1;
+    for (uint8_t i = 0; i < dbg->watchpoint_count; i++) {
+        const watchpoint* watch = &dbg->watchpoints[i];
+        if (watch->address == address && watch->length == length && watch->kind == kind) {
+            dbg->watchpoints[i] = dbg->watchpoints[--dbg->watchpoint_count];
+            update_watched_pages(dbg);
+            return true;
+        }
+    }
+    return false;
+}
+
+void debugger_check_access(debugger* dbg, uint16_t address, watch_kind access) {
+    for (uint8_t i = 0; i < dbg->watchpoint_count; i++) {
+        const watchpoint* watch = &dbg->watchpoints[i];
+        if ((watch->kind & access) && address >= watch->address && (uint32_t) address < (uint32_t) watch->address + watch->length) {
+            // The first hit of an instruction is the one reported
+            if (!dbg->watch_hit) {
+                dbg->watch_hit = true;
+                dbg->watch_address = address;
+                dbg->watch_access = access;
+            }
+            return;
+        }
+    }
+}
+
+debugger_stop debugger_step(debugger* dbg) {
+    dbg->watch_hit = false;
+    if (cpu_step(dbg->machine) == 0) {
+        return DEBUGGER_CPU_STOPPED;
+    }
+    return dbg->watch_hit ? DEBUGGER_WATCHPOINT : DEBUGGER_STEPPED;
+}
+
+debugger_stop debugger_run(debugger* dbg, uint64_t max_cycles) {
+    machine_state* machine = dbg->machine;
+    const cpu_state* cpu = &machine->cpu;
+    uint64_t end = machine->clock + max_cycles;
+    dbg->watch_hit = false;
+    while (machine->clock < end) {
+        if (cpu_step(machine) == 0) {
+            return DEBUGGER_CPU_STOPPED;
+        }
+        if (dbg->watch_hit) {
+            return DEBUGGER_WATCHPOINT;
+        }
+        // A halted CPU stays at the same PC, which shouldn't hit again
+        if (dbg->breakpoint_count != 0 && !cpu->halted && debugger_has_breakpoint(dbg, cpu->PC)) {
+            return DEBUGGER_BREAKPOINT;
+        }
+    }
+    return DEBUGGER_TIMEOUT;
+}
@@ -0,0 +1,82 @@
+// PC breakpoints and memory watchpoints. Nothing in the normal run loops or
+// the bus fast paths knows about them: breakpoints are only checked by the
+// debugger's own run loop, and watchpoints unmap the pages they're in so
+// their accesses reach the bus slow path, which checks them. A machine
+// without a debugger attached runs exactly the same code as before.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "machine.h"
+
+#define DEBUGGER_MAX_WATCHPOINTS 16
+
+typedef enum {
+    WATCH_READ = 0b01,
+    WATCH_WRITE = 0b10,
+    WATCH_ACCESS = WATCH_READ | WATCH_WRITE
+}watch_kind;
+
+typedef struct {
+    uint16_t address;
+    uint16_t length;
+    uint8_t kind; // watch_kind bits
+}watchpoint;
+
+// Why debugger_run() or debugger_step() returned
+typedef enum {
+    DEBUGGER_STEPPED, // The single step finished
+    DEBUGGER_BREAKPOINT, // PC reached a breakpoint
+    DEBUGGER_WATCHPOINT, // The last instruction accessed a watched address
+    DEBUGGER_TIMEOUT, // Ran for all the cycles it was given
+    DEBUGGER_CPU_STOPPED
+}debugger_stop;
+
+typedef struct debugger {
+    machine_state* machine;
+    // A bit per byte of the machine's arena, so every ROM and RAM bank has
+    // its own breakpoints, like the disassembler's cache
+    uint64_t* breakpoints;
+    uint32_t breakpoint_words;
+    uint32_t breakpoint_count;
+
+    watchpoint watchpoints[DEBUGGER_MAX_WATCHPOINTS];
+    uint8_t watchpoint_count;
+    // Set by the bus when a watched address is accessed
+    bool watch_hit;
+    uint16_t watch_address;
+    watch_kind watch_access;
+}debugger;
+
+/// Attaches a debugger to a machine, which keeps it across resets. Only one
+/// debugger can be attached at a time.
+/// \return false if allocation failed
+bool debugger_attach(debugger* dbg, machine_state* machine);
+
+// Removes every watchpoint and detaches from the machine.
+void debugger_detach(debugger* dbg);
+
+/// Sets or clears a breakpoint in the bank currently mapped at an address.
+/// \return false if nothing is mapped there, such as during OAM DMA
+bool debugger_set_breakpoint(debugger* dbg, uint16_t address, bool enabled);
+bool debugger_has_breakpoint(const debugger* dbg, uint16_t address);
+
+/// Watches accesses to length bytes from address, in whatever bank is mapped.
+/// \return false if there are already DEBUGGER_MAX_WATCHPOINTS
+bool debugger_add_watchpoint(debugger* dbg, uint16_t address, uint16_t length, watch_kind kind);
+
+/// Removes a watchpoint added with the same arguments.
+/// \return false if there's no such watchpoint
+bool debugger_remove_watchpoint(debugger* dbg, uint16_t address, uint16_t length, watch_kind kind);
+
+// Called by the bus slow path for accesses to watched pages.
+void debugger_check_access(debugger* dbg, uint16_t address, watch_kind access);
+
+// Runs a single instruction, or services an interrupt.
+debugger_stop debugger_step(debugger* dbg);
+
+/// Runs until a breakpoint or watchpoint is hit or the CPU stops. The
+/// instruction at PC always runs, so this can continue from a breakpoint.
+/// \param max_cycles Machine cycles to run for at most
+debugger_stop debugger_run(debugger* dbg, uint64_t max_cycles);
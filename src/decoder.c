@@ -0,0 +1,847 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "logging.h"
+
+#include "decoder.h"
+#include "bus.h"
+#include "cpu.h"
+
+// 0 0   0 0  0   0 0 0
+//  x       y       z
+//        p   q
+
+// See https://gb-archive.github.io/salvage/decoding_gbz80_opcodes/Decoding%20Gamboy%20Z80%20Opcodes.html for more information
+
+// Each operation is implemented once, and the decoder picks the registers it
+// works on from the opcode's bit fields. That only happens when the table is
+// built, so handlers get their operands as ready made offsets.
+
+typedef struct decoded_instruction decoded_instruction;
+typedef bool (*instruction_handler)(cpu_state* cpu, machine_state* machine, const decoded_instruction* instruction);
+
+struct decoded_instruction {
+    instruction_handler handler;
+    // Register operands as byte offsets into cpu_state
+    uint8_t target; // r[y] or rp[p]
+    uint8_t source; // r[z]
+    // Branches are taken when (F & mask) == value, both are 0 for
+    // unconditional ones
+    uint8_t condition_mask;
+    uint8_t condition_value;
+    uint8_t value; // Bit mask for BIT/RES/SET, address for RST
+};
+
+// Unprefixed opcodes, then the ones after 0xCB
+static decoded_instruction decoded_instructions[512];
+
+// Every handler has the same signature, whether it uses all of it or not
+#define HANDLER(name) static bool name(__attribute__((unused)) cpu_state* cpu, __attribute__((unused)) machine_state* machine, \
+                                       __attribute__((unused)) const decoded_instruction* instruction)
+#define FLAG_IF(condition, flag) ((condition) ? (flag) : 0)
+
+static inline uint8_t* register8_at(cpu_state* cpu, uint8_t offset) {
+    return (uint8_t*) cpu + offset;
+}
+
+static inline uint16_t* register16_at(cpu_state* cpu, uint8_t offset) {
+    return (uint16_t*) ((uint8_t*) cpu + offset);
+}
+
+static inline uint8_t get_flags(const cpu_state* cpu) {
+    return cpu->AF & 0xFF;
+}
+
+static inline void set_flags(cpu_state* cpu, uint8_t flags) {
+    cpu->AF = (cpu->AF & 0xFF00) | flags;
+}
+
+static inline uint8_t carry_bit(const cpu_state* cpu) {
+    return (get_flags(cpu) & FLAG_CARRY) ? 1 : 0;
+}
+
+static inline bool condition_met(const cpu_state* cpu, const decoded_instruction* instruction) {
+    return (get_flags(cpu) & instruction->condition_mask) == instruction->condition_value;
+}
+
+static inline void push(cpu_state* cpu, machine_state* machine, uint16_t value) {
+    cpu->SP -= 2;
+    bus_write_16_bit(cpu->SP, value, machine);
+}
+
+static inline uint16_t pop(cpu_state* cpu, machine_state* machine) {
+    uint16_t value = bus_read_16_bit(cpu->SP, machine);
+    cpu->SP += 2;
+    return value;
+}
+
+// 8-bit arithmetic
+
+static inline uint8_t inc8(cpu_state* cpu, uint8_t value) {
+    uint8_t result = value + 1;
+    set_flags(cpu, (get_flags(cpu) & FLAG_CARRY) | FLAG_IF(result == 0, FLAG_ZERO) |
+                   FLAG_IF((value & 0xF) == 0xF, FLAG_HALF_CARRY));
+    return result;
+}
+
+static inline uint8_t dec8(cpu_state* cpu, uint8_t value) {
+    uint8_t result = value - 1;
+    set_flags(cpu, (get_flags(cpu) & FLAG_CARRY) | FLAG_SUBTRACTION | FLAG_IF(result == 0, FLAG_ZERO) |
+                   FLAG_IF((value & 0xF) == 0, FLAG_HALF_CARRY));
+    return result;
+}
+
+static inline void add_a(cpu_state* cpu, uint8_t value, uint8_t carry) {
+    uint16_t result = cpu->A + value + carry;
+    set_flags(cpu, FLAG_IF((uint8_t) result == 0, FLAG_ZERO) |
+                   FLAG_IF((cpu->A & 0xF) + (value & 0xF) + carry > 0xF, FLAG_HALF_CARRY) |
+                   FLAG_IF(result > 0xFF, FLAG_CARRY));
+    cpu->A = result;
+}
+
+static inline uint8_t sub_a(cpu_state* cpu, uint8_t value, uint8_t carry) {
+    int16_t result = cpu->A - value - carry;
+    set_flags(cpu, FLAG_SUBTRACTION | FLAG_IF((uint8_t) result == 0, FLAG_ZERO) |
+                   FLAG_IF((cpu->A & 0xF) - (value & 0xF) - carry < 0, FLAG_HALF_CARRY) |
+                   FLAG_IF(result < 0, FLAG_CARRY));
+    return result;
+}
+
+static inline void alu_add(cpu_state* cpu, uint8_t value) {
+    add_a(cpu, value, 0);
+}
+
+static inline void alu_adc(cpu_state* cpu, uint8_t value) {
+    add_a(cpu, value, carry_bit(cpu));
+}
+
+static inline void alu_sub(cpu_state* cpu, uint8_t value) {
+    cpu->A = sub_a(cpu, value, 0);
+}
+
+static inline void alu_sbc(cpu_state* cpu, uint8_t value) {
+    cpu->A = sub_a(cpu, value, carry_bit(cpu));
+}
+
+static inline void alu_and(cpu_state* cpu, uint8_t value) {
+    cpu->A &= value;
+    set_flags(cpu, FLAG_HALF_CARRY | FLAG_IF(cpu->A == 0, FLAG_ZERO));
+}
+
+static inline void alu_xor(cpu_state* cpu, uint8_t value) {
+    cpu->A ^= value;
+    set_flags(cpu, FLAG_IF(cpu->A == 0, FLAG_ZERO));
+}
+
+static inline void alu_or(cpu_state* cpu, uint8_t value) {
+    cpu->A |= value;
+    set_flags(cpu, FLAG_IF(cpu->A == 0, FLAG_ZERO));
+}
+
+static inline void alu_cp(cpu_state* cpu, uint8_t value) {
+    sub_a(cpu, value, 0);
+}
+
+// Rotates and shifts, all of them set Z and C from the result
+
+static inline uint8_t shift_result(cpu_state* cpu, uint8_t result, bool carry) {
+    set_flags(cpu, FLAG_IF(result == 0, FLAG_ZERO) | FLAG_IF(carry, FLAG_CARRY));
+    return result;
+}
+
+static inline uint8_t shift_rlc(cpu_state* cpu, uint8_t value) {
+    return shift_result(cpu, (value << 1) | (value >> 7), value & 0x80);
+}
+
+static inline uint8_t shift_rrc(cpu_state* cpu, uint8_t value) {
+    return shift_result(cpu, (value >> 1) | (value << 7), value & 0x01);
+}
+
+static inline uint8_t shift_rl(cpu_state* cpu, uint8_t value) {
+    return shift_result(cpu, (value << 1) | carry_bit(cpu), value & 0x80);
+}
+
+static inline uint8_t shift_rr(cpu_state* cpu, uint8_t value) {
+    return shift_result(cpu, (value >> 1) | (carry_bit(cpu) << 7), value & 0x01);
+}
+
+static inline uint8_t shift_sla(cpu_state* cpu, uint8_t value) {
+    return shift_result(cpu, value << 1, value & 0x80);
+}
+
+static inline uint8_t shift_sra(cpu_state* cpu, uint8_t value) {
+    return shift_result(cpu, (value >> 1) | (value & 0x80), value & 0x01);
+}
+
+static inline uint8_t shift_swap(cpu_state* cpu, uint8_t value) {
+    return shift_result(cpu, (value << 4) | (value >> 4), false);
+}
+
+static inline uint8_t shift_srl(cpu_state* cpu, uint8_t value) {
+    return shift_result(cpu, value >> 1, value & 0x01);
+}
+
+// ADD SP, i8 and LD HL, SP+i8 take their flags from the low byte
+static inline uint16_t sp_plus_offset(cpu_state* cpu, machine_state* machine) {
+    uint8_t offset = *bus_read(cpu->PC++, machine);
+    set_flags(cpu, FLAG_IF((cpu->SP & 0xF) + (offset & 0xF) > 0xF, FLAG_HALF_CARRY) |
+                   FLAG_IF((cpu->SP & 0xFF) + offset > 0xFF, FLAG_CARRY));
+    return cpu->SP + (int8_t) offset;
+}
+
+// x = 0
+
+HANDLER(nop) {
+    return true;
+}
+
+HANDLER(illegal) {
+    LOG_MSG(error, "Illegal or unimplemented instruction 0x%02x at $%04x, exiting.\n", *bus_read(cpu->PC - 1, machine), cpu->PC - 1);
+    return false;
+}
+
+HANDLER(stop) {
+    // STOP ends emulation, the same as the switch core. Its second byte is
+    // skipped so PC points past the instruction.
+    cpu->PC++;
+    return false;
+}
+
+HANDLER(ld_u16_sp) {
+    uint16_t address = bus_read_16_bit(cpu->PC, machine);
+    cpu->PC += 2;
+    bus_write_16_bit(address, cpu->SP, machine);
+    return true;
+}
+
+HANDLER(jr) {
+    int8_t offset = *bus_read(cpu->PC++, machine);
+    if (condition_met(cpu, instruction)) {
+        cpu->PC += offset;
+    }
+    return true;
+}
+
+HANDLER(ld_rp_u16) {
+    *register16_at(cpu, instruction->target) = bus_read_16_bit(cpu->PC, machine);
+    cpu->PC += 2;
+    return true;
+}
+
+HANDLER(add_hl_rp) {
+    uint16_t value = *register16_at(cpu, instruction->target);
+    uint32_t result = cpu->HL + value;
+    set_flags(cpu, (get_flags(cpu) & FLAG_ZERO) |
+                   FLAG_IF((cpu->HL & 0xFFF) + (value & 0xFFF) > 0xFFF, FLAG_HALF_CARRY) |
+                   FLAG_IF(result > 0xFFFF, FLAG_CARRY));
+    cpu->HL = result;
+    return true;
+}
+
+HANDLER(ld_indirect_a) {
+    bus_write_8_bit(*register16_at(cpu, instruction->target), cpu->A, machine);
+    return true;
+}
+
+HANDLER(ld_hli_a) {
+    bus_write_8_bit(cpu->HL++, cpu->A, machine);
+    return true;
+}
+
+HANDLER(ld_hld_a) {
+    bus_write_8_bit(cpu->HL--, cpu->A, machine);
+    return true;
+}
+
+HANDLER(ld_a_indirect) {
+    cpu->A = *bus_read(*register16_at(cpu, instruction->target), machine);
+    return true;
+}
+
+HANDLER(ld_a_hli) {
+    cpu->A = *bus_read(cpu->HL++, machine);
+    return true;
+}
+
+HANDLER(ld_a_hld) {
+    cpu->A = *bus_read(cpu->HL--, machine);
+    return true;
+}
+
+HANDLER(inc_rp) {
+    (*register16_at(cpu, instruction->target))++;
+    return true;
+}
+
+HANDLER(dec_rp) {
+    (*register16_at(cpu, instruction->target))--;
+    return true;
+}
+
+HANDLER(inc_r) {
+    uint8_t* reg = register8_at(cpu, instruction->target);
+    *reg = inc8(cpu, *reg);
+    return true;
+}
+
+HANDLER(inc_hl_indirect) {
+    bus_write_8_bit(cpu->HL, inc8(cpu, *bus_read(cpu->HL, machine)), machine);
+    return true;
+}
+
+HANDLER(dec_r) {
+    uint8_t* reg = register8_at(cpu, instruction->target);
+    *reg = dec8(cpu, *reg);
+    return true;
+}
+
+HANDLER(dec_hl_indirect) {
+    bus_write_8_bit(cpu->HL, dec8(cpu, *bus_read(cpu->HL, machine)), machine);
+    return true;
+}
+
+HANDLER(ld_r_u8) {
+    *register8_at(cpu, instruction->target) = *bus_read(cpu->PC++, machine);
+    return true;
+}
+
+HANDLER(ld_hl_indirect_u8) {
+    bus_write_8_bit(cpu->HL, *bus_read(cpu->PC++, machine), machine);
+    return true;
+}
+
+// The accumulator rotates always clear Z
+#define ACCUMULATOR_ROTATE(name, shift) \
+    HANDLER(name) { \
+        cpu->A = shift(cpu, cpu->A); \
+        set_flags(cpu, get_flags(cpu) & FLAG_CARRY); \
+        return true; \
+    }
+
+ACCUMULATOR_ROTATE(rlca, shift_rlc)
+ACCUMULATOR_ROTATE(rrca, shift_rrc)
+ACCUMULATOR_ROTATE(rla, shift_rl)
+ACCUMULATOR_ROTATE(rra, shift_rr)
+
+HANDLER(daa) {
+    uint8_t flags = get_flags(cpu);
+    uint8_t a = cpu->A;
+    bool carry = flags & FLAG_CARRY;
+    if (!(flags & FLAG_SUBTRACTION)) {
+        if (carry || a > 0x99) {
+            a += 0x60;
+            carry = true;
+        }
+        if ((flags & FLAG_HALF_CARRY) || (a & 0x0F) > 0x09) {
+            a += 0x06;
+        }
+    }
+    else {
+        if (carry) {
+            a -= 0x60;
+        }
+        if (flags & FLAG_HALF_CARRY) {
+            a -= 0x06;
+        }
+    }
+    cpu->A = a;
+    set_flags(cpu, (flags & FLAG_SUBTRACTION) | FLAG_IF(a == 0, FLAG_ZERO) | FLAG_IF(carry, FLAG_CARRY));
+    return true;
+}
+
+HANDLER(cpl) {
+    cpu->A = ~cpu->A;
+    set_flags(cpu, get_flags(cpu) | FLAG_SUBTRACTION | FLAG_HALF_CARRY);
+    return true;
+}
+
+HANDLER(scf) {
+    set_flags(cpu, (get_flags(cpu) & FLAG_ZERO) | FLAG_CARRY);
+    return true;
+}
+
+HANDLER(ccf) {
+    uint8_t flags = get_flags(cpu);
+    set_flags(cpu, (flags & FLAG_ZERO) | ((flags & FLAG_CARRY) ^ FLAG_CARRY));
+    return true;
+}
+
+// x = 1
+
+HANDLER(ld_r_r) {
+    *register8_at(cpu, instruction->target) = *register8_at(cpu, instruction->source);
+    return true;
+}
+
+HANDLER(ld_b_b) {
+    // Test ROMs use this as a breakpoint
+    cpu->software_breakpoint = true;
+    return true;
+}
+
+HANDLER(ld_r_hl_indirect) {
+    *register8_at(cpu, instruction->target) = *bus_read(cpu->HL, machine);
+    return true;
+}
+
+HANDLER(ld_hl_indirect_r) {
+    bus_write_8_bit(cpu->HL, *register8_at(cpu, instruction->source), machine);
+    return true;
+}
+
+HANDLER(halt) {
+    cpu->halted = true;
+    return true;
+}
+
+// x = 2, and the immediate forms at x = 3
+
+typedef enum {
+    ALU_REGISTER,
+    ALU_HL_INDIRECT,
+    ALU_IMMEDIATE,
+    ALU_OPERAND_KINDS
+}alu_operand;
+
+#define ALU_HANDLERS(operation) \
+    HANDLER(operation##_r) { \
+        operation(cpu, *register8_at(cpu, instruction->source)); \
+        return true; \
+    } \
+    HANDLER(operation##_hl) { \
+        operation(cpu, *bus_read(cpu->HL, machine)); \
+        return true; \
+    } \
+    HANDLER(operation##_u8) { \
+        operation(cpu, *bus_read(cpu->PC++, machine)); \
+        return true; \
+    }
+
+ALU_HANDLERS(alu_add)
+ALU_HANDLERS(alu_adc)
+ALU_HANDLERS(alu_sub)
+ALU_HANDLERS(alu_sbc)
+ALU_HANDLERS(alu_and)
+ALU_HANDLERS(alu_xor)
+ALU_HANDLERS(alu_or)
+ALU_HANDLERS(alu_cp)
+
+// alu[y], by operand kind
+static const instruction_handler alu_handlers[8][ALU_OPERAND_KINDS] = {
+    {alu_add_r, alu_add_hl, alu_add_u8},
+    {alu_adc_r, alu_adc_hl, alu_adc_u8},
+    {alu_sub_r, alu_sub_hl, alu_sub_u8},
+    {alu_sbc_r, alu_sbc_hl, alu_sbc_u8},
+    {alu_and_r, alu_and_hl, alu_and_u8},
+    {alu_xor_r, alu_xor_hl, alu_xor_u8},
+    {alu_or_r, alu_or_hl, alu_or_u8},
+    {alu_cp_r, alu_cp_hl, alu_cp_u8}
+};
+
+// x = 3
+
+HANDLER(ret) {
+    if (condition_met(cpu, instruction)) {
+        cpu->PC = pop(cpu, machine);
+    }
+    return true;
+}
+
+HANDLER(reti) {
+    cpu->PC = pop(cpu, machine);
+    cpu->IME = 0b11111111;
+    return true;
+}
+
+HANDLER(pop_rp) {
+    *register16_at(cpu, instruction->target) = pop(cpu, machine);
+    return true;
+}
+
+HANDLER(pop_af) {
+    // The low 4 bits of F don't exist
+    cpu->AF = pop(cpu, machine) & 0xFFF0;
+    return true;
+}
+
+HANDLER(push_rp) {
+    push(cpu, machine, *register16_at(cpu, instruction->target));
+    return true;
+}
+
+HANDLER(jp) {
+    uint16_t address = bus_read_16_bit(cpu->PC, machine);
+    cpu->PC += 2;
+    if (condition_met(cpu, instruction)) {
+        cpu->PC = address;
+    }
+    return true;
+}
+
+HANDLER(jp_hl) {
+    cpu->PC = cpu->HL;
+    return true;
+}
+
+HANDLER(call) {
+    uint16_t address = bus_read_16_bit(cpu->PC, machine);
+    cpu->PC += 2;
+    if (condition_met(cpu, instruction)) {
+        push(cpu, machine, cpu->PC);
+        cpu->PC = address;
+    }
+    return true;
+}
+
+HANDLER(rst) {
+    push(cpu, machine, cpu->PC);
+    cpu->PC = instruction->value;
+    return true;
+}
+
+HANDLER(ldh_u8_a) {
+    uint8_t offset = *bus_read(cpu->PC++, machine);
+    bus_write_8_bit(0xFF00 + offset, cpu->A, machine);
+    return true;
+}
+
+HANDLER(ldh_a_u8) {
+    uint8_t offset = *bus_read(cpu->PC++, machine);
+    cpu->A = *bus_read(0xFF00 + offset, machine);
+    return true;
+}
+
+HANDLER(ldh_c_a) {
+    bus_write_8_bit(0xFF00 + cpu->C, cpu->A, machine);
+    return true;
+}
+
+HANDLER(ldh_a_c) {
+    cpu->A = *bus_read(0xFF00 + cpu->C, machine);
+    return true;
+}
+
+HANDLER(ld_u16_a) {
+    uint16_t address = bus_read_16_bit(cpu->PC, machine);
+    cpu->PC += 2;
+    bus_write_8_bit(address, cpu->A, machine);
+    return true;
+}
+
+HANDLER(ld_a_u16) {
+    uint16_t address = bus_read_16_bit(cpu->PC, machine);
+    cpu->PC += 2;
+    cpu->A = *bus_read(address, machine);
+    return true;
+}
+
+HANDLER(add_sp_i8) {
+    cpu->SP = sp_plus_offset(cpu, machine);
+    return true;
+}
+
+HANDLER(ld_hl_sp_i8) {
+    cpu->HL = sp_plus_offset(cpu, machine);
+    return true;
+}
+
+HANDLER(ld_sp_hl) {
+    cpu->SP = cpu->HL;
+    return true;
+}
+
+HANDLER(di) {
+    cpu->IME = 0;
+    cpu->ime_pending = false;
+    return true;
+}
+
+HANDLER(ei) {
+    cpu->ime_pending = true;
+    return true;
+}
+
+HANDLER(prefix) {
+    const decoded_instruction* prefixed = &decoded_instructions[0x100 + *bus_read(cpu->PC++, machine)];
+    return prefixed->handler(cpu, machine, prefixed);
+}
+
+// 0xCB prefixed
+
+#define SHIFT_HANDLERS(operation) \
+    HANDLER(operation##_r) { \
+        uint8_t* reg = register8_at(cpu, instruction->source); \
+        *reg = operation(cpu, *reg); \
+        return true; \
+    } \
+    HANDLER(operation##_hl) { \
+        bus_write_8_bit(cpu->HL, operation(cpu, *bus_read(cpu->HL, machine)), machine); \
+        return true; \
+    }
+
+SHIFT_HANDLERS(shift_rlc)
+SHIFT_HANDLERS(shift_rrc)
+SHIFT_HANDLERS(shift_rl)
+SHIFT_HANDLERS(shift_rr)
+SHIFT_HANDLERS(shift_sla)
+SHIFT_HANDLERS(shift_sra)
+SHIFT_HANDLERS(shift_swap)
+SHIFT_HANDLERS(shift_srl)
+
+// rot[y], with a register or (HL)
+static const instruction_handler shift_handlers[8][2] = {
+    {shift_rlc_r, shift_rlc_hl},
+    {shift_rrc_r, shift_rrc_hl},
+    {shift_rl_r, shift_rl_hl},
+    {shift_rr_r, shift_rr_hl},
+    {shift_sla_r, shift_sla_hl},
+    {shift_sra_r, shift_sra_hl},
+    {shift_swap_r, shift_swap_hl},
+    {shift_srl_r, shift_srl_hl}
+};
+
+static inline void test_bit(cpu_state* cpu, uint8_t value, uint8_t mask) {
+    set_flags(cpu, (get_flags(cpu) & FLAG_CARRY) | FLAG_HALF_CARRY | FLAG_IF(!(value & mask), FLAG_ZERO));
+}
+
+HANDLER(bit_r) {
+    test_bit(cpu, *register8_at(cpu, instruction->source), instruction->value);
+    return true;
+}
+
+HANDLER(bit_hl) {
+    test_bit(cpu, *bus_read(cpu->HL, machine), instruction->value);
+    return true;
+}
+
+HANDLER(res_r) {
+    *register8_at(cpu, instruction->source) &= ~instruction->value;
+    return true;
+}
+
+HANDLER(res_hl) {
+    bus_write_8_bit(cpu->HL, *bus_read(cpu->HL, machine) & ~instruction->value, machine);
+    return true;
+}
+
+HANDLER(set_r) {
+    *register8_at(cpu, instruction->source) |= instruction->value;
+    return true;
+}
+
+HANDLER(set_hl) {
+    bus_write_8_bit(cpu->HL, *bus_read(cpu->HL, machine) | instruction->value, machine);
+    return true;
+}
+
+// Decoding, only done when the table is built
+
+// r[i], with (HL) at 6 handled by separate handlers
+static const uint8_t register_offsets[8] = {
+    offsetof(cpu_state, B), offsetof(cpu_state, C), offsetof(cpu_state, D), offsetof(cpu_state, E),
+    offsetof(cpu_state, H), offsetof(cpu_state, L), 0, offsetof(cpu_state, A)
+};
+
+// rp[p] and rp2[p], which differ in SP and AF
+static const uint8_t pair_offsets[4] = {
+    offsetof(cpu_state, BC), offsetof(cpu_state, DE), offsetof(cpu_state, HL), offsetof(cpu_state, SP)
+};
+static const uint8_t stack_pair_offsets[4] = {
+    offsetof(cpu_state, BC), offsetof(cpu_state, DE), offsetof(cpu_state, HL), offsetof(cpu_state, AF)
+};
+
+// cc[y] as (F & mask) == value: NZ, Z, NC, C
+static const uint8_t condition_masks[4] = {FLAG_ZERO, FLAG_ZERO, FLAG_CARRY, FLAG_CARRY};
+static const uint8_t condition_values[4] = {0, FLAG_ZERO, 0, FLAG_CARRY};
+
+static void set_condition(decoded_instruction* decoded, uint8_t cc) {
+    decoded->condition_mask = condition_masks[cc];
+    decoded->condition_value = condition_values[cc];
+}
+
+static decoded_instruction decode_unprefixed(uint8_t opcode) {
+    uint8_t x = (opcode & 0b11000000) >> 6;
+    uint8_t y = (opcode & 0b00111000) >> 3;
+    uint8_t p = (opcode & 0b00110000) >> 4;
+    uint8_t q = (opcode & 0b00001000) >> 3;
+    uint8_t z = (opcode & 0b00000111);
+    decoded_instruction decoded = {.handler = illegal};
+
+    switch (x) {
+    case 0:
+        switch (z) {
+            case 0: {
+                // NOP, LD (u16), SP, STOP, JR i8, then JR cc[y-4], i8
+                static const instruction_handler handlers[4] = {nop, ld_u16_sp, stop, jr};
+                decoded.handler = (y < 4) ? handlers[y] : jr;
+                if (y >= 4) {
+                    set_condition(&decoded, y - 4);
+                }
+                break;
+            }
+            case 1:
+                // LD rp[p], u16 or ADD HL, rp[p]
+                decoded.handler = q ? add_hl_rp : ld_rp_u16;
+                decoded.target = pair_offsets[p];
+                break;
+            case 2: {
+                // Stores and loads of A through (BC), (DE), (HL+) and (HL-)
+                static const instruction_handler stores[4] = {ld_indirect_a, ld_indirect_a, ld_hli_a, ld_hld_a};
+                static const instruction_handler loads[4] = {ld_a_indirect, ld_a_indirect, ld_a_hli, ld_a_hld};
+                decoded.handler = q ? loads[p] : stores[p];
+                decoded.target = pair_offsets[p];
+                break;
+            }
+            case 3:
+                decoded.handler = q ? dec_rp : inc_rp;
+                decoded.target = pair_offsets[p];
+                break;
+            case 4:
+                decoded.handler = (y == 6) ? inc_hl_indirect : inc_r;
+                decoded.target = register_offsets[y];
+                break;
+            case 5:
+                decoded.handler = (y == 6) ? dec_hl_indirect : dec_r;
+                decoded.target = register_offsets[y];
+                break;
+            case 6:
+                decoded.handler = (y == 6) ? ld_hl_indirect_u8 : ld_r_u8;
+                decoded.target = register_offsets[y];
+                break;
+            case 7: {
+                static const instruction_handler handlers[8] = {rlca, rrca, rla, rra, daa, cpl, scf, ccf};
+                decoded.handler = handlers[y];
+                break;
+            }
+        }
+        break;
+    case 1:
+        // LD r[y], r[z], with LD (HL), (HL) replaced by HALT
+        if (y == 6 && z == 6) {
+            decoded.handler = halt;
+        }
+        else if (y == 6) {
+            decoded.handler = ld_hl_indirect_r;
+        }
+        else if (z == 6) {
+            decoded.handler = ld_r_hl_indirect;
+        }
+        else if (opcode == LD_B_B) {
+            decoded.handler = ld_b_b;
+        }
+        else {
+            decoded.handler = ld_r_r;
+        }
+        decoded.target = register_offsets[y];
+        decoded.source = register_offsets[z];
+        break;
+    case 2:
+        // alu[y] r[z]
+        decoded.handler = alu_handlers[y][(z == 6) ? ALU_HL_INDIRECT : ALU_REGISTER];
+        decoded.source = register_offsets[z];
+        break;
+    case 3:
+        switch (z) {
+            case 0:
+                if (y < 4) {
+                    decoded.handler = ret;
+                    set_condition(&decoded, y);
+                }
+                else {
+                    static const instruction_handler handlers[4] = {ldh_u8_a, add_sp_i8, ldh_a_u8, ld_hl_sp_i8};
+                    decoded.handler = handlers[y - 4];
+                }
+                break;
+            case 1:
+                if (q == 0) {
+                    decoded.handler = (p == 3) ? pop_af : pop_rp;
+                    decoded.target = stack_pair_offsets[p];
+                }
+                else {
+                    static const instruction_handler handlers[4] = {ret, reti, jp_hl, ld_sp_hl};
+                    decoded.handler = handlers[p];
+                }
+                break;
+            case 2:
+                if (y < 4) {
+                    decoded.handler = jp;
+                    set_condition(&decoded, y);
+                }
+                else {
+                    static const instruction_handler handlers[4] = {ldh_c_a, ld_u16_a, ldh_a_c, ld_a_u16};
+                    decoded.handler = handlers[y - 4];
+                }
+                break;
+            case 3: {
+                // JP u16, the prefix, four holes, DI and EI
+                static const instruction_handler handlers[8] = {jp, prefix, illegal, illegal, illegal, illegal, di, ei};
+                decoded.handler = handlers[y];
+                break;
+            }
+            case 4:
+                if (y < 4) {
+                    decoded.handler = call;
+                    set_condition(&decoded, y);
+                }
+                break;
+            case 5:
+                if (q == 0) {
+                    decoded.handler = push_rp;
+                    decoded.target = stack_pair_offsets[p];
+                }
+                else if (p == 0) {
+                    decoded.handler = call;
+                }
+                break;
+            case 6:
+                decoded.handler = alu_handlers[y][ALU_IMMEDIATE];
+                break;
+            case 7:
+                decoded.handler = rst;
+                decoded.value = y * 8;
+                break;
+        }
+        break;
+    }
+    return decoded;
+}
+
+static decoded_instruction decode_prefixed(uint8_t opcode) {
+    uint8_t x = (opcode & 0b11000000) >> 6;
+    uint8_t y = (opcode & 0b00111000) >> 3;
+    uint8_t z = (opcode & 0b00000111);
+    bool memory = (z == 6);
+    decoded_instruction decoded = {.source = register_offsets[z], .value = 1 << y};
+
+    switch (x) {
+        case 0:
+            decoded.handler = shift_handlers[y][memory];
+            break;
+        case 1:
+            decoded.handler = memory ? bit_hl : bit_r;
+            break;
+        case 2:
+            decoded.handler = memory ? res_hl : res_r;
+            break;
+        case 3:
+            decoded.handler = memory ? set_hl : set_r;
+            break;
+    }
+    return decoded;
+}
+
+__attribute__((constructor)) static void build_decoded_instructions(void) {
+    for (uint16_t opcode = 0; opcode < 0x100; opcode++) {
+        decoded_instructions[opcode] = decode_unprefixed(opcode);
+        decoded_instructions[0x100 + opcode] = decode_prefixed(opcode);
+    }
+}
+
+bool decoder_execute(cpu_state* cpu, machine_state* machine) {
+#ifdef DMGEM_TRACE
+    LOG_MSG(debug, "Executing instruction opcode 0x%02x at $%04x\n", *bus_read(cpu->PC, machine), cpu->PC);
+#endif
+    const decoded_instruction* instruction = &decoded_instructions[*bus_read(cpu->PC++, machine)];
+    return instruction->handler(cpu, machine, instruction);
+}
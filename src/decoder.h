@@ -0,0 +1,14 @@
+// Table driven interpreter core. Every opcode in both maps is decoded once at
+// startup from its x/y/z/p/q bit fields into a handler and the operands it
+// works on, so executing an instruction is a single indexed call with no
+// decoding left to do.
+
+#pragma once
+#include <stdbool.h>
+
+#include "machine.h"
+#include "registers.h"
+
+/// Executes the instruction at PC, like the switch core in cpu.c.
+/// \return false if the CPU stopped
+bool decoder_execute(cpu_state* cpu, machine_state* machine);
@@ -0,0 +1,277 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "logging.h"
+
+#include "determinism.h"
+#include "cpu.h"
+#include "bus.h"
+#include "hash.h"
+
+#define PAGE_SIZE (1 << BUS_PAGE_SHIFT)
+// Written by DMA and the other components without going through the bus
+#define OAM_PAGE (0xFE00 >> BUS_PAGE_SHIFT)
+#define IO_PAGE (0xFF00 >> BUS_PAGE_SHIFT)
+
+const char* state_region_names[STATE_REGION_COUNT] = {
+    [STATE_REGION_ROM] = "ROM copy",
+    [STATE_REGION_VRAM] = "VRAM",
+    [STATE_REGION_CART] = "cartridge window",
+    [STATE_REGION_WRAM] = "work RAM",
+    [STATE_REGION_ECHO] = "echo RAM",
+    [STATE_REGION_OAM] = "OAM",
+    [STATE_REGION_IO] = "I/O and HRAM",
+    [STATE_REGION_EXTERNAL_RAM] = "external RAM"
+};
+
+// Region of a page of the arena
+static state_region page_region(uint32_t page) {
+    if (page >= BUS_PAGE_COUNT) {
+        return STATE_REGION_EXTERNAL_RAM;
+    }
+    if (page < (0x8000 >> BUS_PAGE_SHIFT)) {
+        return STATE_REGION_ROM;
+    }
+    if (page < (0xA000 >> BUS_PAGE_SHIFT)) {
+        return STATE_REGION_VRAM;
+    }
+    if (page < (0xC000 >> BUS_PAGE_SHIFT)) {
+        return STATE_REGION_CART;
+    }
+    if (page < (0xE000 >> BUS_PAGE_SHIFT)) {
+        return STATE_REGION_WRAM;
+    }
+    if (page < OAM_PAGE) {
+        return STATE_REGION_ECHO;
+    }
+    return (page == OAM_PAGE) ? STATE_REGION_OAM : STATE_REGION_IO;
+}
+
+// Spreads a page's CRC over 64 bits, keyed by where the page is. Region
+// hashes are sums of these, so one page can be swapped out of them.
+static uint64_t page_term(uint32_t page, uint32_t crc) {
+    uint64_t term = (((uint64_t) page << 32) | crc) * 0x9E3779B97F4A7C15ull;
+    return term ^ (term >> 29);
+}
+
+static void rehash_page(state_hasher* hasher, uint32_t page) {
+    uint32_t crc = crc32c(0, hasher->machine->arena + page * PAGE_SIZE, PAGE_SIZE);
+    if (crc != hasher->page_crcs[page]) {
+        state_region region = page_region(page);
+        hasher->region_sums[region] += page_term(page, crc) - page_term(page, hasher->page_crcs[page]);
+        hasher->page_crcs[page] = crc;
+    }
+}
+
+bool state_hasher_attach(state_hasher* hasher, machine_state* machine) {
+    memset(hasher, 0, sizeof(*hasher));
+    hasher->machine = machine;
+    hasher->page_count = (CONSOLE_MEMORY_SIZE + RAM_BANK_SIZE * machine->ram_bank_count) / PAGE_SIZE;
+    hasher->page_crcs = malloc(hasher->page_count * sizeof(*hasher->page_crcs));
+    hasher->dirty = calloc(hasher->page_count, 1);
+    if (hasher->page_crcs == NULL || hasher->dirty == NULL) {
+        LOG_MSG(error, "Failed to allocate the state hasher\n");
+        free(hasher->page_crcs);
+        free(hasher->dirty);
+        return false;
+    }
+    for (uint32_t page = 0; page < hasher->page_count; page++) {
+        hasher->page_crcs[page] = crc32c(0, machine->arena + page * PAGE_SIZE, PAGE_SIZE);
+        hasher->region_sums[page_region(page)] += page_term(page, hasher->page_crcs[page]);
+    }
+    machine->hasher = hasher;
+    bus_map_pages(machine);
+    return true;
+}
+
+void state_hasher_detach(state_hasher* hasher) {
+    machine_state* machine = hasher->machine;
+    if (machine != NULL) {
+        machine->hasher = NULL;
+        bus_map_pages(machine);
+    }
+    free(hasher->page_crcs);
+    free(hasher->dirty);
+    memset(hasher, 0, sizeof(*hasher));
+}
+
+void state_hasher_protect(state_hasher* hasher, uint16_t first_page, uint16_t last_page) {
+    machine_state* machine = hasher->machine;
+    for (uint16_t page = first_page; page <= last_page; page++) {
+        hasher->writable_pages[page] = machine->write_pages[page];
+        machine->write_pages[page] = NULL;
+    }
+}
+
+void state_hasher_write(state_hasher* hasher, uint16_t address) {
+    machine_state* machine = hasher->machine;
+    // Wherever the write lands, console memory or a RAM bank, is in the arena
+    const uint8_t* target = bus_peek(machine, address);
+    if (target >= machine->arena && target < machine->arena + hasher->page_count * PAGE_SIZE) {
+        hasher->dirty[(target - machine->arena) / PAGE_SIZE] = 1;
+    }
+    // The rest of the frame's writes to the page go straight to it
+    uint8_t page = address >> BUS_PAGE_SHIFT;
+    if (hasher->writable_pages[page] != NULL) {
+        machine->write_pages[page] = hasher->writable_pages[page];
+    }
+}
+
+void state_hasher_frame(state_hasher* hasher, state_hash* hash) {
+    machine_state* machine = hasher->machine;
+    hasher->dirty[OAM_PAGE] = 1;
+    hasher->dirty[IO_PAGE] = 1;
+    bool full = (++hasher->frames % STATE_HASH_FULL_INTERVAL) == 0;
+    for (uint32_t page = 0; page < hasher->page_count; page++) {
+        if (hasher->dirty[page] || full) {
+            hasher->dirty[page] = 0;
+            rehash_page(hasher, page);
+        }
+    }
+    for (uint16_t page = 0; page < BUS_PAGE_COUNT; page++) {
+        if (hasher->writable_pages[page] != NULL) {
+            machine->write_pages[page] = NULL;
+        }
+    }
+
+    const cpu_state* cpu = &machine->cpu;
+    uint64_t registers[] = {
+        cpu->AF, cpu->BC, cpu->DE, cpu->HL, cpu->SP, cpu->PC,
+        cpu->IME, cpu->ime_pending, cpu->halted, machine->clock
+    };
+    uint32_t low = crc32c(0, (const uint8_t*) registers, sizeof(registers));
+    uint32_t high = crc32c(low, (const uint8_t*) registers, sizeof(registers));
+    hash->registers = ((uint64_t) high << 32) | low;
+    memcpy(hash->regions, hasher->region_sums, sizeof(hash->regions));
+}
+
+typedef struct {
+    const uint8_t* rom_data;
+    uint32_t rom_size;
+    cpu_core core;
+    uint32_t frames;
+    state_hash* hashes; // One per frame
+    uint32_t frames_run;
+    bool stopped; // The CPU stopped before the last frame
+    bool failed; // The machine couldn't be set up
+}determinism_lane;
+
+static void* run_lane(void* argument) {
+    determinism_lane* lane = argument;
+    machine_state machine = {.core = lane->core};
+    state_hasher hasher = {0};
+    if (!machine_init(&machine, lane->rom_data, lane->rom_size) || !state_hasher_attach(&hasher, &machine)) {
+        lane->failed = true;
+        machine_free(&machine);
+        return NULL;
+    }
+    uint64_t next_frame = MACHINE_CYCLES_PER_FRAME;
+    while (lane->frames_run < lane->frames && !lane->stopped) {
+        while (machine.clock < next_frame) {
+            if (cpu_step(&machine) == 0) {
+                lane->stopped = true;
+                break;
+            }
+        }
+        next_frame += MACHINE_CYCLES_PER_FRAME;
+        state_hasher_frame(&hasher, &lane->hashes[lane->frames_run++]);
+    }
+    state_hasher_detach(&hasher);
+    machine_free(&machine);
+    return NULL;
+}
+
+// Logs what differs between two lanes' hashes of a frame
+// \return true if anything does
+static bool report_difference(const state_hash* expected, const state_hash* actual, uint8_t lane, uint32_t frame) {
+    bool registers = expected->registers != actual->registers;
+    bool regions = memcmp(expected->regions, actual->regions, sizeof(expected->regions)) != 0;
+    if (!registers && !regions) {
+        return false;
+    }
+    LOG_MSG(error, "Lane %u diverged from lane 0 at frame %u in:\n", lane, frame);
+    if (registers) {
+        LOG_MSG(error, "  CPU registers (%016llx, lane 0 has %016llx)\n",
+                (unsigned long long) actual->registers, (unsigned long long) expected->registers);
+    }
+    for (uint8_t region = 0; region < STATE_REGION_COUNT; region++) {
+        if (expected->regions[region] != actual->regions[region]) {
+            LOG_MSG(error, "  %s (%016llx, lane 0 has %016llx)\n", state_region_names[region],
+                    (unsigned long long) actual->regions[region], (unsigned long long) expected->regions[region]);
+        }
+    }
+    return true;
+}
+
+bool run_determinism_check(const uint8_t* rom_data, uint32_t rom_size, uint8_t lanes, uint32_t frames,
+                           const run_options* options) {
+    if (lanes < DETERMINISM_MIN_LANES || lanes > DETERMINISM_MAX_LANES || frames == 0) {
+        LOG_MSG(error, "Determinism checks need %d-%d lanes and at least one frame\n", DETERMINISM_MIN_LANES,
+                DETERMINISM_MAX_LANES);
+        return true;
+    }
+    struct timespec start = {0};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    determinism_lane lane_states[DETERMINISM_MAX_LANES] = {0};
+    pthread_t threads[DETERMINISM_MAX_LANES];
+    bool started[DETERMINISM_MAX_LANES] = {0};
+    bool failed = false;
+    for (uint8_t i = 0; i < lanes; i++) {
+        determinism_lane* lane = &lane_states[i];
+        lane->rom_data = rom_data;
+        lane->rom_size = rom_size;
+        lane->core = options->core;
+        lane->frames = frames;
+        lane->hashes = calloc(frames, sizeof(*lane->hashes));
+        started[i] = lane->hashes != NULL && pthread_create(&threads[i], NULL, run_lane, lane) == 0;
+        failed |= !started[i];
+    }
+    for (uint8_t i = 0; i < lanes; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        failed |= lane_states[i].failed;
+    }
+    if (failed) {
+        LOG_MSG(error, "Failed to start every lane\n");
+    }
+
+    // Everything is compared against lane 0, up to the first difference
+    uint32_t frames_run = lane_states[0].frames_run;
+    bool diverged = false;
+    for (uint32_t frame = 0; frame < frames_run && !diverged && !failed; frame++) {
+        for (uint8_t i = 1; i < lanes && !diverged; i++) {
+            if (frame >= lane_states[i].frames_run) {
+                LOG_MSG(error, "Lane %u stopped at frame %u, lane 0 ran %u frames\n", i, lane_states[i].frames_run, frames_run);
+                diverged = true;
+                break;
+            }
+            diverged = report_difference(&lane_states[0].hashes[frame], &lane_states[i].hashes[frame], i, frame);
+        }
+    }
+    for (uint8_t i = 1; i < lanes && !diverged && !failed; i++) {
+        if (lane_states[i].frames_run != frames_run) {
+            LOG_MSG(error, "Lane %u ran %u frames, lane 0 stopped at frame %u\n", i, lane_states[i].frames_run, frames_run);
+            diverged = true;
+        }
+    }
+
+    if (!diverged && !failed) {
+        struct timespec end = {0};
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        const state_hash* last = &lane_states[0].hashes[frames_run - 1];
+        uint32_t final_hash = crc32c(0, (const uint8_t*) last, sizeof(*last));
+        LOG_MSG(info, "%u lanes matched over %u frames%s in %.3fs, final state hash %08x\n", lanes, frames_run,
+                lane_states[0].stopped ? " (the CPU stopped)" : "", seconds, final_hash);
+    }
+    for (uint8_t i = 0; i < lanes; i++) {
+        free(lane_states[i].hashes);
+    }
+    return diverged || failed;
+}
@@ -0,0 +1,81 @@
+// Determinism checking. A state hasher keeps a rolling hash of the CPU
+// registers and every mutable byte of a machine, split into regions like
+// VRAM, work RAM and external RAM, and updates it once per frame.
+//
+// Only pages that changed are hashed again. Pages are write protected by
+// leaving them out of the bus write tables. The first write to a page in a
+// frame takes the slow path, which marks the page dirty and maps it again
+// for the rest of the frame. The OAM and I/O pages are rehashed every frame,
+// since DMA and the other components write them without the bus. Anything
+// else that writes memory behind the bus's back is still caught by a full
+// rehash every STATE_HASH_FULL_INTERVAL frames, just not on the exact frame.
+//
+// run_determinism_check() runs a ROM on several threads at once and compares
+// the hashes frame by frame, which catches state leaking between machines or
+// depending on anything but the inputs.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "machine.h"
+
+// Frames between rehashing every page, dirty or not
+#define STATE_HASH_FULL_INTERVAL 64
+// Lanes run_determinism_check() can compare
+#define DETERMINISM_MIN_LANES 2
+#define DETERMINISM_MAX_LANES 64
+
+typedef enum {
+    STATE_REGION_ROM, // ROM copy of carts without a controller
+    STATE_REGION_VRAM,
+    STATE_REGION_CART, // 0xA000-0xBFFF of console memory, unused by carts with RAM
+    STATE_REGION_WRAM,
+    STATE_REGION_ECHO,
+    STATE_REGION_OAM,
+    STATE_REGION_IO, // I/O registers and HRAM
+    STATE_REGION_EXTERNAL_RAM,
+    STATE_REGION_COUNT
+}state_region;
+
+// Hashes of a machine at the end of a frame
+typedef struct {
+    uint64_t registers; // CPU registers and the clock
+    uint64_t regions[STATE_REGION_COUNT];
+}state_hash;
+
+typedef struct state_hasher {
+    machine_state* machine;
+    uint32_t page_count; // 256 byte pages in the mutable part of the arena
+    uint32_t* page_crcs;
+    uint8_t* dirty; // Byte per page
+    uint64_t region_sums[STATE_REGION_COUNT];
+    uint64_t frames;
+    // What the bus would map each page to for writes, while it's protected
+    uint8_t* writable_pages[BUS_PAGE_COUNT];
+}state_hasher;
+
+extern const char* state_region_names[STATE_REGION_COUNT];
+
+/// Attaches a hasher to a machine and hashes all of its memory once.
+/// \return false if allocation failed
+bool state_hasher_attach(state_hasher* hasher, machine_state* machine);
+
+// Detaches from the machine and maps its pages again.
+void state_hasher_detach(state_hasher* hasher);
+
+// Called by the bus whenever it maps pages, to protect them for writes.
+void state_hasher_protect(state_hasher* hasher, uint16_t first_page, uint16_t last_page);
+
+// Called by the bus slow path before every write.
+void state_hasher_write(state_hasher* hasher, uint16_t address);
+
+// Rehashes what changed since the last call and protects those pages again.
+void state_hasher_frame(state_hasher* hasher, state_hash* hash);
+
+/// Runs a ROM on several threads in parallel for a number of frames and
+/// reports the first frame, lane and regions where they diverged.
+/// \param options Only the core is used
+/// \return false if every lane matched
+bool run_determinism_check(const uint8_t* rom_data, uint32_t rom_size, uint8_t lanes, uint32_t frames,
+                           const run_options* options);
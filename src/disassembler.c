@@ -0,0 +1,359 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "file.h"
+
+#include "disassembler.h"
+#include "opcode_info.h"
+#include "bus.h"
+
+// Windows of the address space that can be switched to another bank
+#define SWITCHABLE_ROM(address) ((address) >= 0x4000 && (address) < 0x8000)
+#define SWITCHABLE_RAM(address) ((address) >= 0xA000 && (address) < 0xC000)
+
+// Labels only apply within the memory region they're in, so ROM0 labels
+// don't name WRAM addresses that happen to share a bank number
+static uint8_t region(uint16_t address) {
+    return (address < 0x8000) ? (address >> 14) : (address >> 13);
+}
+
+static uint8_t peek_byte(const machine_state* machine, uint16_t address) {
+    const uint8_t* byte = bus_peek(machine, address);
+    return (byte != NULL) ? *byte : 0xFF;
+}
+
+uint16_t disassembler_bank(const machine_state* machine, uint16_t address) {
+    const uint8_t* byte = bus_peek(machine, address);
+    if (byte == NULL) {
+        return 0;
+    }
+    if (byte >= machine->cartridge_rom && byte < machine->cartridge_rom + machine->rom_size) {
+        return (byte - machine->cartridge_rom) / ROM_BANK_SIZE;
+    }
+    if (byte >= machine->external_ram && byte < machine->external_ram + RAM_BANK_SIZE * machine->ram_bank_count) {
+        return (byte - machine->external_ram) / RAM_BANK_SIZE;
+    }
+    // Carts without a controller run their ROM from console memory, and the
+    // linker still calls the upper half bank 1
+    if (SWITCHABLE_ROM(address)) {
+        return 1;
+    }
+    return 0;
+}
+
+static const symbol* find_symbol(const disassembler* dis, uint16_t bank, uint16_t address) {
+    uint32_t low = 0;
+    uint32_t high = dis->symbol_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        const symbol* s = &dis->symbols[middle];
+        if (s->bank < bank || (s->bank == bank && s->address < address)) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    // Lands on the first symbol at or after the address
+    return (low < dis->symbol_count) ? &dis->symbols[low] : NULL;
+}
+
+static const char* exact_label(const disassembler* dis, uint16_t bank, uint16_t address) {
+    const symbol* s = find_symbol(dis, bank, address);
+    if (s != NULL && s->bank == bank && s->address == address) {
+        return s->name;
+    }
+    return NULL;
+}
+
+void disassembler_symbolize(const disassembler* dis, uint16_t address, char* buffer, uint32_t size) {
+    uint16_t bank = disassembler_bank(dis->machine, address);
+    const symbol* s = find_symbol(dis, bank, address);
+    if (s != NULL && s->bank == bank && s->address == address) {
+        snprintf(buffer, size, "%s", s->name);
+        return;
+    }
+    // Step back to the closest label before the address
+    uint32_t index = (s != NULL) ? (uint32_t) (s - dis->symbols) : dis->symbol_count;
+    if (index != 0) {
+        s = &dis->symbols[index - 1];
+        if (s->bank == bank && region(s->address) == region(address)) {
+            snprintf(buffer, size, "%s+$%x", s->name, address - s->address);
+            return;
+        }
+    }
+    snprintf(buffer, size, "$%02x:%04x", bank, address);
+}
+
+// Writes a label for an address the instruction at from refers to, if it has
+// one. Cached text must stay right whatever banks get switched in later, so
+// targets in a switchable window are only named from inside that same window,
+// where they can only be in the bank the entry was cached for.
+static bool write_target(const disassembler* dis, uint16_t from, uint16_t target, char* text, uint32_t size) {
+    bool switchable = SWITCHABLE_ROM(target) || SWITCHABLE_RAM(target);
+    if (switchable && region(target) != region(from)) {
+        return false;
+    }
+    const char* label = exact_label(dis, disassembler_bank(dis->machine, target), target);
+    if (label == NULL) {
+        return false;
+    }
+    snprintf(text, size, "%s", label);
+    return true;
+}
+
+// Fills in the operand placeholders of an opcode_info mnemonic
+static void format_instruction(const disassembler* dis, uint16_t address, const opcode_info* info,
+                               const uint8_t* bytes, char* text, uint32_t size) {
+    if (info->mnemonic == NULL) {
+        snprintf(text, size, "DB $%02x", bytes[0]);
+        return;
+    }
+
+    const char* m = info->mnemonic;
+    uint32_t n = 0;
+    while (*m != '\0' && n + 1 < size) {
+        char operand[DISASSEMBLY_TEXT_SIZE] = {0};
+        if (strncmp(m, "u16", 3) == 0) {
+            uint16_t value = bytes[1] | (bytes[2] << 8);
+            // Only addresses get labels, not constants that look like one
+            bool is_address = (m > info->mnemonic && m[-1] == '(') || info->mnemonic[0] == 'J' || info->mnemonic[0] == 'C';
+            if (!is_address || !write_target(dis, address, value, operand, sizeof(operand))) {
+                snprintf(operand, sizeof(operand), "$%04x", value);
+            }
+            m += 3;
+        }
+        else if (strncmp(m, "FF00+u8", 7) == 0) {
+            uint16_t target = 0xFF00 | bytes[1];
+            if (!write_target(dis, address, target, operand, sizeof(operand))) {
+                snprintf(operand, sizeof(operand), "$%04x", target);
+            }
+            m += 7;
+        }
+        else if (strncmp(m, "u8", 2) == 0) {
+            snprintf(operand, sizeof(operand), "$%02x", bytes[1]);
+            m += 2;
+        }
+        else if (strncmp(m, "i8", 2) == 0) {
+            int8_t offset = (int8_t) bytes[1];
+            if (info->mnemonic[0] == 'J') {
+                uint16_t target = address + info->length + offset;
+                if (!write_target(dis, address, target, operand, sizeof(operand))) {
+                    snprintf(operand, sizeof(operand), "$%04x", target);
+                }
+            }
+            else {
+                // "SP+i8" already has its sign, "ADD SP, i8" gets one
+                bool has_sign = n > 0 && text[n - 1] == '+';
+                if (offset < 0) {
+                    if (has_sign) {
+                        n--;
+                    }
+                    snprintf(operand, sizeof(operand), "-$%02x", -offset);
+                }
+                else {
+                    snprintf(operand, sizeof(operand), "%s$%02x", has_sign ? "" : "+", offset);
+                }
+            }
+            m += 2;
+        }
+        else {
+            text[n++] = *m++;
+            continue;
+        }
+        n += snprintf(text + n, size - n, "%s", operand);
+        if (n >= size) {
+            n = size - 1;
+        }
+    }
+    text[n] = '\0';
+}
+
+static void decode(const disassembler* dis, uint16_t address, disassembly_entry* entry) {
+    uint8_t bytes[3] = {0};
+    bytes[0] = peek_byte(dis->machine, address);
+    const opcode_info* info = &unprefixed_opcode_info[bytes[0]];
+    if (bytes[0] == 0xCB) {
+        info = &prefixed_opcode_info[peek_byte(dis->machine, address + 1)];
+    }
+    uint8_t length = (info->mnemonic != NULL) ? info->length : 1;
+    for (uint8_t i = 1; i < length; i++) {
+        bytes[i] = peek_byte(dis->machine, address + i);
+    }
+
+    format_instruction(dis, address, info, bytes, entry->text, sizeof(entry->text));
+    memcpy(entry->bytes, bytes, sizeof(bytes));
+    entry->length = length;
+}
+
+bool disassembler_init(disassembler* dis, machine_state* machine) {
+    memset(dis, 0, sizeof(*dis));
+    dis->machine = machine;
+    dis->page_count = (machine->arena_size + BUS_PAGE_MASK) >> BUS_PAGE_SHIFT;
+    dis->pages = calloc(dis->page_count, sizeof(*dis->pages));
+    if (dis->pages == NULL) {
+        LOG_MSG(error, "Failed to allocate the disassembly cache\n");
+        return false;
+    }
+    return true;
+}
+
+static void clear_cache(disassembler* dis) {
+    for (uint32_t i = 0; i < dis->page_count; i++) {
+        free(dis->pages[i]);
+        dis->pages[i] = NULL;
+    }
+}
+
+void disassembler_free(disassembler* dis) {
+    if (dis->pages != NULL) {
+        clear_cache(dis);
+    }
+    free(dis->pages);
+    free(dis->symbols);
+    free(dis->symbol_file);
+    memset(dis, 0, sizeof(*dis));
+}
+
+const char* disassemble(disassembler* dis, uint16_t address, uint8_t* length) {
+    const machine_state* machine = dis->machine;
+    const uint8_t* byte = bus_peek(machine, address);
+
+    // Entries are keyed by where the byte lives in the arena, which tells
+    // banks apart without asking the memory controller
+    disassembly_entry* entry = &dis->scratch;
+    if (byte != NULL && byte >= machine->arena && byte < machine->arena + machine->arena_size) {
+        uint32_t offset = byte - machine->arena;
+        disassembly_entry** page = &dis->pages[offset >> BUS_PAGE_SHIFT];
+        if (*page == NULL) {
+            *page = calloc(BUS_PAGE_MASK + 1, sizeof(**page)); // One entry per byte of the page
+        }
+        if (*page != NULL) {
+            entry = &(*page)[offset & BUS_PAGE_MASK];
+        }
+    }
+
+    // The entry is still good if the instruction's bytes haven't changed
+    bool valid = entry != &dis->scratch && entry->length != 0;
+    for (uint8_t i = 0; valid && i < entry->length; i++) {
+        valid = entry->bytes[i] == peek_byte(machine, address + i);
+    }
+    if (!valid) {
+        decode(dis, address, entry);
+    }
+    if (length != NULL) {
+        *length = entry->length;
+    }
+    return entry->text;
+}
+
+static int compare_symbols(const void* a, const void* b) {
+    const symbol* left = a;
+    const symbol* right = b;
+    if (left->bank != right->bank) {
+        return left->bank - right->bank;
+    }
+    if (left->address != right->address) {
+        return left->address - right->address;
+    }
+    // Global labels name an address better than the local ones under them
+    bool left_local = strchr(left->name, '.') != NULL;
+    bool right_local = strchr(right->name, '.') != NULL;
+    if (left_local != right_local) {
+        return left_local - right_local;
+    }
+    return (left->order > right->order) - (left->order < right->order);
+}
+
+static bool parse_hex(char** cursor, uint16_t* value) {
+    char* end = NULL;
+    unsigned long result = strtoul(*cursor, &end, 16);
+    if (end == *cursor || result > 0xFFFF) {
+        return false;
+    }
+    *value = result;
+    *cursor = end;
+    return true;
+}
+
+bool disassembler_load_symbols(disassembler* dis, const char* path) {
+    uint32_t size = 0;
+    uint8_t* data = file_load(path, &size);
+    if (data == NULL) {
+        return false;
+    }
+    // Names are terminated in place, which needs room after the last one
+    char* file = realloc(data, size + 1);
+    if (file == NULL) {
+        LOG_MSG(error, "Failed to allocate memory for %s\n", path);
+        free(data);
+        return false;
+    }
+    file[size] = '\0';
+
+    // At most one symbol per line
+    uint32_t lines = 1;
+    for (uint32_t i = 0; i < size; i++) {
+        lines += file[i] == '\n';
+    }
+    symbol* symbols = calloc(lines, sizeof(*symbols));
+    if (symbols == NULL) {
+        LOG_MSG(error, "Failed to allocate memory for %s\n", path);
+        free(file);
+        return false;
+    }
+
+    uint32_t count = 0;
+    uint32_t skipped = 0;
+    char* line = file;
+    for (uint32_t number = 1; line != NULL; number++) {
+        char* next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+        char* c = line;
+        while (*c == ' ' || *c == '\t') {
+            c++;
+        }
+        // Comments and blank lines
+        if (*c == ';' || *c == '\0' || *c == '\r') {
+            line = next;
+            continue;
+        }
+
+        symbol* s = &symbols[count];
+        if (parse_hex(&c, &s->bank) && *c++ == ':' && parse_hex(&c, &s->address) && (*c == ' ' || *c == '\t')) {
+            while (*c == ' ' || *c == '\t') {
+                c++;
+            }
+            s->name = c;
+            c += strcspn(c, " \t\r;");
+            *c = '\0';
+            s->order = number;
+            count += (*s->name != '\0');
+        }
+        else {
+            skipped++;
+        }
+        line = next;
+    }
+    qsort(symbols, count, sizeof(*symbols), compare_symbols);
+
+    free(dis->symbols);
+    free(dis->symbol_file);
+    dis->symbols = symbols;
+    dis->symbol_count = count;
+    dis->symbol_file = file;
+    // Cached text might have labels from the old symbols, or lack new ones
+    clear_cache(dis);
+
+    LOG_MSG(info, "Loaded %u symbols from %s\n", count, path);
+    if (skipped != 0) {
+        LOG_MSG(warning, "Skipped %u lines of %s that aren't symbols\n", skipped, path);
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+// Disassembler for traces, profiler output and crash reports. Decoded text is
+// cached per (bank, address), so symbolizing the same code over and over is a
+// lookup. Labels come from RGBDS .sym files ("BB:AAAA Name" per line).
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "machine.h"
+
+// Longest text an instruction decodes to, labels are cut off to fit
+#define DISASSEMBLY_TEXT_SIZE 48
+
+typedef struct {
+    char text[DISASSEMBLY_TEXT_SIZE];
+    // What the text was decoded from. A lookup compares these with memory,
+    // which catches code writes no matter which path they took to memory.
+    uint8_t bytes[3];
+    uint8_t length; // 0 if nothing is cached here
+}disassembly_entry;
+
+typedef struct {
+    uint16_t bank; // ROM or external RAM bank, 0 for everything else
+    uint16_t address;
+    const char* name;
+    uint32_t order; // Line in the file, to keep sorting stable
+}symbol;
+
+typedef struct {
+    machine_state* machine;
+    // One array of entries per 256 byte page of the machine's arena, which
+    // covers every bank. Pages are allocated the first time they're used.
+    disassembly_entry** pages;
+    uint32_t page_count;
+    disassembly_entry scratch; // For code outside the arena, like open bus during OAM DMA
+
+    symbol* symbols; // Sorted by bank and then address
+    uint32_t symbol_count;
+    char* symbol_file; // Symbol names point into this
+}disassembler;
+
+/// Sets up a disassembler for a machine. The machine has to stay alive and
+/// keep its arena for as long as the disassembler is used.
+/// \return false if allocation failed
+bool disassembler_init(disassembler* dis, machine_state* machine);
+void disassembler_free(disassembler* dis);
+
+/// Loads labels from an RGBDS .sym file, replacing any loaded before.
+/// \return false if the file couldn't be read
+bool disassembler_load_symbols(disassembler* dis, const char* path);
+
+/// Disassembles the instruction at an address, as currently mapped.
+/// \param length Set to the instruction's length in bytes if not NULL
+/// \return Text that stays valid until the next call with the same address
+const char* disassemble(disassembler* dis, uint16_t address, uint8_t* length);
+
+// Bank that an address currently maps to, numbered the way .sym files do.
+uint16_t disassembler_bank(const machine_state* machine, uint16_t address);
+
+/// Names an address as "Label", "Label+$N" with the closest label before it,
+/// or "$BB:AAAA" if there's none.
+void disassembler_symbolize(const disassembler* dis, uint16_t address, char* buffer, uint32_t size);
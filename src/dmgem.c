@@ -0,0 +1,165 @@
+// Embedding API on top of machine_state. The handle keeps a copy of the last
+// finished frame, since the PPU draws the next one into its own framebuffer
+// as soon as it starts.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dmgem.h"
+#include "machine.h"
+#include "cpu.h"
+#include "telemetry.h"
+
+struct dmgem {
+    machine_state machine;
+    bool stopped;
+    uint64_t next_frame; // Clock at which the APU is next caught up, like run_machine() does
+    uint64_t frame_number;
+    uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
+};
+
+dmgem* dmgem_create(const uint8_t* rom, uint32_t size) {
+    dmgem* handle = calloc(1, sizeof(*handle));
+    if (handle == NULL) {
+        return NULL;
+    }
+    if (!machine_init(&handle->machine, rom, size)) {
+        dmgem_destroy(handle);
+        return NULL;
+    }
+    ppu_set_render_interval(&handle->machine.ppu, 1);
+    handle->next_frame = MACHINE_CYCLES_PER_FRAME;
+    return handle;
+}
+
+void dmgem_destroy(dmgem* handle) {
+    if (handle == NULL) {
+        return;
+    }
+    machine_free(&handle->machine);
+    free(handle);
+}
+
+bool dmgem_set_boot_rom(dmgem* handle, const uint8_t* boot_rom, uint32_t size) {
+    if (!machine_set_boot_rom(&handle->machine, boot_rom, size)) {
+        return false;
+    }
+    handle->stopped = false;
+    handle->next_frame = MACHINE_CYCLES_PER_FRAME;
+    handle->frame_number = 0;
+    memset(handle->framebuffer, 0, sizeof(handle->framebuffer));
+    return true;
+}
+
+// Runs one instruction and keeps whatever frame it finished
+// \return true if a frame finished
+static bool step(dmgem* handle) {
+    machine_state* machine = &handle->machine;
+    if (cpu_step(machine) == 0) {
+        handle->stopped = true;
+        return false;
+    }
+    if (machine->clock >= handle->next_frame) {
+        apu_end_frame(&machine->apu, machine->console_memory, machine->clock);
+        handle->next_frame += MACHINE_CYCLES_PER_FRAME;
+    }
+    const uint8_t* frame = ppu_take_frame(&machine->ppu, &handle->frame_number);
+    if (frame == NULL) {
+        return false;
+    }
+    memcpy(handle->framebuffer, frame, sizeof(handle->framebuffer));
+    return true;
+}
+
+dmgem_status dmgem_run_cycles(dmgem* handle, uint32_t cycles) {
+    uint64_t end = handle->machine.clock + cycles;
+    while (!handle->stopped && handle->machine.clock < end) {
+        step(handle);
+    }
+    return handle->stopped ? DMGEM_STOPPED : DMGEM_OK;
+}
+
+dmgem_status dmgem_run_frame(dmgem* handle) {
+    // With the LCD off no frame ever finishes. A running LCD finishes one
+    // within a frame's worth of cycles, so waiting for that long covers both.
+    uint64_t end = handle->machine.clock + MACHINE_CYCLES_PER_FRAME;
+    while (!handle->stopped && handle->machine.clock < end) {
+        if (step(handle)) {
+            break;
+        }
+    }
+    return handle->stopped ? DMGEM_STOPPED : DMGEM_OK;
+}
+
+const uint8_t* dmgem_framebuffer(const dmgem* handle) {
+    return &handle->framebuffer[0][0];
+}
+
+uint64_t dmgem_frame_number(const dmgem* handle) {
+    return handle->frame_number;
+}
+
+uint64_t dmgem_clock(const dmgem* handle) {
+    return handle->machine.clock;
+}
+
+void dmgem_get_stats(const dmgem* handle, dmgem_stats* stats) {
+    const machine_state* machine = &handle->machine;
+    dmgem_stats result = {
+        .cycles = machine->clock,
+        .instructions = machine->stats.instructions,
+        .interrupts = machine->stats.interrupts,
+        .halt_cycles = machine->stats.halt_cycles,
+        .frames = machine->ppu.frame,
+        .frames_rendered = machine->ppu.rendered_frames,
+        .bank_switches = machine->stats.bank_switches,
+        .sram_writes = machine->stats.sram_writes,
+        .slow_reads = machine->stats.slow_reads,
+        .slow_writes = machine->stats.slow_writes
+    };
+    *stats = result;
+}
+
+bool dmgem_write_stats(const dmgem* handle, const char* path, const char* label) {
+    return telemetry_append(path, &handle->machine, label, -1);
+}
+
+void dmgem_set_input(dmgem* handle, uint8_t buttons) {
+    joypad_set(&handle->machine.joypad, handle->machine.console_memory, buttons);
+}
+
+uint32_t dmgem_state_size(const dmgem* handle) {
+    return machine_state_size(&handle->machine);
+}
+
+bool dmgem_save_state(const dmgem* handle, uint8_t* buffer, uint32_t size) {
+    return machine_save_state(&handle->machine, buffer, size);
+}
+
+bool dmgem_load_state(dmgem* handle, const uint8_t* buffer, uint32_t size) {
+    if (!machine_load_state(&handle->machine, buffer, size)) {
+        return false;
+    }
+    handle->stopped = false;
+    // Keep the APU catch up on the loaded clock's frame boundaries
+    uint64_t clock = handle->machine.clock;
+    handle->next_frame = clock - clock % MACHINE_CYCLES_PER_FRAME + MACHINE_CYCLES_PER_FRAME;
+    // The last finished frame comes from the state too. While the PPU is
+    // drawing, its framebuffer is half overwritten, so that frame is lost.
+    ppu_state* ppu = &handle->machine.ppu;
+    const uint8_t* frame = ppu_take_frame(ppu, &handle->frame_number);
+    if (frame == NULL && !ppu->rendering) {
+        frame = &ppu->framebuffer[0][0];
+        handle->frame_number = ppu->ready_frame;
+    }
+    if (frame != NULL) {
+        memcpy(handle->framebuffer, frame, sizeof(handle->framebuffer));
+    }
+    else {
+        handle->frame_number = 0;
+        memset(handle->framebuffer, 0, sizeof(handle->framebuffer));
+    }
+    return true;
+}
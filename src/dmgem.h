@@ -0,0 +1,111 @@
+// Embedding API. Each dmgem handle is one emulated Game Boy. The host runs it
+// a number of cycles or a frame at a time, reads the finished frame, sets the
+// buttons and saves or loads states. This is the only header a host needs,
+// and it's built into the static and shared libdmgem. Handles are
+// independent, but a single handle must not be used from two threads at
+// once.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// The shared library only exports what's declared here
+#define DMGEM_API __attribute__((visibility("default")))
+
+#define DMGEM_SCREEN_WIDTH 160
+#define DMGEM_SCREEN_HEIGHT 144
+// Machine cycles (M-cycles) per second and per frame
+#define DMGEM_CYCLES_PER_SECOND 1048576
+#define DMGEM_CYCLES_PER_FRAME 17556
+#define DMGEM_BOOT_ROM_SIZE 256
+
+// Buttons for dmgem_set_input(), combined as a bit mask
+typedef enum {
+    DMGEM_BUTTON_RIGHT = 0x01,
+    DMGEM_BUTTON_LEFT = 0x02,
+    DMGEM_BUTTON_UP = 0x04,
+    DMGEM_BUTTON_DOWN = 0x08,
+    DMGEM_BUTTON_A = 0x10,
+    DMGEM_BUTTON_B = 0x20,
+    DMGEM_BUTTON_SELECT = 0x40,
+    DMGEM_BUTTON_START = 0x80
+}dmgem_button;
+
+typedef enum {
+    DMGEM_OK,
+    DMGEM_STOPPED // The CPU hit STOP or an illegal opcode and won't run further
+}dmgem_status;
+
+// Counters since the machine was created, for telemetry
+typedef struct {
+    uint64_t cycles;
+    uint64_t instructions; // Instructions retired
+    uint64_t interrupts; // Interrupts dispatched
+    uint64_t halt_cycles; // Cycles skipped ahead while halted
+    uint64_t frames; // Frames started, including ones not rendered
+    uint64_t frames_rendered;
+    uint64_t bank_switches; // Controller writes that changed the ROM or RAM bank
+    uint64_t sram_writes; // Writes that reached cartridge RAM
+    uint64_t slow_reads; // Accesses that missed the page tables
+    uint64_t slow_writes;
+}dmgem_stats;
+
+typedef struct dmgem dmgem;
+
+/// Creates a machine running the ROM.
+/// \param rom ROM file contents, copied into the machine
+/// \return NULL if allocation failed or the cartridge isn't supported
+DMGEM_API dmgem* dmgem_create(const uint8_t* rom, uint32_t size);
+DMGEM_API void dmgem_destroy(dmgem* handle);
+
+/// Loads a DMG boot ROM and restarts the machine from power on to run it.
+/// Without one, machines start in the state it hands over in.
+/// \param size Must be DMGEM_BOOT_ROM_SIZE
+/// \return false, leaving the machine as it was, if the size is wrong
+DMGEM_API bool dmgem_set_boot_rom(dmgem* handle, const uint8_t* boot_rom, uint32_t size);
+
+/// Runs at least the given number of machine cycles. The last instruction
+/// can go a few cycles over, the next call accounts for that.
+DMGEM_API dmgem_status dmgem_run_cycles(dmgem* handle, uint32_t cycles);
+
+/// Runs until the PPU finishes a frame, or for at most a frame's worth of
+/// cycles, which is what happens while the LCD is off.
+DMGEM_API dmgem_status dmgem_run_frame(dmgem* handle);
+
+/// Most recently finished frame, DMGEM_SCREEN_HEIGHT rows of
+/// DMGEM_SCREEN_WIDTH shades from 0 (white) to 3 (black). Blank until the
+/// first frame. Stays valid until the handle is destroyed.
+DMGEM_API const uint8_t* dmgem_framebuffer(const dmgem* handle);
+
+// Number of the frame in dmgem_framebuffer(), counted from power on.
+DMGEM_API uint64_t dmgem_frame_number(const dmgem* handle);
+
+// Machine cycles run since power on.
+DMGEM_API uint64_t dmgem_clock(const dmgem* handle);
+
+// Fills in the counters. Loading a state restores cycles and frames, the
+// rest carry on.
+DMGEM_API void dmgem_get_stats(const dmgem* handle, dmgem_stats* stats);
+
+/// Appends the counters to a file as a JSON line, see telemetry.h.
+/// \param label Tags the line, e.g. the ROM path. Can be NULL.
+/// \return false if the file couldn't be written
+DMGEM_API bool dmgem_write_stats(const dmgem* handle, const char* path, const char* label);
+
+/// Sets which buttons are held until the next call.
+/// \param buttons dmgem_button bits
+DMGEM_API void dmgem_set_input(dmgem* handle, uint8_t buttons);
+
+// Size of the buffer dmgem_save_state() needs, fixed for a handle.
+DMGEM_API uint32_t dmgem_state_size(const dmgem* handle);
+
+/// Saves the machine. States only load into the same ROM, with the same
+/// build of the library.
+/// \return false if the buffer is too small
+DMGEM_API bool dmgem_save_state(const dmgem* handle, uint8_t* buffer, uint32_t size);
+
+/// Restores a state from dmgem_save_state(), along with the frame
+/// dmgem_framebuffer() returns. That is blank if the state was saved while a
+/// frame was being drawn.
+/// \return false, leaving the machine as it was, if the state doesn't fit it
+DMGEM_API bool dmgem_load_state(dmgem* handle, const uint8_t* buffer, uint32_t size);
@@ -1,3 +1,5 @@
+#include <stdio.h>
+#include <malloc.h>
 #include <sys/stat.h>
 
 #include "logging.h"
@@ -14,3 +16,32 @@ uint32_t file_size(const char* filepath) {
     return st.st_size;
 }
 
+uint8_t* file_load(const char* filepath, uint32_t* size) {
+    if (!file_exists(filepath)) {
+        LOG_MSG(error, "%s doesn't exist.\n", filepath);
+        return NULL;
+    }
+
+    *size = file_size(filepath);
+    uint8_t* data = calloc(*size, 1);
+    if (data == NULL) {
+        LOG_MSG(error, "Failed to allocate %d bytes for %s\n", *size, filepath);
+        return NULL;
+    }
+
+    FILE* file = fopen(filepath, "rb");
+    if (file == NULL) {
+        LOG_MSG(error, "Failed to open %s\n", filepath);
+        free(data);
+        return NULL;
+    }
+
+    if (fread(data, *size, 1, file) != 1) {
+        LOG_MSG(error, "Failed to read all %d bytes from %s\n", *size, filepath);
+        fclose(file);
+        free(data);
+        return NULL;
+    }
+    fclose(file);
+    return data;
+}
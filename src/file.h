@@ -4,3 +4,8 @@
 bool file_exists(const char* filepath);
 uint32_t file_size(const char* filepath);
 
+/// Reads an entire file into a new buffer.
+/// \param filepath File to read
+/// \param size Set to the number of bytes read
+/// \return Buffer owned by the caller, or NULL on failure
+uint8_t* file_load(const char* filepath, uint32_t* size);
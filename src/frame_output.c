@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+
+#include "frame_output.h"
+#include "png.h"
+
+// T-cycles per frame, for the Y4M frame rate
+#define FRAME_T_CYCLES 70224
+
+static const uint8_t shade_luma[4] = {0xFF, 0xAA, 0x55, 0x00};
+
+static bool write_y4m_frame(frame_output* output, const frame_slot* slot) {
+    uint8_t luma[SCREEN_HEIGHT * SCREEN_WIDTH];
+    const uint8_t* shades = &slot->pixels[0][0];
+    for (uint32_t i = 0; i < sizeof(luma); i++) {
+        luma[i] = shade_luma[shades[i] & 0x3];
+    }
+    fputs("FRAME\n", output->stream);
+    return fwrite(luma, 1, sizeof(luma), output->stream) == sizeof(luma);
+}
+
+static bool write_png_frame(frame_output* output, const frame_slot* slot) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/frame_%08" PRIu64 ".png", output->path, slot->frame);
+    return png_write_shades(path, &slot->pixels[0][0], SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+static void* output_thread(void* user) {
+    frame_output* output = user;
+    while (true) {
+        sem_wait(&output->filled);
+        uint32_t tail = output->tail;
+        if (tail == __atomic_load_n(&output->head, __ATOMIC_ACQUIRE)) {
+            // The only post without a frame behind it is the one from
+            // frame_output_stop(), which comes after the last frame
+            if (__atomic_load_n(&output->stopping, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            continue;
+        }
+
+        const frame_slot* slot = &output->slots[tail & (FRAME_RING_SLOTS - 1)];
+        // Keep draining after a failure so the producer can't block forever
+        if (!output->failed) {
+            bool ok = (output->format == FRAME_OUTPUT_Y4M) ? write_y4m_frame(output, slot) : write_png_frame(output, slot);
+            if (ok) {
+                output->written++;
+            }
+            else {
+                LOG_MSG(error, "Failed to write frame %" PRIu64 ", no more frames will be written\n", slot->frame);
+                output->failed = true;
+            }
+        }
+        __atomic_store_n(&output->tail, tail + 1, __ATOMIC_RELEASE);
+        sem_post(&output->freed);
+    }
+    return NULL;
+}
+
+bool frame_output_start(frame_output* output, frame_output_format format, const char* path, frame_output_policy policy, uint32_t interval) {
+    memset(output, 0, sizeof(*output));
+    output->format = format;
+    output->policy = policy;
+    output->path = path;
+
+    if (format == FRAME_OUTPUT_Y4M) {
+        // Logging goes to stdout, so a live viewer needs a FIFO instead
+        output->stream = fopen(path, "wb");
+        if (output->stream == NULL) {
+            LOG_MSG(error, "Failed to open %s for writing\n", path);
+            return false;
+        }
+        // Mono is 8-bit luma only, which is all a DMG frame needs
+        fprintf(output->stream, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 Cmono\n",
+                SCREEN_WIDTH, SCREEN_HEIGHT, 4194304, FRAME_T_CYCLES * (interval != 0 ? interval : 1));
+    }
+    else if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        LOG_MSG(error, "Failed to create %s\n", path);
+        return false;
+    }
+
+    sem_init(&output->filled, 0, 0);
+    sem_init(&output->freed, 0, 0);
+    if (pthread_create(&output->thread, NULL, output_thread, output) != 0) {
+        LOG_MSG(error, "Failed to start the frame output thread\n");
+        sem_destroy(&output->filled);
+        sem_destroy(&output->freed);
+        if (output->stream != NULL) {
+            fclose(output->stream);
+        }
+        output->stream = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool frame_output_publish(frame_output* output, const uint8_t* pixels, uint64_t frame) {
+    uint32_t head = output->head;
+    while (head - __atomic_load_n(&output->tail, __ATOMIC_ACQUIRE) == FRAME_RING_SLOTS) {
+        if (output->policy == FRAME_OUTPUT_DROP) {
+            output->dropped++;
+            return false;
+        }
+        // Posts from frames consumed while the ring wasn't full are still
+        // counted, so this can wake early. The loop checks again.
+        sem_wait(&output->freed);
+    }
+
+    frame_slot* slot = &output->slots[head & (FRAME_RING_SLOTS - 1)];
+    slot->frame = frame;
+    memcpy(slot->pixels, pixels, sizeof(slot->pixels));
+    __atomic_store_n(&output->head, head + 1, __ATOMIC_RELEASE);
+    sem_post(&output->filled);
+    output->published++;
+    return true;
+}
+
+void frame_output_stop(frame_output* output) {
+    __atomic_store_n(&output->stopping, true, __ATOMIC_RELEASE);
+    sem_post(&output->filled);
+    pthread_join(output->thread, NULL);
+    sem_destroy(&output->filled);
+    sem_destroy(&output->freed);
+
+    if (output->stream != NULL) {
+        fclose(output->stream);
+        output->stream = NULL;
+    }
+    LOG_MSG(info, "Wrote %" PRIu64 " frames, dropped %" PRIu64 "\n", output->written, output->dropped);
+}
@@ -0,0 +1,71 @@
+// Encodes finished frames on a separate thread, so writing video never stalls
+// emulation. Frames go through a single producer, single consumer ring that
+// needs no locks: the emulator thread only moves the head and the output
+// thread only moves the tail. Semaphores are only used to sleep on an empty or
+// full ring, never to protect the slots.
+
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "ppu.h"
+
+// Power of two, so indices can keep counting up and wrap with a mask
+#define FRAME_RING_SLOTS 8
+
+typedef enum {
+    FRAME_OUTPUT_PNG, // One numbered PNG per frame in a directory
+    FRAME_OUTPUT_Y4M // Grayscale YUV4MPEG2 stream, can be a FIFO for live viewing
+}frame_output_format;
+
+typedef enum {
+    FRAME_OUTPUT_BLOCK, // Wait for a free slot, every frame gets written
+    FRAME_OUTPUT_DROP // Throw the frame away, emulation never waits
+}frame_output_policy;
+
+typedef struct {
+    uint64_t frame; // Frame number from the PPU
+    uint8_t pixels[SCREEN_HEIGHT][SCREEN_WIDTH];
+}frame_slot;
+
+typedef struct {
+    frame_slot slots[FRAME_RING_SLOTS];
+    // Frames published and consumed so far. Each side only writes its own
+    // counter, the slot between them belongs to the consumer.
+    uint32_t head;
+    uint32_t tail;
+    sem_t filled; // Posted for every published frame and once to stop
+    sem_t freed; // Posted for every consumed frame
+    bool stopping;
+
+    frame_output_format format;
+    frame_output_policy policy;
+    const char* path;
+    FILE* stream; // Y4M output
+    pthread_t thread;
+
+    // Producer statistics
+    uint64_t published;
+    uint64_t dropped;
+    // Consumer statistics, only read after the thread has been joined
+    uint64_t written;
+    bool failed;
+}frame_output;
+
+/// Opens the output and starts the encoding thread.
+/// \param path PNG directory or Y4M file
+/// \param interval Every how many emulated frames one is published, sets the Y4M frame rate
+/// \return false if the output couldn't be opened or the thread didn't start
+bool frame_output_start(frame_output* output, frame_output_format format, const char* path, frame_output_policy policy, uint32_t interval);
+
+/// Hands a frame to the output thread. Never blocks with FRAME_OUTPUT_DROP.
+/// \param pixels SCREEN_HEIGHT rows of SCREEN_WIDTH shades
+/// \return false if the frame was dropped
+bool frame_output_publish(frame_output* output, const uint8_t* pixels, uint64_t frame);
+
+// Waits for every published frame to be written, then stops the thread and
+// closes the output.
+void frame_output_stop(frame_output* output);
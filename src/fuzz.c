@@ -0,0 +1,120 @@
+// libFuzzer/AFL entry point. Each input becomes a small cartridge: the first
+// bytes choose the cartridge type and sizes, the rest is code starting at
+// 0x150. The machine runs for a bounded number of cycles and is reused
+// between inputs, a reset only clears its memory.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "machine.h"
+#include "cpu.h"
+#include "memory_controllers.h"
+#include "rom.h"
+
+// Machine cycles each input gets to run
+#define FUZZ_MAX_CYCLES 100000
+// Size of the generated ROM buffer. The header may declare fewer banks, in
+// which case the rest is never used.
+#define FUZZ_ROM_SIZE (ROM_BANK_SIZE * 4)
+// One counter per ROM byte, then one per address from 0x8000 up, which is
+// RAM that code can run from too
+#define FUZZ_GUEST_COVERAGE_SIZE (FUZZ_ROM_SIZE + 0x8000)
+
+typedef enum {
+    FUZZ_BYTE_CART_TYPE,
+    FUZZ_BYTE_ROM_SIZE,
+    FUZZ_BYTE_RAM_SIZE,
+    FUZZ_HEADER_SIZE
+}fuzz_input_layout;
+
+static const uint8_t fuzz_cart_types[] = {
+    ROM_ONLY, MBC1_ONLY, MBC1_RAM, MBC1_RAM_BATTERY
+};
+
+// Guest (bank, PC) coverage. libFuzzer picks up any counters placed in this
+// section and treats new ones as new coverage, just like host edges. Other
+// builds go through fuzz_main.c, which hands them to AFL.
+#if defined(__linux__) && defined(__clang__)
+__attribute__((section("__libfuzzer_extra_counters")))
+#endif
+uint8_t fuzz_guest_coverage[FUZZ_GUEST_COVERAGE_SIZE];
+const uint32_t fuzz_guest_coverage_size = FUZZ_GUEST_COVERAGE_SIZE;
+
+static machine_state machine = {0};
+static uint8_t rom[FUZZ_ROM_SIZE];
+
+// Returns the size of the ROM the header declares
+static uint32_t build_cartridge(const uint8_t* data, size_t size) {
+    memset(rom, 0, sizeof(rom));
+
+    // Entry point jumps over the header to the fuzzed code: NOP; JP $0150
+    static const uint8_t entry[] = {NOP, JP_16, 0x50, 0x01};
+    memcpy(rom + 0x100, entry, sizeof(entry));
+
+    cart_header* cart = (cart_header*) (rom + 0x100);
+    cart->cart_hardware_flags = fuzz_cart_types[data[FUZZ_BYTE_CART_TYPE] % sizeof(fuzz_cart_types)];
+    cart->rom_size = data[FUZZ_BYTE_ROM_SIZE] % 2; // 2 or 4 banks
+    cart->ram_size = data[FUZZ_BYTE_RAM_SIZE] % 6;
+
+    uint32_t rom_size = rom_header_bank_count(cart) * ROM_BANK_SIZE;
+    size_t code_size = size - FUZZ_HEADER_SIZE;
+    if (code_size > rom_size - 0x150) {
+        code_size = rom_size - 0x150;
+    }
+    memcpy(rom + 0x150, data + FUZZ_HEADER_SIZE, code_size);
+    return rom_size;
+}
+
+// Only the ROM and the header-derived sizes matter for the layout, so the
+// machine can be reset in place unless those changed.
+static bool prepare_machine(uint32_t rom_size) {
+    cart_header* cart = (cart_header*) (rom + 0x100);
+    bool same_layout = machine.arena != NULL &&
+                       machine.rom_bank_count == rom_header_bank_count(cart) &&
+                       machine.ram_bank_count == ram_bank_count(cart) &&
+                       machine.memory_controller == get_cart_controller(cart);
+    if (same_layout) {
+        memcpy(machine.cartridge_rom, rom, rom_size);
+        machine_reset(&machine);
+        return true;
+    }
+
+    machine_free(&machine);
+    machine_state empty = {0};
+    machine = empty;
+    return machine_init(&machine, rom, rom_size);
+}
+
+// Every (bank, PC) pair gets its own counter: the ROM byte the PC points at,
+// or past the ROM for everything from 0x8000 up
+static uint32_t coverage_index(uint16_t pc) {
+    if (pc < ROM_BANK_SIZE) {
+        return pc;
+    }
+    if (pc < 2 * ROM_BANK_SIZE) {
+        // Bank numbers past the end of the ROM wrap around
+        uint32_t bank = controller_high_rom_bank(&machine) % machine.rom_bank_count;
+        return bank * ROM_BANK_SIZE + (pc & (ROM_BANK_SIZE - 1));
+    }
+    return FUZZ_ROM_SIZE + (pc - 2 * ROM_BANK_SIZE);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size < FUZZ_HEADER_SIZE) {
+        return 0;
+    }
+    uint32_t rom_size = build_cartridge(data, size);
+    if (!prepare_machine(rom_size)) {
+        return 0;
+    }
+
+    while (machine.clock < FUZZ_MAX_CYCLES) {
+        fuzz_guest_coverage[coverage_index(machine.cpu.PC)]++;
+
+        if (cpu_step(&machine) == 0) {
+            break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+// Driver for the fuzz harness when it isn't linked against libFuzzer. Runs
+// every file given on the command line, or stdin, which is what AFL and crash
+// reproduction need. With afl-clang-fast, inputs are looped in persistent mode.
+// AFL only instruments the host, so guest coverage is added to its map here.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <malloc.h>
+
+#include "logging.h"
+#include "file.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+extern uint8_t fuzz_guest_coverage[];
+extern const uint32_t fuzz_guest_coverage_size;
+
+// Coverage map and its size from the AFL runtime, when it's linked in. AFL++
+// can size the map at startup, classic AFL always uses 64 KiB.
+extern uint8_t* __afl_area_ptr __attribute__((weak));
+extern uint32_t __afl_map_size __attribute__((weak));
+#define FUZZ_AFL_DEFAULT_MAP_SIZE 0x10000
+
+// Largest input read from stdin
+#define FUZZ_MAX_INPUT_SIZE 0x10000
+
+#ifndef __AFL_LOOP
+#define __AFL_LOOP(count) (first_iteration ? (first_iteration = false, true) : false)
+static bool first_iteration = true;
+#endif
+
+static uint32_t guest_coverage_count(void) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < fuzz_guest_coverage_size; i++) {
+        count += (fuzz_guest_coverage[i] != 0);
+    }
+    return count;
+}
+
+// Hashes the guest counters of the last input into AFL's map, where they
+// share slots with host edges like the edges do with each other, and clears
+// them for the next input
+static void add_guest_coverage_to_afl(void) {
+    if (&__afl_area_ptr == NULL || __afl_area_ptr == NULL) {
+        return;
+    }
+    uint32_t map_size = &__afl_map_size != NULL && __afl_map_size != 0 ? __afl_map_size : FUZZ_AFL_DEFAULT_MAP_SIZE;
+    for (uint32_t i = 0; i < fuzz_guest_coverage_size; i++) {
+        if (fuzz_guest_coverage[i] != 0) {
+            __afl_area_ptr[((i * 0x9E3779B1u) >> 16) % map_size] += fuzz_guest_coverage[i];
+            fuzz_guest_coverage[i] = 0;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            uint32_t size = 0;
+            uint8_t* data = file_load(argv[i], &size);
+            if (data == NULL) {
+                continue;
+            }
+            LLVMFuzzerTestOneInput(data, size);
+            free(data);
+        }
+        LOG_MSG(info, "Ran %d inputs, %d guest (bank, PC) pairs covered\n", argc - 1, guest_coverage_count());
+        return 0;
+    }
+
+    static uint8_t input[FUZZ_MAX_INPUT_SIZE];
+    while (__AFL_LOOP(10000)) {
+        size_t size = fread(input, 1, sizeof(input), stdin);
+        LLVMFuzzerTestOneInput(input, size);
+        add_guest_coverage_to_afl();
+    }
+    return 0;
+}
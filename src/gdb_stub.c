@@ -0,0 +1,589 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "logging.h"
+
+#include "gdb_stub.h"
+#include "debugger.h"
+#include "cpu.h"
+#include "boot_rom.h"
+#include "bus.h"
+
+// Largest packet we accept, and tell the client about
+#define GDB_PACKET_SIZE 4096
+#define GDB_INTERRUPT 0x03
+
+// Signals in stop replies
+#define GDB_SIGINT 2
+#define GDB_SIGILL 4
+#define GDB_SIGTRAP 5
+
+static const char target_xml[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<feature name=\"org.dmgem.sm83\">"
+    "<reg name=\"af\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"bc\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"de\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"hl\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"sp\" bitsize=\"16\" type=\"data_ptr\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "</feature>"
+    "</target>";
+
+#define GDB_REGISTER_COUNT 6
+
+typedef struct {
+    int fd;
+    // Received bytes not consumed yet
+    uint8_t input[GDB_PACKET_SIZE];
+    uint32_t input_length;
+    uint32_t input_offset;
+    bool no_ack; // The client turned acknowledgements off
+    bool detached;
+    char last_stop[64]; // Reply to '?'
+
+    machine_state* machine;
+    debugger dbg;
+}gdb_session;
+
+static register16* register_at(cpu_state* cpu, uint32_t index) {
+    register16* registers[GDB_REGISTER_COUNT] = {&cpu->AF, &cpu->BC, &cpu->DE, &cpu->HL, &cpu->SP, &cpu->PC};
+    return (index < GDB_REGISTER_COUNT) ? registers[index] : NULL;
+}
+
+static int8_t hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Reads hex digits at the cursor and moves past them
+static uint32_t parse_hex(const char** cursor) {
+    uint32_t value = 0;
+    while (hex_digit(**cursor) >= 0) {
+        value = (value << 4) | hex_digit(**cursor);
+        (*cursor)++;
+    }
+    return value;
+}
+
+// Registers go over the wire in target byte order, little endian
+static uint16_t parse_register(const char** cursor) {
+    uint16_t value = 0;
+    for (uint8_t i = 0; i < 2 && hex_digit((*cursor)[0]) >= 0 && hex_digit((*cursor)[1]) >= 0; i++) {
+        value |= ((hex_digit((*cursor)[0]) << 4) | hex_digit((*cursor)[1])) << (8 * i);
+        *cursor += 2;
+    }
+    return value;
+}
+
+static void format_register(char* out, uint16_t value) {
+    sprintf(out, "%02x%02x", value & 0xFF, value >> 8);
+}
+
+// Byte that a client address refers to, see gdb_stub.h for the bank bits
+static uint8_t* memory_at(machine_state* machine, uint32_t address) {
+    uint16_t cpu_address = address & 0xFFFF;
+    uint32_t bank = address >> 16;
+    if (bank != 0 && machine->memory_controller != NONE) {
+        if (cpu_address >= 0x4000 && cpu_address < 0x8000 && bank < machine->rom_bank_count) {
+            return machine->cartridge_rom + bank * ROM_BANK_SIZE + (cpu_address - 0x4000);
+        }
+        if (cpu_address >= 0xA000 && cpu_address < 0xC000 && bank < machine->ram_bank_count) {
+            return machine->external_ram + bank * RAM_BANK_SIZE + (cpu_address - 0xA000);
+        }
+    }
+    // Pokes from the debugger go straight to memory without side effects,
+    // like its reads
+    return (uint8_t*) bus_peek(machine, cpu_address);
+}
+
+static int read_byte(gdb_session* session) {
+    if (session->input_offset == session->input_length) {
+        ssize_t received = recv(session->fd, session->input, sizeof(session->input), 0);
+        if (received <= 0) {
+            return -1;
+        }
+        session->input_length = received;
+        session->input_offset = 0;
+    }
+    return session->input[session->input_offset++];
+}
+
+static bool send_all(gdb_session* session, const char* data, size_t length) {
+    while (length != 0) {
+        ssize_t sent = send(session->fd, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+static bool send_packet(gdb_session* session, const char* data) {
+    size_t length = strlen(data);
+    char* packet = malloc(length + 4);
+    if (packet == NULL) {
+        return false;
+    }
+    uint8_t checksum = 0;
+    for (size_t i = 0; i < length; i++) {
+        checksum += (uint8_t) data[i];
+    }
+    packet[0] = '$';
+    memcpy(packet + 1, data, length);
+    sprintf(packet + 1 + length, "#%02x", checksum);
+
+    bool sent = false;
+    while (send_all(session, packet, length + 4)) {
+        if (session->no_ack) {
+            sent = true;
+            break;
+        }
+        // Anything but a NAK counts as an acknowledgement
+        int ack = read_byte(session);
+        if (ack != '-') {
+            sent = ack != -1;
+            break;
+        }
+    }
+    free(packet);
+    return sent;
+}
+
+/// Receives the next packet into buffer, acknowledging it.
+/// \return false if the connection closed
+static bool receive_packet(gdb_session* session, char* buffer) {
+    while (true) {
+        int c = 0;
+        do {
+            c = read_byte(session);
+        } while (c != '$' && c != -1);
+        if (c == -1) {
+            return false;
+        }
+
+        uint32_t length = 0;
+        uint8_t checksum = 0;
+        while ((c = read_byte(session)) != '#' && c != -1) {
+            checksum += c;
+            if (length < GDB_PACKET_SIZE) {
+                buffer[length++] = c;
+            }
+        }
+        int high = read_byte(session);
+        int low = read_byte(session);
+        if (c == -1 || high == -1 || low == -1) {
+            return false;
+        }
+        buffer[length] = '\0';
+
+        bool valid = hex_digit(high) >= 0 && hex_digit(low) >= 0 && ((hex_digit(high) << 4) | hex_digit(low)) == checksum;
+        if (!session->no_ack && !send_all(session, valid ? "+" : "-", 1)) {
+            return false;
+        }
+        if (valid || session->no_ack) {
+            return true;
+        }
+    }
+}
+
+// Checks for a Ctrl-C from the client without blocking
+static bool interrupt_requested(gdb_session* session, bool* closed) {
+    struct pollfd fd = {.fd = session->fd, .events = POLLIN};
+    if (session->input_offset == session->input_length && poll(&fd, 1, 0) > 0) {
+        if (read_byte(session) == -1) {
+            *closed = true;
+            return false;
+        }
+        session->input_offset--;
+    }
+    // Clients don't send packets while the target runs, anything else that
+    // arrives is a stray acknowledgement and can go
+    while (session->input_offset < session->input_length) {
+        if (session->input[session->input_offset++] == GDB_INTERRUPT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void set_stop_reply(gdb_session* session, debugger_stop stop, bool interrupted) {
+    if (interrupted) {
+        sprintf(session->last_stop, "S%02x", GDB_SIGINT);
+    }
+    else if (stop == DEBUGGER_WATCHPOINT) {
+        const char* kind = (session->dbg.watch_access == WATCH_WRITE) ? "watch" : "rwatch";
+        sprintf(session->last_stop, "T%02x%s:%04x;", GDB_SIGTRAP, kind, session->dbg.watch_address);
+    }
+    else if (stop == DEBUGGER_CPU_STOPPED) {
+        sprintf(session->last_stop, "S%02x", GDB_SIGILL);
+    }
+    else {
+        sprintf(session->last_stop, "S%02x", GDB_SIGTRAP);
+    }
+}
+
+/// Runs until something stops the machine or the client interrupts it.
+/// \return false if the connection closed
+static bool resume(gdb_session* session, bool step) {
+    if (step) {
+        set_stop_reply(session, debugger_step(&session->dbg), false);
+        return true;
+    }
+    bool closed = false;
+    while (true) {
+        debugger_stop stop = debugger_run(&session->dbg, GDB_POLL_CYCLES);
+        bool interrupted = interrupt_requested(session, &closed);
+        if (closed) {
+            return false;
+        }
+        if (stop != DEBUGGER_TIMEOUT || interrupted) {
+            set_stop_reply(session, stop, interrupted);
+            return true;
+        }
+    }
+}
+
+static void read_registers(gdb_session* session, char* reply) {
+    for (uint32_t i = 0; i < GDB_REGISTER_COUNT; i++) {
+        format_register(reply + 4 * i, *register_at(&session->machine->cpu, i));
+    }
+}
+
+static void write_registers(gdb_session* session, const char* data, char* reply) {
+    for (uint32_t i = 0; i < GDB_REGISTER_COUNT && *data != '\0'; i++) {
+        *register_at(&session->machine->cpu, i) = parse_register(&data);
+    }
+    strcpy(reply, "OK");
+}
+
+static void read_memory(gdb_session* session, const char* data, char* reply) {
+    uint32_t address = parse_hex(&data);
+    data++;
+    uint32_t length = parse_hex(&data);
+    if (length > GDB_PACKET_SIZE / 2) {
+        length = GDB_PACKET_SIZE / 2;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        // Keep the bank bits and wrap within the 16-bit address
+        uint32_t byte_address = (address & ~0xFFFFu) | ((address + i) & 0xFFFF);
+        const uint8_t* byte = memory_at(session->machine, byte_address);
+        sprintf(reply + 2 * i, "%02x", (byte != NULL) ? *byte : 0xFF);
+    }
+    reply[2 * length] = '\0';
+}
+
+static void write_memory(gdb_session* session, const char* data, char* reply) {
+    uint32_t address = parse_hex(&data);
+    data++;
+    uint32_t length = parse_hex(&data);
+    data++;
+    for (uint32_t i = 0; i < length && hex_digit(data[0]) >= 0 && hex_digit(data[1]) >= 0; i++) {
+        uint8_t* byte = memory_at(session->machine, (address & ~0xFFFFu) | ((address + i) & 0xFFFF));
+        if (byte != NULL) {
+            *byte = (hex_digit(data[0]) << 4) | hex_digit(data[1]);
+        }
+        data += 2;
+    }
+    strcpy(reply, "OK");
+}
+
+// Z and z packets, "type,address,kind"
+static void set_breakpoint(gdb_session* session, const char* data, bool insert, char* reply) {
+    uint32_t type = parse_hex(&data);
+    data++;
+    uint16_t address = parse_hex(&data);
+    data++;
+    uint32_t length = parse_hex(&data);
+
+    static const watch_kind watch_kinds[] = {[2] = WATCH_WRITE, [3] = WATCH_READ, [4] = WATCH_ACCESS};
+    bool ok = false;
+    if (type == 0 || type == 1) {
+        ok = debugger_set_breakpoint(&session->dbg, address, insert);
+    }
+    else if (type <= 4) {
+        ok = insert ? debugger_add_watchpoint(&session->dbg, address, length, watch_kinds[type])
+                    : debugger_remove_watchpoint(&session->dbg, address, length, watch_kinds[type]);
+    }
+    else {
+        // Unsupported types get an empty reply
+        reply[0] = '\0';
+        return;
+    }
+    strcpy(reply, ok ? "OK" : "E01");
+}
+
+// qXfer:features:read:target.xml:offset,length
+static void read_target_xml(const char* data, char* reply) {
+    uint32_t offset = parse_hex(&data);
+    data++;
+    uint32_t length = parse_hex(&data);
+    uint32_t size = sizeof(target_xml) - 1;
+    if (length > GDB_PACKET_SIZE - 2) {
+        length = GDB_PACKET_SIZE - 2;
+    }
+    if (offset >= size) {
+        strcpy(reply, "l");
+        return;
+    }
+    if (length > size - offset) {
+        length = size - offset;
+    }
+    reply[0] = (offset + length < size) ? 'm' : 'l';
+    memcpy(reply + 1, target_xml + offset, length);
+    reply[1 + length] = '\0';
+}
+
+static void query(const char* packet, char* reply) {
+    static const char features[] = "qXfer:features:read:target.xml:";
+    if (strncmp(packet, "qSupported", 10) == 0) {
+        sprintf(reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+", GDB_PACKET_SIZE);
+    }
+    else if (strncmp(packet, features, sizeof(features) - 1) == 0) {
+        read_target_xml(packet + sizeof(features) - 1, reply);
+    }
+    else if (strcmp(packet, "qAttached") == 0) {
+        strcpy(reply, "1");
+    }
+    else if (strcmp(packet, "qC") == 0) {
+        strcpy(reply, "QC1");
+    }
+    else if (strcmp(packet, "qfThreadInfo") == 0) {
+        strcpy(reply, "m1");
+    }
+    else if (strcmp(packet, "qsThreadInfo") == 0) {
+        strcpy(reply, "l");
+    }
+    else if (strcmp(packet, "QStartNoAckMode") == 0) {
+        strcpy(reply, "OK");
+    }
+}
+
+/// Handles one packet and sends the reply.
+/// \return false if the session is over
+static bool handle_packet(gdb_session* session, const char* packet) {
+    char reply[GDB_PACKET_SIZE + 2] = {0};
+    cpu_state* cpu = &session->machine->cpu;
+
+    switch (packet[0]) {
+        case '?':
+            strcpy(reply, session->last_stop);
+            break;
+        case 'g':
+            read_registers(session, reply);
+            break;
+        case 'G':
+            write_registers(session, packet + 1, reply);
+            break;
+        case 'p': {
+            const char* data = packet + 1;
+            register16* reg = register_at(cpu, parse_hex(&data));
+            if (reg != NULL) {
+                format_register(reply, *reg);
+            }
+            else {
+                strcpy(reply, "E01");
+            }
+            break;
+        }
+        case 'P': {
+            const char* data = packet + 1;
+            register16* reg = register_at(cpu, parse_hex(&data));
+            data++;
+            if (reg != NULL) {
+                *reg = parse_register(&data);
+            }
+            strcpy(reply, (reg != NULL) ? "OK" : "E01");
+            break;
+        }
+        case 'm':
+            read_memory(session, packet + 1, reply);
+            break;
+        case 'M':
+            write_memory(session, packet + 1, reply);
+            break;
+        case 'c':
+        case 's': {
+            const char* data = packet + 1;
+            if (*data != '\0') {
+                cpu->PC = parse_hex(&data);
+            }
+            if (!resume(session, packet[0] == 's')) {
+                return false;
+            }
+            strcpy(reply, session->last_stop);
+            break;
+        }
+        case 'v':
+            if (strcmp(packet, "vCont?") == 0) {
+                strcpy(reply, "vCont;c;C;s;S");
+            }
+            else if (strncmp(packet, "vCont;", 6) == 0) {
+                // There's only one thread, so the first action is the one
+                char action = packet[6];
+                if (!resume(session, action == 's' || action == 'S')) {
+                    return false;
+                }
+                strcpy(reply, session->last_stop);
+            }
+            break;
+        case 'Z':
+        case 'z':
+            set_breakpoint(session, packet + 1, packet[0] == 'Z', reply);
+            break;
+        case 'q':
+        case 'Q':
+            query(packet, reply);
+            break;
+        case 'H':
+        case 'T':
+            strcpy(reply, "OK");
+            break;
+        case 'D':
+            session->detached = true;
+            send_packet(session, "OK");
+            return false;
+        case 'k':
+            return false;
+        default:
+            // An empty reply tells the client the packet isn't supported
+            break;
+    }
+    if (!send_packet(session, reply)) {
+        return false;
+    }
+    if (strcmp(packet, "QStartNoAckMode") == 0) {
+        session->no_ack = true;
+    }
+    return true;
+}
+
+// Listens on a localhost TCP port, or a Unix socket for anything that isn't
+// a number
+static int listen_on(const char* address) {
+    char* end = NULL;
+    unsigned long port = strtoul(address, &end, 10);
+    bool tcp = *address != '\0' && *end == '\0';
+
+    int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LOG_MSG(error, "Failed to create a socket: %s\n", strerror(errno));
+        return -1;
+    }
+    int result = 0;
+    if (tcp) {
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        struct sockaddr_in socket_address = {
+            .sin_family = AF_INET,
+            .sin_port = htons(port),
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+        };
+        result = bind(fd, (struct sockaddr*) &socket_address, sizeof(socket_address));
+    }
+    else {
+        struct sockaddr_un socket_address = {.sun_family = AF_UNIX};
+        if (strlen(address) >= sizeof(socket_address.sun_path)) {
+            LOG_MSG(error, "Socket path %s is too long\n", address);
+            close(fd);
+            return -1;
+        }
+        strcpy(socket_address.sun_path, address);
+        // Replace a socket left over from an earlier run, but nothing else
+        struct stat st = {0};
+        if (stat(address, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(address);
+        }
+        result = bind(fd, (struct sockaddr*) &socket_address, sizeof(socket_address));
+    }
+    if (result != 0 || listen(fd, 1) != 0) {
+        LOG_MSG(error, "Failed to listen on %s: %s\n", address, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool run_gdb_server(uint8_t* rom_data, uint32_t rom_size, const char* address, const run_options* options) {
+    machine_state machine = {.core = options->core};
+    if (!machine_init(&machine, rom_data, rom_size)) {
+        LOG_MSG(error, "Failed to initialize the machine\n");
+        machine_free(&machine);
+        return true;
+    }
+    if (options->boot_rom_path != NULL && !boot_rom_load(&machine, options->boot_rom_path)) {
+        machine_free(&machine);
+        return true;
+    }
+
+    int listener = listen_on(address);
+    if (listener < 0) {
+        machine_free(&machine);
+        return true;
+    }
+    LOG_MSG(info, "Waiting for a GDB client on %s\n", address);
+    int fd = accept(listener, NULL, NULL);
+    close(listener);
+    if (fd < 0) {
+        LOG_MSG(error, "Failed to accept a GDB client: %s\n", strerror(errno));
+        machine_free(&machine);
+        return true;
+    }
+    // Packets are small and each one waits for a reply
+    int no_delay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    LOG_MSG(info, "GDB client connected\n");
+
+    gdb_session session = {0};
+    session.fd = fd;
+    session.machine = &machine;
+    sprintf(session.last_stop, "S%02x", GDB_SIGTRAP);
+    if (!debugger_attach(&session.dbg, &machine)) {
+        close(fd);
+        machine_free(&machine);
+        return true;
+    }
+
+    char packet[GDB_PACKET_SIZE + 1];
+    while (receive_packet(&session, packet) && handle_packet(&session, packet)) {
+    }
+    debugger_detach(&session.dbg);
+    close(fd);
+
+    bool running = true;
+    if (session.detached) {
+        LOG_MSG(info, "GDB client detached, running on\n");
+        while (running) {
+            running = cpu_step(&machine) != 0;
+        }
+    }
+    else {
+        LOG_MSG(info, "GDB session ended\n");
+    }
+    machine_free(&machine);
+    return false;
+}
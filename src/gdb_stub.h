@@ -0,0 +1,24 @@
+// GDB remote serial protocol server, so guest code can be debugged with GDB
+// or anything else that speaks RSP. Registers are AF, BC, DE, HL, SP and PC,
+// described to the client with a target.xml. Breakpoints and watchpoints use
+// the debugger in debugger.h, so the machine runs at full speed between stops.
+//
+// Memory addresses are CPU addresses, as currently mapped. Bits 16 and up
+// pick a ROM bank for 0x4000-0x7FFF or a RAM bank for 0xA000-0xBFFF instead,
+// so 0x34000 is the start of ROM bank 3 whatever bank is switched in.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "machine.h"
+
+// Machine cycles run between checks for an interrupt from the client
+#define GDB_POLL_CYCLES MACHINE_CYCLES_PER_FRAME
+
+/// Waits for a GDB client and runs the ROM under its control until the
+/// client kills it, or detaches and the CPU stops.
+/// \param address TCP port to listen on at localhost, or a Unix socket path
+/// \param options Only the core and boot ROM are used
+/// \return false if the session ended normally
+bool run_gdb_server(uint8_t* rom_data, uint32_t rom_size, const char* address, const run_options* options);
@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HASH_HAVE_SSE42
+#define HASH_HAVE_AVX2
+#endif
+
+#include "hash.h"
+
+// Reflected polynomials
+#define CRC32C_POLYNOMIAL 0x82F63B78
+#define CRC32_POLYNOMIAL 0xEDB88320
+
+static uint32_t crc32c_table[256];
+static uint32_t crc32_table[256];
+static bool use_sse42 = false;
+static bool use_avx2 = false;
+
+__attribute__((constructor)) static void build_crc_tables(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t castagnoli = i;
+        uint32_t zlib = i;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            castagnoli = (castagnoli >> 1) ^ ((castagnoli & 1) ? CRC32C_POLYNOMIAL : 0);
+            zlib = (zlib >> 1) ^ ((zlib & 1) ? CRC32_POLYNOMIAL : 0);
+        }
+        crc32c_table[i] = castagnoli;
+        crc32_table[i] = zlib;
+    }
+#ifdef HASH_HAVE_SSE42
+    use_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+#ifdef HASH_HAVE_AVX2
+    use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+static uint32_t crc_table(const uint32_t* table, uint32_t crc, const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef HASH_HAVE_SSE42
+// Compiled for SSE4.2 on its own, only called when the CPU supports it
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* data, size_t size) {
+#ifdef __x86_64__
+    uint64_t wide = crc;
+    while (size >= sizeof(uint64_t)) {
+        uint64_t chunk = 0;
+        memcpy(&chunk, data, sizeof(chunk));
+        wide = _mm_crc32_u64(wide, chunk);
+        data += sizeof(chunk);
+        size -= sizeof(chunk);
+    }
+    crc = (uint32_t) wide;
+#endif
+    while (size != 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        size--;
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t size) {
+    crc = ~crc;
+#ifdef HASH_HAVE_SSE42
+    if (use_sse42) {
+        return ~crc32c_sse42(crc, data, size);
+    }
+#endif
+    return ~crc_table(crc32c_table, crc, data, size);
+}
+
+uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size) {
+    return ~crc_table(crc32_table, ~crc, data, size);
+}
+
+// PSADBW against zero adds up each group of 8 bytes into a 64-bit lane,
+// which can't overflow for any buffer that fits in memory. Both return how
+// many bytes they summed, the caller does the rest.
+#ifdef HASH_HAVE_AVX2
+__attribute__((target("avx2")))
+static size_t byte_sum_avx2(const uint8_t* data, size_t size, uint64_t* sum) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t done = 0;
+    for (; done + sizeof(__m256i) <= size; done += sizeof(__m256i)) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*) (data + done));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(bytes, zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, total);
+    *sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return done;
+}
+#endif
+
+#ifdef __SSE2__
+static size_t byte_sum_sse2(const uint8_t* data, size_t size, uint64_t* sum) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    size_t done = 0;
+    for (; done + sizeof(__m128i) <= size; done += sizeof(__m128i)) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*) (data + done));
+        total = _mm_add_epi64(total, _mm_sad_epu8(bytes, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*) lanes, total);
+    *sum = lanes[0] + lanes[1];
+    return done;
+}
+#endif
+
+uint64_t byte_sum(const uint8_t* data, size_t size) {
+    uint64_t sum = 0;
+    size_t done = 0;
+#ifdef HASH_HAVE_AVX2
+    if (use_avx2) {
+        done = byte_sum_avx2(data, size, &sum);
+    }
+#endif
+#ifdef __SSE2__
+    if (done == 0) {
+        done = byte_sum_sse2(data, size, &sum);
+    }
+#endif
+    for (size_t i = done; i < size; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
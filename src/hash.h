@@ -0,0 +1,19 @@
+// Checksums. CRC32C is used to hash framebuffers and uses the SSE4.2 CRC
+// instruction when the CPU has it. CRC32 is the zlib/PNG one. Byte sums are
+// for additive checksums like the ROM header's, using AVX2 or SSE2 when the
+// CPU has them.
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/// CRC32C (Castagnoli) of a buffer.
+/// \param crc 0 for a new hash, or the result of a previous call to continue it
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t size);
+
+/// CRC32 as used by zlib and PNG chunks.
+/// \param crc 0 for a new hash, or the result of a previous call to continue it
+uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size);
+
+// Sum of every byte in a buffer.
+uint64_t byte_sum(const uint8_t* data, size_t size);
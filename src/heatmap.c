@@ -0,0 +1,135 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "logging.h"
+
+#include "heatmap.h"
+#include "memory_controllers.h"
+#include "bus.h"
+
+// Names for the registers games are most likely to hammer
+static const char* register_names[0x100] = {
+    [0x00] = "JOYP", [0x01] = "SB", [0x02] = "SC", [0x04] = "DIV",
+    [0x05] = "TIMA", [0x06] = "TMA", [0x07] = "TAC", [0x0F] = "IF",
+    [0x10] = "NR10", [0x11] = "NR11", [0x12] = "NR12", [0x13] = "NR13", [0x14] = "NR14",
+    [0x16] = "NR21", [0x17] = "NR22", [0x18] = "NR23", [0x19] = "NR24",
+    [0x1A] = "NR30", [0x1B] = "NR31", [0x1C] = "NR32", [0x1D] = "NR33", [0x1E] = "NR34",
+    [0x20] = "NR41", [0x21] = "NR42", [0x22] = "NR43", [0x23] = "NR44",
+    [0x24] = "NR50", [0x25] = "NR51", [0x26] = "NR52",
+    [0x40] = "LCDC", [0x41] = "STAT", [0x42] = "SCY", [0x43] = "SCX",
+    [0x44] = "LY", [0x45] = "LYC", [0x46] = "DMA", [0x47] = "BGP",
+    [0x48] = "OBP0", [0x49] = "OBP1", [0x4A] = "WY", [0x4B] = "WX",
+    [0xFF] = "IE"
+};
+
+bool heatmap_attach(memory_heatmap* heatmap, machine_state* machine) {
+    memset(heatmap, 0, sizeof(*heatmap));
+    heatmap->machine = machine;
+    heatmap->bank_count = (machine->rom_bank_count != 0) ? machine->rom_bank_count : 1;
+    heatmap->pages = calloc(heatmap->bank_count, sizeof(*heatmap->pages));
+    heatmap->registers = calloc(heatmap->bank_count, sizeof(*heatmap->registers));
+    if (heatmap->pages == NULL || heatmap->registers == NULL) {
+        LOG_MSG(error, "Failed to allocate the heatmap\n");
+        free(heatmap->pages);
+        free(heatmap->registers);
+        return false;
+    }
+    machine->heatmap = heatmap;
+    // OAM DMA has every page unmapped already, and maps them again when
+    // it's done
+    if (machine->dma_remaining_cycles == 0) {
+        bus_map_pages(machine);
+    }
+    return true;
+}
+
+void heatmap_detach(memory_heatmap* heatmap) {
+    machine_state* machine = heatmap->machine;
+    if (machine != NULL) {
+        machine->heatmap = NULL;
+        if (machine->dma_remaining_cycles == 0) {
+            bus_map_pages(machine);
+        }
+    }
+    free(heatmap->pages);
+    free(heatmap->registers);
+    memset(heatmap, 0, sizeof(*heatmap));
+}
+
+void heatmap_count(memory_heatmap* heatmap, uint16_t address, heatmap_access access) {
+    uint16_t bank = controller_high_rom_bank(heatmap->machine) % heatmap->bank_count;
+    heatmap->pages[bank][address >> BUS_PAGE_SHIFT][access]++;
+    if (address >= 0xFF00) {
+        heatmap->registers[bank][address & 0xFF][access]++;
+    }
+}
+
+bool heatmap_write_csv(const memory_heatmap* heatmap, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        LOG_MSG(error, "Failed to open %s for writing\n", path);
+        return false;
+    }
+    fprintf(file, "kind,bank,address,reads,writes\n");
+    for (uint16_t bank = 0; bank < heatmap->bank_count; bank++) {
+        for (uint16_t page = 0; page < BUS_PAGE_COUNT; page++) {
+            const uint64_t* counts = heatmap->pages[bank][page];
+            if (counts[HEATMAP_READ] != 0 || counts[HEATMAP_WRITE] != 0) {
+                fprintf(file, "page,%u,0x%04x,%" PRIu64 ",%" PRIu64 "\n", bank, page << BUS_PAGE_SHIFT,
+                        counts[HEATMAP_READ], counts[HEATMAP_WRITE]);
+            }
+        }
+    }
+    for (uint16_t bank = 0; bank < heatmap->bank_count; bank++) {
+        for (uint16_t reg = 0; reg < 0x100; reg++) {
+            const uint64_t* counts = heatmap->registers[bank][reg];
+            if (counts[HEATMAP_READ] != 0 || counts[HEATMAP_WRITE] != 0) {
+                fprintf(file, "register,%u,0x%04x,%" PRIu64 ",%" PRIu64 "\n", bank, 0xFF00 | reg,
+                        counts[HEATMAP_READ], counts[HEATMAP_WRITE]);
+            }
+        }
+    }
+    bool written = !ferror(file);
+    written = (fclose(file) == 0) && written;
+    if (!written) {
+        LOG_MSG(error, "Failed to write %s\n", path);
+    }
+    return written;
+}
+
+void heatmap_report(const memory_heatmap* heatmap) {
+    uint64_t totals[0x100][HEATMAP_ACCESS_KINDS] = {0};
+    for (uint16_t bank = 0; bank < heatmap->bank_count; bank++) {
+        for (uint16_t reg = 0; reg < 0x100; reg++) {
+            totals[reg][HEATMAP_READ] += heatmap->registers[bank][reg][HEATMAP_READ];
+            totals[reg][HEATMAP_WRITE] += heatmap->registers[bank][reg][HEATMAP_WRITE];
+        }
+    }
+
+    // Picks the busiest remaining register each time, there are only 256
+    bool shown[0x100] = {0};
+    LOG_MSG(info, "Most accessed registers:\n");
+    for (uint8_t rank = 0; rank < HEATMAP_TOP_REGISTERS; rank++) {
+        int16_t best = -1;
+        uint64_t best_total = 0;
+        for (uint16_t reg = 0; reg < 0x100; reg++) {
+            uint64_t total = totals[reg][HEATMAP_READ] + totals[reg][HEATMAP_WRITE];
+            if (!shown[reg] && total > best_total) {
+                best = reg;
+                best_total = total;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        shown[best] = true;
+        const char* name = register_names[best];
+        LOG_MSG(info, "  $%04X %-5s %12" PRIu64 " reads %12" PRIu64 " writes\n", 0xFF00 | best,
+                (name != NULL) ? name : (best >= 0x80 && best != 0xFF) ? "HRAM" : "",
+                totals[best][HEATMAP_READ], totals[best][HEATMAP_WRITE]);
+    }
+}
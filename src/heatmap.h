@@ -0,0 +1,47 @@
+// Memory access heatmap. Counts reads and writes per 256 byte page and per
+// register in 0xFF00-0xFFFF, split by the ROM bank mapped at 0x4000-0x7FFF
+// when the access happened. Instruction fetches count as reads. While a
+// heatmap is attached, no page is mapped directly, so every access goes
+// through the bus slow path where it's counted. That makes it slow, but
+// machines without a heatmap don't pay anything for it.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "machine.h"
+
+// Most accessed registers shown by heatmap_report()
+#define HEATMAP_TOP_REGISTERS 10
+
+typedef enum {
+    HEATMAP_READ,
+    HEATMAP_WRITE,
+    HEATMAP_ACCESS_KINDS
+}heatmap_access;
+
+typedef struct memory_heatmap {
+    machine_state* machine;
+    uint16_t bank_count;
+    // Indexed by [bank][page or register][heatmap_access]
+    uint64_t (*pages)[BUS_PAGE_COUNT][HEATMAP_ACCESS_KINDS];
+    uint64_t (*registers)[0x100][HEATMAP_ACCESS_KINDS];
+}memory_heatmap;
+
+/// Attaches a heatmap to a machine and moves every page to the slow path.
+/// \return false if allocation failed
+bool heatmap_attach(memory_heatmap* heatmap, machine_state* machine);
+
+// Detaches from the machine and maps its pages again.
+void heatmap_detach(memory_heatmap* heatmap);
+
+// Called by the bus slow path for every access.
+void heatmap_count(memory_heatmap* heatmap, uint16_t address, heatmap_access access);
+
+/// Writes every nonzero counter as CSV rows of
+/// "kind,bank,address,reads,writes", where kind is page or register.
+/// \return false if the file couldn't be written
+bool heatmap_write_csv(const memory_heatmap* heatmap, const char* path);
+
+// Logs the most accessed registers over all banks.
+void heatmap_report(const memory_heatmap* heatmap);
@@ -0,0 +1,348 @@
+// ROM directory indexer. Scans a directory tree for .gb and .gbc files with a
+// pool of threads, validates every header and checksum (see rom_validate())
+// and writes a compact index, so a batch scheduler can group ROMs by memory
+// controller and size without opening each file.
+//
+// Index files are little endian:
+//   "DMGIDX1\0", record count (u32), string table size (u32),
+//   records of INDEX_RECORD_SIZE bytes, sorted by controller, ROM banks,
+//   RAM banks and path:
+//     path offset in the string table (u32), file size (u32),
+//     file CRC32C (u32), global checksum from the header (u16),
+//     ROM banks the header declares (u16), RAM banks (u8),
+//     cart type byte (u8), controller_type (u8), rom_problem bits (u8),
+//     title (16 bytes, NUL padded),
+//   then the string table of NUL terminated paths relative to the directory.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+#include "file.h"
+
+#include "rom.h"
+#include "hash.h"
+
+static const char index_magic[8] = "DMGIDX1";
+#define INDEX_HEADER_SIZE 16
+#define INDEX_RECORD_SIZE 36
+#define INDEX_MAX_THREADS 64
+
+typedef struct {
+    char* path; // Relative to the scanned directory
+    bool loaded;
+    uint32_t file_size;
+    uint32_t crc;
+    uint16_t global_checksum;
+    uint16_t rom_banks;
+    uint8_t ram_banks;
+    uint8_t cart_type;
+    uint8_t controller;
+    uint8_t problems;
+    char title[ROM_TITLE_SIZE + 1];
+}index_entry;
+
+typedef struct {
+    const char* root;
+    index_entry* entries;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t next; // Next entry a worker picks up
+}index_job;
+
+static void print_instructions() {
+    LOG_MSG(info, "Usage: dmgem-index [options] DIR INDEX\n");
+    LOG_MSG(info, "  --threads N  Worker threads (default one per CPU, up to %d)\n", INDEX_MAX_THREADS);
+}
+
+static bool is_rom_name(const char* name) {
+    const char* extension = strrchr(name, '.');
+    return extension != NULL && (strcasecmp(extension, ".gb") == 0 || strcasecmp(extension, ".gbc") == 0);
+}
+
+// Writes root/relative into path
+// \return false if it doesn't fit
+static bool join_path(char* path, size_t size, const char* root, const char* relative) {
+    int length = snprintf(path, size, "%s/%s", root, relative);
+    if (length < 0 || (size_t) length >= size) {
+        LOG_MSG(warning, "Skipping %s/%s, the path is too long\n", root, relative);
+        return false;
+    }
+    return true;
+}
+
+// Adds every ROM under root/relative to the job, depth first. Symbolic links
+// aren't followed, so a link to a parent directory can't recurse forever.
+static bool scan_directory(index_job* job, const char* relative) {
+    char path[4096];
+    if (!join_path(path, sizeof(path), job->root, relative)) {
+        return true;
+    }
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        LOG_MSG(error, "Failed to open %s\n", path);
+        return false;
+    }
+    bool ok = true;
+    struct dirent* entry = NULL;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char child[4096];
+        int length = snprintf(child, sizeof(child), "%s%s%s", relative, relative[0] != '\0' ? "/" : "", entry->d_name);
+        if (length < 0 || (size_t) length >= sizeof(child)) {
+            LOG_MSG(warning, "Skipping %s in %s/%s, the path is too long\n", entry->d_name, job->root, relative);
+            continue;
+        }
+        if (!join_path(path, sizeof(path), job->root, child)) {
+            continue;
+        }
+        struct stat info = {0};
+        if (lstat(path, &info) != 0) {
+            continue;
+        }
+        if (S_ISDIR(info.st_mode)) {
+            ok = scan_directory(job, child);
+            continue;
+        }
+        if (!S_ISREG(info.st_mode) || !is_rom_name(entry->d_name)) {
+            continue;
+        }
+        if (job->count == job->capacity) {
+            uint32_t capacity = job->capacity != 0 ? job->capacity * 2 : 256;
+            index_entry* entries = realloc(job->entries, capacity * sizeof(*entries));
+            if (entries == NULL) {
+                LOG_MSG(error, "Failed to allocate the index\n");
+                ok = false;
+                break;
+            }
+            job->entries = entries;
+            job->capacity = capacity;
+        }
+        index_entry empty = {.path = strdup(child)};
+        job->entries[job->count++] = empty;
+        ok = empty.path != NULL;
+    }
+    closedir(dir);
+    return ok;
+}
+
+static void index_rom(const char* root, index_entry* entry) {
+    char path[4096];
+    if (!join_path(path, sizeof(path), root, entry->path)) {
+        return;
+    }
+    uint32_t size = 0;
+    uint8_t* rom = file_load(path, &size);
+    if (rom == NULL) {
+        return;
+    }
+    entry->loaded = true;
+    entry->file_size = size;
+    entry->crc = crc32c(0, rom, size);
+    entry->problems = rom_validate(rom, size);
+    if (!(entry->problems & ROM_TRUNCATED)) {
+        const cart_header* cart = (const cart_header*) (rom + ROM_HEADER_ADDRESS);
+        entry->global_checksum = __builtin_bswap16(cart->global_checksum); // Stored big endian
+        entry->rom_banks = rom_header_bank_count(cart);
+        entry->ram_banks = ram_bank_count(cart);
+        entry->cart_type = cart->cart_hardware_flags;
+        entry->controller = get_cart_controller(cart);
+        rom_title(cart, entry->title);
+    }
+    free(rom);
+}
+
+static void* index_worker(void* user) {
+    index_job* job = user;
+    while (true) {
+        uint32_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count) {
+            return NULL;
+        }
+        index_rom(job->root, &job->entries[i]);
+    }
+}
+
+static int compare_entries(const void* a, const void* b) {
+    const index_entry* x = a;
+    const index_entry* y = b;
+    if (x->controller != y->controller) {
+        return x->controller - y->controller;
+    }
+    if (x->rom_banks != y->rom_banks) {
+        return x->rom_banks - y->rom_banks;
+    }
+    if (x->ram_banks != y->ram_banks) {
+        return x->ram_banks - y->ram_banks;
+    }
+    return strcmp(x->path, y->path);
+}
+
+static void write_u16(uint8_t* out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void write_u32(uint8_t* out, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++) {
+        out[i] = value >> (8 * i);
+    }
+}
+
+// Writes the loaded entries, which are already sorted
+static bool write_index(const index_job* job, uint32_t records, const char* path) {
+    uint32_t strings_size = 0;
+    for (uint32_t i = 0; i < job->count; i++) {
+        if (job->entries[i].loaded) {
+            strings_size += strlen(job->entries[i].path) + 1;
+        }
+    }
+    uint32_t size = INDEX_HEADER_SIZE + records * INDEX_RECORD_SIZE + strings_size;
+    uint8_t* file = calloc(size, 1);
+    if (file == NULL) {
+        LOG_MSG(error, "Failed to allocate memory for %s\n", path);
+        return false;
+    }
+    memcpy(file, index_magic, sizeof(index_magic));
+    write_u32(file + 8, records);
+    write_u32(file + 12, strings_size);
+
+    uint8_t* record = file + INDEX_HEADER_SIZE;
+    char* strings = (char*) record + records * INDEX_RECORD_SIZE;
+    uint32_t string_offset = 0;
+    for (uint32_t i = 0; i < job->count; i++) {
+        const index_entry* entry = &job->entries[i];
+        if (!entry->loaded) {
+            continue;
+        }
+        write_u32(record, string_offset);
+        write_u32(record + 4, entry->file_size);
+        write_u32(record + 8, entry->crc);
+        write_u16(record + 12, entry->global_checksum);
+        write_u16(record + 14, entry->rom_banks);
+        record[16] = entry->ram_banks;
+        record[17] = entry->cart_type;
+        record[18] = entry->controller;
+        record[19] = entry->problems;
+        memcpy(record + 20, entry->title, strlen(entry->title));
+        record += INDEX_RECORD_SIZE;
+
+        uint32_t length = strlen(entry->path) + 1;
+        memcpy(strings + string_offset, entry->path, length);
+        string_offset += length;
+    }
+
+    FILE* out = fopen(path, "wb");
+    bool written = out != NULL && fwrite(file, size, 1, out) == 1;
+    if (out != NULL) {
+        written = (fclose(out) == 0) && written;
+    }
+    free(file);
+    if (!written) {
+        LOG_MSG(error, "Failed to write %s\n", path);
+    }
+    return written;
+}
+
+// Logs how many ROMs each controller has and how many failed each check
+static void report(const index_job* job) {
+    uint32_t controllers[CONTROLLER_TYPE_COUNT] = {0};
+    uint32_t problems[8] = {0};
+    for (uint32_t i = 0; i < job->count; i++) {
+        const index_entry* entry = &job->entries[i];
+        if (!entry->loaded) {
+            continue;
+        }
+        controllers[entry->controller]++;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            problems[bit] += (entry->problems >> bit) & 1;
+        }
+    }
+    for (uint8_t type = 0; type < CONTROLLER_TYPE_COUNT; type++) {
+        if (controllers[type] != 0) {
+            LOG_MSG(info, "  %-14s %u\n", controller_type_names[type], controllers[type]);
+        }
+    }
+    static const char* problem_names[8] = {
+        "truncated", "bad logo", "bad header checksum", "bad global checksum", "unknown cart type", "size mismatch"
+    };
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        if (problems[bit] != 0) {
+            LOG_MSG(warning, "  %u with %s\n", problems[bit], problem_names[bit]);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t thread_count = cpus > 0 ? cpus : 1;
+    const char* paths[2] = {NULL, NULL};
+    uint8_t path_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+        }
+        else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+        }
+    }
+    if (path_count != 2) {
+        print_instructions();
+        return 1;
+    }
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    if (thread_count > INDEX_MAX_THREADS) {
+        thread_count = INDEX_MAX_THREADS;
+    }
+
+    index_job job = {.root = paths[0]};
+    bool ok = scan_directory(&job, "");
+    if (ok) {
+        if (thread_count > job.count) {
+            thread_count = job.count != 0 ? job.count : 1;
+        }
+        // Threads that fail to start just leave more work for the others,
+        // and this thread joins in too
+        pthread_t threads[INDEX_MAX_THREADS];
+        bool started[INDEX_MAX_THREADS] = {false};
+        for (uint32_t i = 1; i < thread_count; i++) {
+            started[i] = pthread_create(&threads[i], NULL, index_worker, &job) == 0;
+        }
+        index_worker(&job);
+        for (uint32_t i = 1; i < thread_count; i++) {
+            if (started[i]) {
+                pthread_join(threads[i], NULL);
+            }
+        }
+
+        qsort(job.entries, job.count, sizeof(*job.entries), compare_entries);
+        uint32_t records = 0;
+        for (uint32_t i = 0; i < job.count; i++) {
+            records += job.entries[i].loaded;
+        }
+        ok = write_index(&job, records, paths[1]);
+        if (ok) {
+            LOG_MSG(info, "Indexed %u ROMs from %s into %s with %u threads\n", records, paths[0], paths[1], thread_count);
+            report(&job);
+        }
+        ok = ok && records == job.count;
+    }
+
+    for (uint32_t i = 0; i < job.count; i++) {
+        free(job.entries[i].path);
+    }
+    free(job.entries);
+    return !ok;
+}
@@ -0,0 +1,44 @@
+#include "joypad.h"
+#include "registers.h"
+
+enum {
+    JOYP_SELECT_DIRECTIONS = 0b00010000, // 0 selects them
+    JOYP_SELECT_BUTTONS = 0b00100000,
+    JOYP_SELECT_MASK = JOYP_SELECT_DIRECTIONS | JOYP_SELECT_BUTTONS,
+    JOYP_UNUSED = 0b11000000 // Always read 1
+};
+
+// Low nibble of JOYP for the current selection, 1 for released
+static uint8_t selected_lines(const joypad_state* joypad, uint8_t select) {
+    uint8_t pressed = 0;
+    if ((select & JOYP_SELECT_DIRECTIONS) == 0) {
+        pressed |= joypad->held & 0x0F;
+    }
+    if ((select & JOYP_SELECT_BUTTONS) == 0) {
+        pressed |= joypad->held >> 4;
+    }
+    return ~pressed & 0x0F;
+}
+
+static void update(const joypad_state* joypad, uint8_t* memory, uint8_t select) {
+    select &= JOYP_SELECT_MASK;
+    memory[JOYP] = JOYP_UNUSED | select | selected_lines(joypad, select);
+}
+
+void joypad_reset(joypad_state* joypad, uint8_t* memory) {
+    update(joypad, memory, JOYP_SELECT_MASK);
+}
+
+void joypad_write(joypad_state* joypad, uint8_t* memory, uint8_t value) {
+    update(joypad, memory, value);
+}
+
+void joypad_set(joypad_state* joypad, uint8_t* memory, uint8_t held) {
+    uint8_t before = memory[JOYP] & 0x0F;
+    joypad->held = held;
+    update(joypad, memory, memory[JOYP]);
+    // The interrupt fires on a line going from released to pressed
+    if (before & ~memory[JOYP] & 0x0F) {
+        memory[INTERRUPT_REQUEST] |= INTERRUPT_JOYPAD;
+    }
+}
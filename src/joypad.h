@@ -0,0 +1,39 @@
+// Joypad (JOYP register). The game selects the direction keys and/or the
+// buttons with bits 4-5, and the low nibble reads which of them are held,
+// with 0 meaning pressed. JOYP is recomputed whenever the selection or the
+// held buttons change, so reads stay on the bus fast path.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    JOYP = 0xFF00
+}joypad_registers;
+
+// Held buttons as a bit mask, the low nibble is the direction keys
+typedef enum {
+    JOYPAD_RIGHT = 0b00000001,
+    JOYPAD_LEFT = 0b00000010,
+    JOYPAD_UP = 0b00000100,
+    JOYPAD_DOWN = 0b00001000,
+    JOYPAD_A = 0b00010000,
+    JOYPAD_B = 0b00100000,
+    JOYPAD_SELECT = 0b01000000,
+    JOYPAD_START = 0b10000000
+}joypad_button;
+
+typedef struct {
+    uint8_t held; // joypad_button bits
+}joypad_state;
+
+// Puts JOYP in its power on state, with nothing selected. Held buttons are kept.
+void joypad_reset(joypad_state* joypad, uint8_t* memory);
+
+// Handles a write to JOYP, only the selection bits are writable.
+void joypad_write(joypad_state* joypad, uint8_t* memory, uint8_t value);
+
+/// Changes which buttons are held. Pressing a button in a selected group
+/// requests the joypad interrupt.
+/// \param held joypad_button bits
+void joypad_set(joypad_state* joypad, uint8_t* memory, uint8_t held);
@@ -0,0 +1,277 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "logging.h"
+
+#include "lockstep.h"
+#include "cpu.h"
+#include "bus.h"
+#include "rom.h"
+#include "opcode_info.h"
+
+typedef enum {
+    LOGIC_AND,
+    LOGIC_XOR,
+    LOGIC_OR
+}logic_op;
+
+static const uint8_t all_flags = FLAG_ZERO | FLAG_SUBTRACTION | FLAG_HALF_CARRY | FLAG_CARRY;
+
+#ifdef __AVX2__
+// Expands a 32-bit lane mask to a vector with 0xFF in every selected byte.
+static __m256i lane_mask_vector(uint32_t mask) {
+    // Give every byte a copy of the mask byte that holds its bit, then test
+    // the single bit that belongs to it.
+    __m256i bits = _mm256_set1_epi32((int32_t) mask);
+    const __m256i spread = _mm256_setr_epi64x(
+            0x0000000000000000, 0x0101010101010101,
+            0x0202020202020202, 0x0303030303030303
+    );
+    bits = _mm256_shuffle_epi8(bits, spread);
+    const __m256i select = _mm256_set1_epi64x((int64_t) 0x8040201008040201);
+    bits = _mm256_and_si256(bits, select);
+    return _mm256_cmpeq_epi8(bits, select);
+}
+#endif
+
+// LD r, r' for every lane in the mask.
+static void vector_load(register8* dst, const register8* src, uint32_t mask) {
+#ifdef __AVX2__
+    __m256i lanes = lane_mask_vector(mask);
+    __m256i old = _mm256_loadu_si256((const __m256i*) dst);
+    __m256i value = _mm256_loadu_si256((const __m256i*) src);
+    _mm256_storeu_si256((__m256i*) dst, _mm256_blendv_epi8(old, value, lanes));
+#else
+    for (uint8_t i = 0; i < LOCKSTEP_MAX_LANES; i++) {
+        if (mask & (1u << i)) {
+            dst[i] = src[i];
+        }
+    }
+#endif
+}
+
+// AND/XOR/OR A, r for every lane in the mask. Flags match sm83_and8(),
+// sm83_xor8() and sm83_or8().
+static void vector_logic(lockstep_registers* regs, const register8* operand, logic_op op, uint32_t mask) {
+    uint8_t half_carry = (op == LOGIC_AND) ? FLAG_HALF_CARRY : 0;
+#ifdef __AVX2__
+    __m256i lanes = lane_mask_vector(mask);
+    __m256i a = _mm256_loadu_si256((const __m256i*) regs->A);
+    __m256i f = _mm256_loadu_si256((const __m256i*) regs->F);
+    __m256i value = _mm256_loadu_si256((const __m256i*) operand);
+
+    __m256i result;
+    switch (op) {
+        case LOGIC_AND:
+            result = _mm256_and_si256(a, value);
+            break;
+        case LOGIC_XOR:
+            result = _mm256_xor_si256(a, value);
+            break;
+        default:
+            result = _mm256_or_si256(a, value);
+            break;
+    }
+
+    __m256i zero = _mm256_cmpeq_epi8(result, _mm256_setzero_si256());
+    __m256i flags = _mm256_and_si256(zero, _mm256_set1_epi8(FLAG_ZERO));
+    flags = _mm256_or_si256(flags, _mm256_set1_epi8((char) half_carry));
+    __m256i new_f = _mm256_andnot_si256(_mm256_set1_epi8((char) all_flags), f);
+    new_f = _mm256_or_si256(new_f, flags);
+
+    _mm256_storeu_si256((__m256i*) regs->A, _mm256_blendv_epi8(a, result, lanes));
+    _mm256_storeu_si256((__m256i*) regs->F, _mm256_blendv_epi8(f, new_f, lanes));
+#else
+    for (uint8_t i = 0; i < LOCKSTEP_MAX_LANES; i++) {
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        register8 result;
+        switch (op) {
+            case LOGIC_AND:
+                result = regs->A[i] & operand[i];
+                break;
+            case LOGIC_XOR:
+                result = regs->A[i] ^ operand[i];
+                break;
+            default:
+                result = regs->A[i] | operand[i];
+                break;
+        }
+        uint8_t flags = half_carry | ((result == 0) ? FLAG_ZERO : 0);
+        regs->A[i] = result;
+        regs->F[i] = (regs->F[i] & ~all_flags) | flags;
+    }
+#endif
+}
+
+// Runs the opcode on all lanes in the mask at once if it only touches
+// registers. Returns false if the opcode needs the scalar core.
+static bool vector_execute(lockstep_registers* regs, uint8_t opcode, uint32_t mask) {
+    // Same order as the register field of the opcode. (HL) is a memory
+    // access, so it's left out.
+    register8* registers[8] = {
+            regs->B, regs->C, regs->D, regs->E, regs->H, regs->L, NULL, regs->A
+    };
+    uint8_t y = (opcode & 0b00111000) >> 3;
+    uint8_t z = (opcode & 0b00000111);
+
+    if (opcode >= LD_B_B && opcode <= LD_A_A) {
+        // Also rejects HALT (0x76), which sits where LD (HL), (HL) would be
+        if (registers[y] == NULL || registers[z] == NULL) {
+            return false;
+        }
+        vector_load(registers[y], registers[z], mask);
+        return true;
+    }
+    if (opcode >= AND_A_B && opcode <= OR_A_A && registers[z] != NULL) {
+        // y is 4, 5 or 6 for AND, XOR and OR
+        vector_logic(regs, registers[z], (logic_op) (y - 4), mask);
+        return true;
+    }
+    return false;
+}
+
+static void load_lane(cpu_state* cpu, const lockstep_registers* regs, uint8_t lane) {
+    cpu->AF = (regs->A[lane] << 8) | regs->F[lane];
+    cpu->B = regs->B[lane];
+    cpu->C = regs->C[lane];
+    cpu->D = regs->D[lane];
+    cpu->E = regs->E[lane];
+    cpu->H = regs->H[lane];
+    cpu->L = regs->L[lane];
+    cpu->SP = regs->SP[lane];
+    cpu->PC = regs->PC[lane];
+}
+
+static void store_lane(lockstep_registers* regs, const cpu_state* cpu, uint8_t lane) {
+    regs->A[lane] = cpu->A;
+    regs->F[lane] = cpu->AF & 0xFF;
+    regs->B[lane] = cpu->B;
+    regs->C[lane] = cpu->C;
+    regs->D[lane] = cpu->D;
+    regs->E[lane] = cpu->E;
+    regs->H[lane] = cpu->H;
+    regs->L[lane] = cpu->L;
+    regs->SP[lane] = cpu->SP;
+    regs->PC[lane] = cpu->PC;
+}
+
+// Interrupts, HALT and a pending EI are only handled by cpu_step()
+static bool lane_needs_scalar(const machine_state* lane) {
+    const uint8_t* memory = lane->console_memory;
+    uint8_t pending = memory[INTERRUPT_ENABLE] & memory[INTERRUPT_REQUEST] & INTERRUPT_ALL;
+    return lane->cpu.halted || lane->cpu.ime_pending || pending != 0;
+}
+
+bool lockstep_init(lockstep_group* group, uint8_t lane_count, const uint8_t* rom_data, uint32_t rom_size) {
+    if (lane_count == 0 || lane_count > LOCKSTEP_MAX_LANES) {
+        LOG_MSG(error, "Lane count must be between 1 and %d, got %d\n", LOCKSTEP_MAX_LANES, lane_count);
+        return false;
+    }
+    group->lane_count = lane_count;
+    for (uint8_t i = 0; i < lane_count; i++) {
+        if (!machine_init(&group->lanes[i], rom_data, rom_size)) {
+            return false;
+        }
+        store_lane(&group->regs, &group->lanes[i].cpu, i);
+        group->running |= (1u << i);
+    }
+    return true;
+}
+
+void lockstep_free(lockstep_group* group) {
+    for (uint8_t i = 0; i < group->lane_count; i++) {
+        machine_free(&group->lanes[i]);
+    }
+    group->running = 0;
+}
+
+uint32_t lockstep_step(lockstep_group* group) {
+    lockstep_registers* regs = &group->regs;
+    uint32_t pending = group->running;
+
+    while (pending != 0) {
+        // Gather every lane that agrees with the first pending lane on both
+        // the PC and the opcode there. Lanes can have different memory, so
+        // the same PC alone isn't enough.
+        uint8_t lead = __builtin_ctz(pending);
+        uint16_t pc = regs->PC[lead];
+        uint8_t opcode = *bus_read(pc, &group->lanes[lead]);
+        uint32_t converged = 0;
+        for (uint8_t i = lead; i < group->lane_count; i++) {
+            bool same = (pending & (1u << i)) && regs->PC[i] == pc;
+            if (same && *bus_read(pc, &group->lanes[i]) == opcode) {
+                converged |= (1u << i);
+            }
+        }
+        pending &= ~converged;
+
+        bool vectorizable = __builtin_popcount(converged) > 1;
+        for (uint8_t i = lead; i < group->lane_count && vectorizable; i++) {
+            if ((converged & (1u << i)) && lane_needs_scalar(&group->lanes[i])) {
+                vectorizable = false;
+            }
+        }
+        if (vectorizable && vector_execute(regs, opcode, converged)) {
+            group->vector_steps++;
+            group->vector_instructions += __builtin_popcount(converged);
+            for (uint8_t i = lead; i < group->lane_count; i++) {
+                if (converged & (1u << i)) {
+                    regs->PC[i]++;
+                    group->lanes[i].clock += unprefixed_opcode_info[opcode].cycles;
+                    group->lanes[i].stats.instructions++;
+                    if (group->lanes[i].dma_remaining_cycles != 0) {
+                        bus_advance_dma(&group->lanes[i], unprefixed_opcode_info[opcode].cycles);
+                    }
+                    ppu_catch_up(&group->lanes[i].ppu, group->lanes[i].console_memory, group->lanes[i].clock);
+                }
+            }
+            continue;
+        }
+
+        // Diverged, or not an instruction we can vectorize
+        for (uint8_t i = lead; i < group->lane_count; i++) {
+            if (!(converged & (1u << i))) {
+                continue;
+            }
+            machine_state* lane = &group->lanes[i];
+            load_lane(&lane->cpu, regs, i);
+            if (cpu_step(lane) == 0) {
+                group->running &= ~(1u << i);
+            }
+            store_lane(regs, &lane->cpu, i);
+            group->scalar_steps++;
+        }
+    }
+    return group->running;
+}
+
+bool run_lockstep(uint8_t* rom_data, uint32_t rom_size, uint8_t lane_count) {
+    static lockstep_group group = {0};
+    if (!lockstep_init(&group, lane_count, rom_data, rom_size)) {
+        LOG_MSG(error, "Failed to initialize %d lockstep lanes\n", lane_count);
+        lockstep_free(&group);
+        return true;
+    }
+    print_rom_info(rom_data, rom_size);
+
+    struct timespec start = {0};
+    struct timespec end = {0};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (lockstep_step(&group) != 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    uint64_t instructions = group.vector_instructions + group.scalar_steps;
+    LOG_MSG(info, "%d lanes ran %llu instructions in %.3fs (%.0f per second)\n", lane_count, (unsigned long long) instructions, seconds, instructions / seconds);
+    LOG_MSG(info, "%llu vector steps covering %llu instructions, %llu scalar steps\n", (unsigned long long) group.vector_steps, (unsigned long long) group.vector_instructions, (unsigned long long) group.scalar_steps);
+
+    lockstep_free(&group);
+    // Same exit code convention as run_machine(), the lanes only stop on an error.
+    return true;
+}
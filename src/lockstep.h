@@ -0,0 +1,54 @@
+// Runs several instances of the same ROM in lockstep. Lanes that are at the
+// same PC about to run the same register-only instruction are executed
+// together with one vector operation, anything else falls back to the normal
+// scalar CPU core one lane at a time.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "machine.h"
+
+// Largest supported group. One AVX2 register holds 32 8-bit lanes.
+#define LOCKSTEP_MAX_LANES 32
+
+// CPU registers of every lane, stored as structure-of-arrays so that one
+// operation can be applied to the same register of all lanes at once.
+typedef struct {
+    register8 A[LOCKSTEP_MAX_LANES];
+    register8 F[LOCKSTEP_MAX_LANES];
+    register8 B[LOCKSTEP_MAX_LANES];
+    register8 C[LOCKSTEP_MAX_LANES];
+    register8 D[LOCKSTEP_MAX_LANES];
+    register8 E[LOCKSTEP_MAX_LANES];
+    register8 H[LOCKSTEP_MAX_LANES];
+    register8 L[LOCKSTEP_MAX_LANES];
+    register16 SP[LOCKSTEP_MAX_LANES];
+    register16 PC[LOCKSTEP_MAX_LANES];
+}lockstep_registers;
+
+typedef struct {
+    // Registers here are authoritative while the group runs. A lane's
+    // cpu_state is only up to date while it's being stepped by the scalar core.
+    lockstep_registers regs;
+    machine_state lanes[LOCKSTEP_MAX_LANES];
+    uint32_t running; // Bitmask of lanes that haven't stopped yet
+    uint8_t lane_count;
+
+    uint64_t vector_steps; // Instructions executed once for several lanes
+    uint64_t vector_instructions; // Lane instructions covered by vector_steps
+    uint64_t scalar_steps; // Instructions executed for a single lane
+}lockstep_group;
+
+/// Creates lane_count machines that all run the same ROM.
+/// \param group Group to initialize. Should be zeroed.
+/// \param lane_count Number of lanes, from 1 to LOCKSTEP_MAX_LANES
+/// \return false if any lane failed to initialize
+bool lockstep_init(lockstep_group* group, uint8_t lane_count, const uint8_t* rom_data, uint32_t rom_size);
+void lockstep_free(lockstep_group* group);
+
+/// Executes one instruction on every running lane.
+/// \return Bitmask of lanes that are still running afterwards
+uint32_t lockstep_step(lockstep_group* group);
+
+bool run_lockstep(uint8_t* rom_data, uint32_t rom_size, uint8_t lane_count);
@@ -1,6 +1,5 @@
-// Manages entire virtual machine by updating each component every machine
-// cycle. Each component will wait for the appropriate number of cycles if
-// doing a multi-cycle operation, for more accurate timing.
+// Manages entire virtual machine. The CPU runs one instruction at a time and
+// the other components are caught up to its clock after each one.
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -8,48 +7,361 @@
 #include <memory.h>
 #include <stdio.h>
 
+#include "logging.h"
+
 #include "machine.h"
 #include "cpu.h"
 #include "memory_controllers.h"
+#include "bus.h"
 #include "rom.h"
+#include "wav.h"
+#include "pacing.h"
+#include "disassembler.h"
+#include "coverage.h"
+#include "heatmap.h"
+#include "hash.h"
+#include "telemetry.h"
+#include "perf_counters.h"
+#include "boot_rom.h"
+
+// Under AddressSanitizer, a poisoned gap separates the mutable state from the
+// ROM so that out of bounds external RAM accesses are caught instead of
+// silently landing in the ROM. The gap is as big as the largest offset a
+// controller can add from a 2-bit RAM bank number.
+#if defined(__SANITIZE_ADDRESS__)
+#define MACHINE_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define MACHINE_ASAN
+#endif
+#endif
+
+#ifdef MACHINE_ASAN
+#include <sanitizer/asan_interface.h>
+#define MACHINE_GUARD_SIZE (RAM_BANK_SIZE * 4)
+#else
+#define MACHINE_GUARD_SIZE 0
+#define ASAN_POISON_MEMORY_REGION(address, size) ((void) (address), (void) (size))
+#define ASAN_UNPOISON_MEMORY_REGION(address, size) ((void) (address), (void) (size))
+#endif
+
+const char* cpu_core_names[CPU_CORE_COUNT] = {
+    [CPU_CORE_SWITCH] = "switch",
+    [CPU_CORE_DECODED] = "decoded"
+};
 
-bool run_machine(uint8_t* rom_data, uint32_t rom_size) {
-    machine_state machine = {0};
-    uint32_t machine_mem_size = 0xFFFF + 1;
+bool machine_init(machine_state* machine, const uint8_t* rom_data, uint32_t rom_size) {
+    // The header decides how much memory the cartridge needs
+    cart_header cart = {0};
+    if (rom_size >= 0x100 + sizeof(cart)) {
+        memcpy(&cart, rom_data + 0x100, sizeof(cart));
+    }
+    machine->memory_controller = get_cart_controller(&cart);
+    machine->rom_bank_count = rom_header_bank_count(&cart);
+    machine->ram_bank_count = ram_bank_count(&cart);
 
-    // Enough space for 8 8KiB banks of external RAM
-    uint32_t cart_ram_size = RAM_BANK_SIZE * 8;
-     
-    uint32_t total_ram_size = machine_mem_size + rom_size + cart_ram_size;
-    machine.console_memory = calloc(total_ram_size, 1);
-    if (machine.console_memory == NULL) {
+    // Bank switching can reach any bank the header claims, even if the file
+    // is shorter than that.
+    machine->rom_size = machine->rom_bank_count * ROM_BANK_SIZE;
+    if (rom_size > machine->rom_size) {
+        machine->rom_size = rom_size;
+    }
+    uint32_t state_size = CONSOLE_MEMORY_SIZE + RAM_BANK_SIZE * machine->ram_bank_count;
+    machine->arena_size = state_size + MACHINE_GUARD_SIZE + machine->rom_size + BOOT_ROM_SIZE;
+    machine->arena = calloc(machine->arena_size, 1);
+    if (machine->arena == NULL) {
         return false;
     }
-    machine.cartridge_rom = (machine.console_memory + machine_mem_size);
+    machine->console_memory = machine->arena;
+    machine->external_ram = machine->arena + CONSOLE_MEMORY_SIZE;
+    machine->cartridge_rom = machine->arena + state_size + MACHINE_GUARD_SIZE;
+    machine->boot_rom = machine->cartridge_rom + machine->rom_size;
+    ASAN_POISON_MEMORY_REGION(machine->arena + state_size, MACHINE_GUARD_SIZE);
+
+    memcpy(machine->cartridge_rom, rom_data, rom_size);
+    machine->rom_crc = crc32c(0, machine->cartridge_rom, machine->rom_size);
+    machine_reset(machine);
+
+    // Only run if the requested memory controller is implemented
+    return init_memory_controller(machine);
+}
 
-    memcpy(machine.cartridge_rom, rom_data, rom_size);
+void machine_reset(machine_state* machine) {
+    memset(machine->arena, 0, CONSOLE_MEMORY_SIZE + RAM_BANK_SIZE * machine->ram_bank_count);
 
     // Copy the first 2 16KiB ROM banks into RAM
-    memcpy(machine.console_memory, machine.cartridge_rom, 0x7FFF);
-    cart_header* cart = (cart_header*) (machine.console_memory + 0x100);
-    machine.memory_controller = get_controller_type(get_cart_hardware(cart));
-    machine.rom_bank_count = 2 * (1 << cart->rom_size);
-    machine.ram_bank_count = ram_bank_count(cart);
-    print_rom_info(cart);
+    memcpy(machine->console_memory, machine->cartridge_rom, 2 * ROM_BANK_SIZE);
 
-    machine.external_ram = calloc(1, RAM_BANK_SIZE * machine.ram_bank_count);
+    machine->clock = 0;
+    cpu_init(&machine->cpu);
+    init_memory_controller(machine);
+    machine->dma_remaining_cycles = 0;
+    apu_reset(&machine->apu, machine->console_memory);
+    ppu_reset(&machine->ppu, machine->console_memory);
+    joypad_reset(&machine->joypad, machine->console_memory);
+    serial_port empty_serial = {0};
+    machine->serial = empty_serial;
+    machine->boot_rom_mapped = machine->has_boot_rom;
+    if (!machine->boot_rom_mapped) {
+        boot_rom_skip(machine);
+    }
+    bus_map_pages(machine);
+    machine_stats empty_stats = {0};
+    machine->stats = empty_stats;
+}
 
-    // Only enter main loop if the requested memory controller is implemented
-    bool running = init_memory_controller(cart);
+bool machine_set_boot_rom(machine_state* machine, const uint8_t* data, uint32_t size) {
+    if (size != BOOT_ROM_SIZE) {
+        LOG_MSG(error, "Boot ROM is %u bytes, expected %u\n", size, BOOT_ROM_SIZE);
+        return false;
+    }
+    memcpy(machine->boot_rom, data, BOOT_ROM_SIZE);
+    machine->has_boot_rom = true;
+    machine_reset(machine);
+    return true;
+}
 
+void machine_free(machine_state* machine) {
+    if (machine->arena != NULL) {
+        ASAN_UNPOISON_MEMORY_REGION(machine->arena, machine->arena_size);
+    }
+    free(machine->arena);
+    machine->arena = NULL;
+    machine->console_memory = NULL;
+    machine->cartridge_rom = NULL;
+    machine->external_ram = NULL;
+    machine->boot_rom = NULL;
+}
+
+static const char state_magic[8] = "DMGSAV1";
+
+// Identifies what a save state can be loaded into
+typedef struct {
+    char magic[8];
+    uint32_t machine_size; // sizeof(machine_state) of the build that saved it
+    uint32_t memory_size; // Mutable part of the arena
+    uint32_t rom_size;
+    uint32_t rom_crc;
+}state_header;
+
+static uint32_t mutable_memory_size(const machine_state* machine) {
+    return CONSOLE_MEMORY_SIZE + RAM_BANK_SIZE * machine->ram_bank_count;
+}
+
+uint32_t machine_state_size(const machine_state* machine) {
+    return sizeof(state_header) + sizeof(machine_state) + mutable_memory_size(machine);
+}
+
+bool machine_save_state(const machine_state* machine, uint8_t* buffer, uint32_t size) {
+    if (size < machine_state_size(machine)) {
+        return false;
+    }
+    state_header header = {
+        .machine_size = sizeof(machine_state),
+        .memory_size = mutable_memory_size(machine),
+        .rom_size = machine->rom_size,
+        .rom_crc = machine->rom_crc
+    };
+    memcpy(header.magic, state_magic, sizeof(state_magic));
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), machine, sizeof(machine_state));
+    memcpy(buffer + sizeof(header) + sizeof(machine_state), machine->arena, header.memory_size);
+    return true;
+}
+
+bool machine_load_state(machine_state* machine, const uint8_t* buffer, uint32_t size) {
+    state_header header = {0};
+    if (size < machine_state_size(machine)) {
+        return false;
+    }
+    memcpy(&header, buffer, sizeof(header));
+    if (memcmp(header.magic, state_magic, sizeof(state_magic)) != 0 || header.machine_size != sizeof(machine_state) ||
+        header.memory_size != mutable_memory_size(machine) || header.rom_size != machine->rom_size ||
+        header.rom_crc != machine->rom_crc) {
+        return false;
+    }
+
+    // Pointers in the saved struct are from whichever machine saved it, so
+    // everything that isn't emulated hardware comes from this one
+    machine_state host = *machine;
+    memcpy(machine, buffer + sizeof(header), sizeof(machine_state));
+    machine->arena = host.arena;
+    machine->arena_size = host.arena_size;
+    machine->console_memory = host.console_memory;
+    machine->cartridge_rom = host.cartridge_rom;
+    machine->external_ram = host.external_ram;
+    machine->boot_rom = host.boot_rom;
+    machine->has_boot_rom = host.has_boot_rom;
+    machine->core = host.core;
+    machine->debugger = host.debugger;
+    memcpy(machine->watched_pages, host.watched_pages, sizeof(host.watched_pages));
+    machine->heatmap = host.heatmap;
+    machine->hasher = host.hasher;
+    machine->stats = host.stats;
+    machine->apu.synthesize = host.apu.synthesize;
+    machine->apu.sink = host.apu.sink;
+    machine->apu.sink_user = host.apu.sink_user;
+    machine->apu.resample = host.apu.resample;
+    machine->apu.resampler = host.apu.resampler;
+    machine->apu.buffered_frames = host.apu.buffered_frames;
+    memcpy(machine->apu.buffer, host.apu.buffer, sizeof(host.apu.buffer));
+    machine->ppu.render_interval = host.ppu.render_interval;
+    machine->ppu.render_requested = host.ppu.render_requested;
+    machine->ppu.rendered_frames = host.ppu.rendered_frames;
+
+    memcpy(machine->arena, buffer + sizeof(header) + sizeof(machine_state), header.memory_size);
+    bus_map_pages(machine);
+    return true;
+}
+
+// Instructions shown from where the CPU stopped
+#define STOP_REPORT_INSTRUCTIONS 4
+
+// Prints where the CPU stopped and the code there, for when a ROM crashes
+static void report_stop(machine_state* machine, uint16_t address, const char* symbols_path) {
+    disassembler dis = {0};
+    if (!disassembler_init(&dis, machine)) {
+        return;
+    }
+    if (symbols_path != NULL) {
+        disassembler_load_symbols(&dis, symbols_path);
+    }
+    const cpu_state* cpu = &machine->cpu;
+    LOG_MSG(info, "CPU stopped at $%02x:%04x after %llu cycles\n",
+            disassembler_bank(machine, address), address, (unsigned long long) machine->clock);
+    LOG_MSG(info, "AF:%04x BC:%04x DE:%04x HL:%04x SP:%04x PC:%04x\n",
+            cpu->AF, cpu->BC, cpu->DE, cpu->HL, cpu->SP, cpu->PC);
+    for (uint8_t i = 0; i < STOP_REPORT_INSTRUCTIONS; i++) {
+        char location[DISASSEMBLY_TEXT_SIZE];
+        uint8_t length = 0;
+        disassembler_symbolize(&dis, address, location, sizeof(location));
+        const char* text = disassemble(&dis, address, &length);
+        LOG_MSG(info, "%s $%04x %-24s %s\n", (i == 0) ? ">" : " ", address, location, text);
+        address += length;
+    }
+    disassembler_free(&dis);
+}
+
+static void write_wav_samples(void* user, const int16_t* samples, uint32_t frame_count) {
+    wav_write(user, samples, frame_count);
+}
+
+bool run_machine(const char* rom_path, uint8_t* rom_data, uint32_t rom_size, const run_options* options) {
+    machine_state machine = {.core = options->core};
+    if (!machine_init(&machine, rom_data, rom_size)) {
+        LOG_MSG(error, "Failed to initialize the machine\n");
+        machine_free(&machine);
+        return true;
+    }
+    if (options->boot_rom_path != NULL && !boot_rom_load(&machine, options->boot_rom_path)) {
+        machine_free(&machine);
+        return true;
+    }
+    print_rom_info(rom_data, rom_size);
+
+    wav_writer wav = {0};
+    if (options->wav_path != NULL) {
+        uint32_t sample_rate = options->resample ? 48000 : APU_NATIVE_RATE;
+        if (!wav_open(&wav, options->wav_path, sample_rate)) {
+            machine_free(&machine);
+            return true;
+        }
+        apu_set_output(&machine.apu, write_wav_samples, &wav, sample_rate);
+    }
+
+    // Encoding happens on another thread, this one only copies finished frames
+    // into the ring
+    frame_output video = {0};
+    bool recording = options->video_path != NULL;
+    if (recording) {
+        uint32_t interval = options->video_interval != 0 ? options->video_interval : 1;
+        if (!frame_output_start(&video, options->video_format, options->video_path, options->video_policy, interval)) {
+            wav_close(&wav);
+            machine_free(&machine);
+            return true;
+        }
+        ppu_set_render_interval(&machine.ppu, interval);
+    }
+
+    bool running = true;
+    uint64_t next_frame = MACHINE_CYCLES_PER_FRAME;
+    // Pacing is checked once per frame, uncapped runs skip it entirely
+    bool paced = options->speed > 0;
+    pacer pacer = {0};
+    pacer_start(&pacer, options->speed);
+
+    coverage_map coverage = {0};
+    bool covering = options->coverage_dir != NULL && coverage_init(&coverage, &machine);
+    memory_heatmap heatmap = {0};
+    bool counting = options->heatmap_path != NULL && heatmap_attach(&heatmap, &machine);
+
+    // Opened last so setup isn't counted
+    perf_counters perf = {0};
+    bool measuring = options->perf_counters && perf_counters_open(&perf);
+
+    uint64_t frames = 0;
+    uint16_t instruction_pc = 0;
     while (running) {
-        machine.clock++;
-        running = tick(&machine);
+        instruction_pc = machine.cpu.PC;
+        if (covering) {
+            coverage_record(&coverage, &machine);
+        }
+        running = cpu_step(&machine) != 0;
+        if (recording) {
+            uint64_t frame_number = 0;
+            const uint8_t* frame = ppu_take_frame(&machine.ppu, &frame_number);
+            if (frame != NULL) {
+                frame_output_publish(&video, frame, frame_number);
+            }
+        }
+        if (machine.clock >= next_frame) {
+            apu_end_frame(&machine.apu, machine.console_memory, machine.clock);
+            next_frame += MACHINE_CYCLES_PER_FRAME;
+            frames++;
+            if (measuring) {
+                perf_counters_frame(&perf);
+            }
+            if (options->stats_path != NULL && options->stats_interval != 0 && frames % options->stats_interval == 0) {
+                telemetry_append(options->stats_path, &machine, rom_path, pacer_busy_seconds(&pacer));
+            }
+            if (paced) {
+                pacer_wait(&pacer, machine.clock);
+            }
+        }
+    }
+    apu_end_frame(&machine.apu, machine.console_memory, machine.clock);
+    if (measuring) {
+        perf_counters_frame(&perf);
+        perf_counters_close(&perf);
+        perf_counters_report(&perf, cpu_core_names[machine.core], machine.stats.instructions);
     }
-    free(machine.console_memory);
+    pacer_report(&pacer, machine.clock);
+    report_stop(&machine, instruction_pc, options->symbols_path);
+    if (options->stats_path != NULL) {
+        telemetry_append(options->stats_path, &machine, rom_path, pacer_busy_seconds(&pacer));
+    }
+    if (covering) {
+        coverage_save(&coverage, options->coverage_dir);
+        coverage_free(&coverage);
+    }
+    if (counting) {
+        heatmap_report(&heatmap);
+        heatmap_write_csv(&heatmap, options->heatmap_path);
+        heatmap_detach(&heatmap);
+    }
+    wav_close(&wav);
+    if (recording) {
+        frame_output_stop(&video);
+    }
+
+    uint32_t serial_length = 0;
+    const uint8_t* serial_data = serial_output(&machine.serial, &serial_length);
+    if (serial_length != 0) {
+        LOG_MSG(info, "Serial output:\n%.*s\n", serial_length, serial_data);
+    }
+    machine_free(&machine);
     // Inverted to turn bool into standard process exit code.
     // 0 (false) is success, 1 (true) is an error.
     return !running;
 
 }
-
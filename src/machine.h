@@ -2,30 +2,168 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// Memory controller types
-typedef enum {
-    NONE,
-    MBC1,
-    MBC2,
-    MBC3,
-    MBC5,
-    MBC6,
-    MBC7
-}controller_type;
+#include "registers.h"
+#include "serial.h"
+#include "apu.h"
+#include "ppu.h"
+#include "frame_output.h"
+#include "joypad.h"
+#include "rom.h"
 
 typedef enum {
-   RAM_BANK_SIZE = 0x2000
+   CONSOLE_MEMORY_SIZE = 0x10000,
+   ROM_BANK_SIZE = 0x4000,
+   RAM_BANK_SIZE = 0x2000,
+   MACHINE_CYCLES_PER_SECOND = 1048576,
+   MACHINE_CYCLES_PER_FRAME = 17556 // 154 lines of 114 M-cycles
 }machine_constants;
 
+// Interpreter that cpu_step() runs instructions with
+typedef enum {
+    CPU_CORE_SWITCH, // Hand written switch over every opcode
+    CPU_CORE_DECODED, // Handler table built by decoding each opcode once, see decoder.h
+    CPU_CORE_COUNT
+}cpu_core;
+
+// Name of a core as given to --core
+extern const char* cpu_core_names[CPU_CORE_COUNT];
+
+// The bus splits the address space into 256 byte pages
+#define BUS_PAGE_SHIFT 8
+#define BUS_PAGE_COUNT 0x100
+#define BUS_PAGE_MASK 0xFF
+
+// Bank selection registers of the cartridge memory controller
 typedef struct {
+    uint8_t rom_bank: 5;
+    uint8_t ram_bank: 2;
+    bool mode: 1;
+    bool ram_enabled: 1;
+}controller_registers;
+
+// Counters kept for telemetry, see telemetry.h. Each is a single increment
+// where the event already happens, so they're always on. Cleared on reset,
+// and kept when a state is loaded, since they describe the run rather than
+// the emulated hardware.
+typedef struct {
+    uint64_t instructions; // Instructions retired
+    uint64_t interrupts; // Interrupts dispatched
+    uint64_t halt_cycles; // Cycles skipped ahead while halted
+    uint64_t bank_switches; // Controller writes that changed the ROM or RAM bank
+    uint64_t sram_writes; // Writes that reached external RAM
+    // Accesses that missed the page tables and went through the bus slow
+    // path. Hits are the fast path and aren't counted.
+    uint64_t slow_reads;
+    uint64_t slow_writes;
+}machine_stats;
+
+typedef struct {
+    cpu_state cpu;
+    // All memory of the machine is one allocation, laid out as console
+    // memory, external RAM, the ROM and then the boot ROM. Everything up to
+    // the ROM is mutable state, so a reset is a single memset.
+    uint8_t* arena;
+    uint32_t arena_size;
     uint8_t* console_memory; // Machine's 16-bit address space
     uint8_t* cartridge_rom; // ROM file (full cartridge data)
     uint8_t* external_ram; // External cartridge RAM
-    uint8_t rom_bank_count;
+    uint32_t rom_size; // Size of the ROM region, at least every bank in the header
+    uint8_t* boot_rom; // BOOT_ROM_SIZE bytes, see boot_rom.h
+    bool has_boot_rom; // Loaded with machine_set_boot_rom(), kept across resets
+    bool boot_rom_mapped; // Over 0x0000-0x00FF until the game unmaps it
+
+    // Direct pointers to each page of the address space as the CPU sees it,
+    // or NULL if accesses need to be decoded by bus_read_slow() and
+    // bus_write_slow().
+    uint8_t* read_pages[BUS_PAGE_COUNT];
+    uint8_t* write_pages[BUS_PAGE_COUNT];
+
+    uint16_t rom_bank_count;
     uint8_t ram_bank_count;
     controller_type memory_controller;
+    controller_registers controller;
+    serial_port serial;
+    apu_state apu;
+    ppu_state ppu;
+    joypad_state joypad; // Held buttons are kept across resets
+    uint8_t dma_remaining_cycles; // M-cycles until an OAM DMA transfer releases the bus
     uint64_t clock;
+    machine_stats stats;
+    uint32_t rom_crc; // CRC32C of the ROM region, identifies the cartridge
+    cpu_core core; // Kept across resets
+
+    // Attached debugger or NULL, kept across resets like its watchpoints.
+    // Each page has the watch_kind bits of the watchpoints in it, and is
+    // never mapped directly for those kinds of access.
+    struct debugger* debugger;
+    uint8_t watched_pages[BUS_PAGE_COUNT];
+    // Attached heatmap or NULL. While there is one, no page is mapped
+    // directly so it sees every access.
+    struct memory_heatmap* heatmap;
+    // Attached state hasher or NULL, see determinism.h. It write protects
+    // pages to find the ones that changed.
+    struct state_hasher* hasher;
 }machine_state;
 
-bool run_machine(uint8_t* rom_data, uint32_t rom_size);
+/// Allocates all memory for a machine and loads a ROM into it. Every piece of
+/// state lives in the machine_state, so several machines can run side by side.
+/// \param machine Machine to initialize. Should be zeroed.
+/// \param rom_data ROM file contents, copied into the machine
+/// \param rom_size Size of the ROM in bytes
+/// \return false if allocation failed or the cartridge isn't supported
+bool machine_init(machine_state* machine, const uint8_t* rom_data, uint32_t rom_size);
+
+// Puts the machine back to its power on state without reallocating. The ROM
+// is kept, everything else is cleared. Without a boot ROM, the state it would
+// have handed over in is applied straight away.
+void machine_reset(machine_state* machine);
+
+/// Loads a DMG boot ROM and resets the machine to run it.
+/// \param size Must be BOOT_ROM_SIZE
+/// \return false if the size is wrong
+bool machine_set_boot_rom(machine_state* machine, const uint8_t* data, uint32_t size);
+
+// Releases everything allocated by machine_init().
+void machine_free(machine_state* machine);
+
+// Size of a save state of this machine in bytes.
+uint32_t machine_state_size(const machine_state* machine);
+
+/// Saves everything the emulated hardware would need to carry on, i.e. the
+/// machine_state and the mutable part of the arena, behind a small header.
+/// Host side settings like the core, audio output, render interval and
+/// attached tools aren't part of it. States are raw structs, so they only
+/// load into the same build of the emulator running the same ROM.
+/// \param buffer At least machine_state_size() bytes
+/// \return false if the buffer is too small
+bool machine_save_state(const machine_state* machine, uint8_t* buffer, uint32_t size);
+
+/// Restores a state from machine_save_state(). Host side settings of the
+/// machine are kept.
+/// \return false, leaving the machine untouched, if the state is from
+/// another ROM or build
+bool machine_load_state(machine_state* machine, const uint8_t* buffer, uint32_t size);
+
+// Settings for run_machine() that don't affect emulation
+typedef struct {
+    const char* wav_path; // Audio is written here if set
+    bool resample; // Resample audio to 48kHz instead of the native rate
+    const char* video_path; // Frames are recorded here if set
+    frame_output_format video_format;
+    frame_output_policy video_policy; // What to do when encoding falls behind
+    uint32_t video_interval; // Record every Nth frame, 0 is treated as 1
+    double speed; // Multiple of real time to run at, 0 for uncapped
+    cpu_core core;
+    const char* symbols_path; // RGBDS .sym file for labels in disassembly
+    const char* coverage_dir; // ROM coverage is merged into a file here if set, see coverage.h
+    const char* heatmap_path; // Memory access counts are written here as CSV if set, see heatmap.h
+    const char* stats_path; // Telemetry is appended here as JSON lines if set, see telemetry.h
+    uint32_t stats_interval; // Also append every N frames, 0 for only at exit
+    bool perf_counters; // Measure host counters per frame and report them, see perf_counters.h
+    const char* boot_rom_path; // Run this boot ROM first if set, instead of starting at 0x0100
+}run_options;
 
+/// Runs a ROM until the CPU stops.
+/// \param rom_path Where the ROM was loaded from, only used to label output
+/// \return true if the run ended in an error, like a process exit code
+bool run_machine(const char* rom_path, uint8_t* rom_data, uint32_t rom_size, const run_options* options);
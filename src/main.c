@@ -1,4 +1,6 @@
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <malloc.h>
 #include <sys/stat.h>
 
@@ -7,9 +9,58 @@
 
 #include "rom.h"
 #include "machine.h"
+#include "lockstep.h"
+#include "test_runner.h"
+#include "trace.h"
+#include "screenshot.h"
+#include "gdb_stub.h"
+#include "determinism.h"
+
+// Emulated seconds a test ROM gets before it counts as timed out
+#define DEFAULT_TEST_TIMEOUT 120
+// Frames each lane of a determinism check runs for
+#define DEFAULT_DETERMINISM_FRAMES 600
 
 void print_instructions() {
-    LOG_MSG(info, "Usage: dmgem [ROM filepath]\n");
+    LOG_MSG(info, "Usage: dmgem [options] [ROM filepath]\n");
+    LOG_MSG(info, "  --lockstep N       Run N copies of the ROM in lockstep (1-%d)\n", LOCKSTEP_MAX_LANES);
+    LOG_MSG(info, "  --determinism N    Run N copies in parallel threads and compare state hashes every frame\n");
+    LOG_MSG(info, "  --check-frames N   Frames a determinism check runs for (default %d)\n", DEFAULT_DETERMINISM_FRAMES);
+    LOG_MSG(info, "  --test             Run every ROM given as a test ROM and report results\n");
+    LOG_MSG(info, "  --test-timeout S   Emulated seconds before a test ROM times out (default %d)\n", DEFAULT_TEST_TIMEOUT);
+    LOG_MSG(info, "  --core C           Interpreter core, switch (default) or decoded\n");
+    LOG_MSG(info, "  --boot-rom F       Run the DMG boot ROM in F before the cartridge\n");
+    LOG_MSG(info, "  --symbols F        Label disassembly in reports with an RGBDS .sym file\n");
+    LOG_MSG(info, "  --coverage D       Merge the ROM bytes executed, read and written into a file in D\n");
+    LOG_MSG(info, "  --heatmap F        Count accesses per page and I/O register, written to F as CSV (slow)\n");
+    LOG_MSG(info, "  --stats F          Append run counters to F as a JSON line at exit, per ROM with --test\n");
+    LOG_MSG(info, "  --stats-every N    Also append them every N frames\n");
+    LOG_MSG(info, "  --perf             Measure host cycles, instructions and misses per frame (Linux)\n");
+    LOG_MSG(info, "  --gdb A            Wait for a GDB client on localhost port A, or Unix socket A\n");
+    LOG_MSG(info, "  --trace-compare F  Check every instruction against a Gameboy Doctor log\n");
+    LOG_MSG(info, "  --screenshot N     Hash frame N of every ROM given and compare it to the ROM's .hash file\n");
+    LOG_MSG(info, "  --expect-dir D     Keep .hash files in D instead of next to the ROMs\n");
+    LOG_MSG(info, "  --png-dir D        Write mismatching frames to D as PNGs\n");
+    LOG_MSG(info, "  --update-hashes    Record hashes for ROMs that don't match instead of failing\n");
+    LOG_MSG(info, "  --wav F            Write the audio output to a WAV file\n");
+    LOG_MSG(info, "  --resample         Resample audio to 48kHz instead of the native %dHz\n", APU_NATIVE_RATE);
+    LOG_MSG(info, "  --record-png D     Write frames to D as numbered PNGs\n");
+    LOG_MSG(info, "  --record-y4m F     Write frames to F as a grayscale Y4M video, F can be a FIFO\n");
+    LOG_MSG(info, "  --record-every N   Only record every Nth frame (default 1)\n");
+    LOG_MSG(info, "  --speed X          Run at X times real time, 1 for real time (default 0, uncapped)\n");
+    LOG_MSG(info, "  --drop-frames      Drop frames when encoding falls behind instead of waiting for it\n");
+}
+
+// Parses a lane count, which must be a number from min to max
+// \return false if it isn't
+static bool parse_lanes(const char* text, uint8_t min, uint8_t max, uint8_t* lanes) {
+    char* end = NULL;
+    unsigned long value = strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || text[0] == '-' || value < min || value > max) {
+        return false;
+    }
+    *lanes = value;
+    return true;
 }
 
 int main(int argc, char* argv[]) {
@@ -19,39 +70,179 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    char* filename = argv[1];
-
-    if (!file_exists(filename)) {
-        LOG_MSG(error, "%s doesn't exist.\n", filename);
-        print_instructions();
+    // Everything that isn't an option is a ROM path
+    char** rom_paths = calloc(argc, sizeof(*rom_paths));
+    if (rom_paths == NULL) {
+        LOG_MSG(error, "Failed to allocate the ROM list\n");
         return 1;
     }
-    
-    uint32_t rom_size = file_size(filename);
-    uint8_t* rom_data = calloc(rom_size, 1);
-    if (rom_data == NULL) {
-        LOG_MSG(error, "Failed to allocate %d bytes for ROM\n", rom_size);
-        return 1;
+    int rom_count = 0;
+    uint8_t lockstep_lanes = 0;
+    uint8_t determinism_lanes = 0;
+    uint32_t determinism_frames = DEFAULT_DETERMINISM_FRAMES;
+    bool test_mode = false;
+    uint32_t test_timeout = DEFAULT_TEST_TIMEOUT;
+    char* trace_reference_path = NULL;
+    char* gdb_address = NULL;
+    run_options options = {0};
+    bool screenshot_mode = false;
+    screenshot_options screenshot = {0};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--lockstep") == 0 && i + 1 < argc) {
+            if (!parse_lanes(argv[++i], 1, LOCKSTEP_MAX_LANES, &lockstep_lanes)) {
+                LOG_MSG(error, "--lockstep needs 1-%d lanes, got %s\n", LOCKSTEP_MAX_LANES, argv[i]);
+                print_instructions();
+                free(rom_paths);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--determinism") == 0 && i + 1 < argc) {
+            if (!parse_lanes(argv[++i], DETERMINISM_MIN_LANES, DETERMINISM_MAX_LANES, &determinism_lanes)) {
+                LOG_MSG(error, "--determinism needs %d-%d lanes, got %s\n", DETERMINISM_MIN_LANES, DETERMINISM_MAX_LANES,
+                        argv[i]);
+                print_instructions();
+                free(rom_paths);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--check-frames") == 0 && i + 1 < argc) {
+            determinism_frames = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--test") == 0) {
+            test_mode = true;
+        }
+        else if (strcmp(argv[i], "--test-timeout") == 0 && i + 1 < argc) {
+            test_timeout = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--core") == 0 && i + 1 < argc) {
+            i++;
+            options.core = CPU_CORE_COUNT;
+            for (uint8_t core = 0; core < CPU_CORE_COUNT; core++) {
+                if (strcmp(argv[i], cpu_core_names[core]) == 0) {
+                    options.core = core;
+                }
+            }
+            if (options.core == CPU_CORE_COUNT) {
+                LOG_MSG(error, "Unknown core %s\n", argv[i]);
+                free(rom_paths);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--boot-rom") == 0 && i + 1 < argc) {
+            options.boot_rom_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--symbols") == 0 && i + 1 < argc) {
+            options.symbols_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--coverage") == 0 && i + 1 < argc) {
+            options.coverage_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc) {
+            options.heatmap_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            options.stats_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stats-every") == 0 && i + 1 < argc) {
+            options.stats_interval = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--perf") == 0) {
+            options.perf_counters = true;
+        }
+        else if (strcmp(argv[i], "--gdb") == 0 && i + 1 < argc) {
+            gdb_address = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace-compare") == 0 && i + 1 < argc) {
+            trace_reference_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc) {
+            screenshot_mode = true;
+            screenshot.frame = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--expect-dir") == 0 && i + 1 < argc) {
+            screenshot.expect_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--png-dir") == 0 && i + 1 < argc) {
+            screenshot.png_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--update-hashes") == 0) {
+            screenshot.update = true;
+        }
+        else if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc) {
+            options.wav_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--resample") == 0) {
+            options.resample = true;
+        }
+        else if (strcmp(argv[i], "--record-png") == 0 && i + 1 < argc) {
+            options.video_path = argv[++i];
+            options.video_format = FRAME_OUTPUT_PNG;
+        }
+        else if (strcmp(argv[i], "--record-y4m") == 0 && i + 1 < argc) {
+            options.video_path = argv[++i];
+            options.video_format = FRAME_OUTPUT_Y4M;
+        }
+        else if (strcmp(argv[i], "--record-every") == 0 && i + 1 < argc) {
+            options.video_interval = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            options.speed = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--drop-frames") == 0) {
+            options.video_policy = FRAME_OUTPUT_DROP;
+        }
+        else {
+            rom_paths[rom_count++] = argv[i];
+        }
     }
-
-    FILE* rom_file = fopen(filename, "rb");
-    if (rom_file == NULL) {
-        LOG_MSG(error, "Failed to open provided ROM file %s\n", filename);
+    if (rom_count == 0) {
+        LOG_MSG(error, "No ROM file provided.\n");
         print_instructions();
+        free(rom_paths);
         return 1;
     }
 
-    if (fread(rom_data, rom_size, 1, rom_file) != 1) {
-        LOG_MSG(error, "Failed to read all %d bytes from %s\n", rom_size, filename);
-        fclose(rom_file);
+    if (test_mode) {
+        uint64_t max_cycles = (uint64_t) test_timeout * MACHINE_CYCLES_PER_SECOND;
+        int failures = run_test_suite(rom_paths, rom_count, max_cycles, &options);
+        free(rom_paths);
+        return (failures != 0);
+    }
+
+    if (screenshot_mode) {
+        screenshot.max_cycles = (uint64_t) test_timeout * MACHINE_CYCLES_PER_SECOND;
+        int failures = run_screenshot_suite(rom_paths, rom_count, &screenshot);
+        free(rom_paths);
+        return (failures != 0);
+    }
+
+    char* filename = rom_paths[0];
+    free(rom_paths);
+    uint32_t rom_size = 0;
+    uint8_t* rom_data = file_load(filename, &rom_size);
+    if (rom_data == NULL) {
+        print_instructions();
         return 1;
     }
-    fclose(rom_file);
     LOG_MSG(debug, "Loaded %s (%d bytes)\n", filename, rom_size);
 
     // Main emulation loop
-    uint8_t exit_code = run_machine(rom_data, rom_size);
+    uint8_t exit_code = 0;
+    if (trace_reference_path != NULL) {
+        exit_code = run_trace_compare(rom_data, rom_size, trace_reference_path, &options);
+    }
+    else if (gdb_address != NULL) {
+        exit_code = run_gdb_server(rom_data, rom_size, gdb_address, &options);
+    }
+    else if (determinism_lanes != 0) {
+        exit_code = run_determinism_check(rom_data, rom_size, determinism_lanes, determinism_frames, &options);
+    }
+    else if (lockstep_lanes != 0) {
+        exit_code = run_lockstep(rom_data, rom_size, lockstep_lanes);
+    }
+    else {
+        exit_code = run_machine(filename, rom_data, rom_size, &options);
+    }
     free(rom_data);
     return exit_code;
 }
-
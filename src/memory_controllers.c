@@ -4,13 +4,6 @@
 #include "memory_controllers.h"
 #include "bus.h"
 
-static struct {
-    uint8_t rom_bank: 5;
-    uint8_t ram_bank: 2;
-    bool mode: 1;
-    bool ram_enabled: 1;
-}controller_state;
-
 enum {
     RANGE_MIN = 0x000
 };
@@ -66,42 +59,10 @@ bool range_mbc1_rom_high(uint16_t addr) {
     return in_range(addr, MBC1_R_RANGE_ROM_0, MBC1_R_RANGE_ROM_HIGH);
 }
 
-// Size of a 16KiB ROM bank.
-#define ROM_BANK_SIZE 0x4000
-// Size of an 8KiB RAM bank.
-#define RAM_BANK_SIZE 0x2000
-
 // A pointer to this is returned when reading from disabled cartridge RAM, so that all the read data will be 0xFF.
 static const uint64_t invalid_data = 0xFFFFFFFFFFFFFFFF;
 
-static controller_type memory_controller = NONE;
-static uint8_t rom_size = 0;
-
-controller_type get_controller_type(hardware_flags flags) {
-    if (flags.MBC1) {
-        return MBC1;
-    }
-    else if (flags.MBC2) {
-        return MBC2;
-    }
-    else if (flags.MBC3) {
-        return MBC3;
-    }
-    else if (flags.MBC5) {
-        return MBC5;
-    }
-    else if (flags.MBC6) {
-        return MBC6;
-    }
-    else if (flags.MBC7) {
-        return MBC7;
-    }
-    else {
-        return NONE;
-    }
-}
-
-uint8_t zero_bank_number(uint8_t rom_bank_count, uint8_t ram_bank_count) {
+uint8_t zero_bank_number(uint16_t rom_bank_count, uint8_t ram_bank_count) {
     if (rom_bank_count <= 32) {
         return 0;
     }
@@ -115,9 +76,9 @@ uint8_t zero_bank_number(uint8_t rom_bank_count, uint8_t ram_bank_count) {
     return 0;
 }
 
-uint8_t high_bank_number(uint8_t rom_bank_count, uint8_t ram_bank_count) {
+uint8_t high_bank_number(const controller_registers* controller, uint16_t rom_bank_count, uint8_t ram_bank_count) {
     // ROM bank number capped to the number of available banks
-    uint8_t base_bank_num = controller_state.rom_bank;
+    uint8_t base_bank_num = controller->rom_bank;
     if (base_bank_num > rom_bank_count) {
         base_bank_num = rom_bank_count;
     }
@@ -137,9 +98,9 @@ uint8_t high_bank_number(uint8_t rom_bank_count, uint8_t ram_bank_count) {
     return base_bank_num;
 }
 
-bool init_memory_controller(cart_header* cart) {
-    hardware_flags hardware = get_cart_hardware(cart);
-    memory_controller = get_controller_type(hardware);
+bool init_memory_controller(machine_state* machine) {
+    controller_registers reset = {0};
+    machine->controller = reset;
 
     return true;
 }
@@ -147,33 +108,44 @@ bool init_memory_controller(cart_header* cart) {
 uint8_t* mbc1_read(uint16_t addr, const machine_state* machine) {
     // Read from ROM bank 0
     if (range_mbc1_rom_0(addr)) {
-        if (controller_state.mode != 0) {
+        uint32_t offset = addr;
+        if (machine->controller.mode != 0) {
             uint8_t zero_bank_num = zero_bank_number(machine->rom_bank_count, machine->ram_bank_count);
-            addr += (ROM_BANK_SIZE * zero_bank_num);
+            offset += (ROM_BANK_SIZE * zero_bank_num);
         }
-        return &machine->cartridge_rom[addr];
+        return &machine->cartridge_rom[offset % machine->rom_size];
     }
     else if (range_mbc1_rom_high(addr)) {
         // Offset within the bank that the addr is pointing to
-        uint8_t high_bank_num = high_bank_number(machine->rom_bank_count, machine->ram_bank_count) + 1;
-        uint16_t offset = ROM_BANK_SIZE * high_bank_num + (addr - ROM_BANK_SIZE);
-        return &machine->cartridge_rom[offset];
+        uint8_t high_bank_num = high_bank_number(&machine->controller, machine->rom_bank_count, machine->ram_bank_count) + 1;
+        uint32_t offset = ROM_BANK_SIZE * high_bank_num + (addr - ROM_BANK_SIZE);
+        // Bank numbers past the end of the ROM wrap around, like on hardware
+        return &machine->cartridge_rom[offset % machine->rom_size];
     }
     else if (range_mbc1_ext_ram(addr)) {
-        // Trying to read from disabled RAM always returns 0xFF values.
-        if (!controller_state.ram_enabled) {
+        // Trying to read from disabled or missing RAM always returns 0xFF values.
+        if (!machine->controller.ram_enabled || machine->ram_bank_count == 0) {
             return (uint8_t*) &invalid_data;
         }
     
-        uint16_t offset = addr - MBC1_W_RANGE_EXT_RAM_LOW;
-        if (controller_state.mode == 1) {
-            offset += RAM_BANK_SIZE * controller_state.ram_bank;
+        uint32_t offset = addr - MBC1_W_RANGE_EXT_RAM_LOW;
+        if (machine->controller.mode == 1) {
+            offset += RAM_BANK_SIZE * machine->controller.ram_bank;
         }
-        return &machine->external_ram[offset];
+        return &machine->external_ram[offset % (RAM_BANK_SIZE * machine->ram_bank_count)];
     }
     return (uint8_t*) &invalid_data;
 }
 
+uint16_t controller_high_rom_bank(const machine_state* machine) {
+    switch (machine->memory_controller) {
+    case MBC1:
+        return high_bank_number(&machine->controller, machine->rom_bank_count, machine->ram_bank_count) + 1;
+    default:
+        return 1;
+    }
+}
+
 uint8_t* controller_read(uint16_t addr, const machine_state* machine) {
     switch (machine->memory_controller) {
     case MBC1:
@@ -185,50 +157,54 @@ uint8_t* controller_read(uint16_t addr, const machine_state* machine) {
     return &machine->console_memory[addr];
 }
 
-void write_mbc1_8(uint16_t addr, uint8_t value, const machine_state* machine) {
+void write_mbc1_8(uint16_t addr, uint8_t value, machine_state* machine) {
     if (range_mbc1_enable_ram(addr)) {
-        controller_state.ram_enabled = ((value | 0xF) == 0xA);
+        machine->controller.ram_enabled = ((value & 0xF) == 0xA);
     }
     else if (range_mbc1_rom_bank(addr)) {
         // Exclude 3 bits because this is a 5-bit field.
         // Stops us from writing a bank number larger than the number of
         // available banks.
         uint8_t bitmask = (machine->rom_bank_count - 1) & 0b00011111;
+        uint8_t previous_bank = machine->controller.rom_bank;
     
-        controller_state.rom_bank = value & bitmask;
-        if (controller_state.rom_bank == 0) {
-            controller_state.rom_bank = 1;
+        machine->controller.rom_bank = value & bitmask;
+        if (machine->controller.rom_bank == 0) {
+            machine->controller.rom_bank = 1;
         }
+        machine->stats.bank_switches += machine->controller.rom_bank != previous_bank;
     }
     else if (range_mbc1_ram_bank(addr)) {
+        uint8_t previous_bank = machine->controller.ram_bank;
         // Get lowest 2 bits of value
-        controller_state.ram_bank = value & 0b00000011;
+        machine->controller.ram_bank = value & 0b00000011;
+        machine->stats.bank_switches += machine->controller.ram_bank != previous_bank;
     }
     else if (range_mbc1_mode_sel(addr)) {
-        controller_state.mode = value & 0b00000001;
+        machine->controller.mode = value & 0b00000001;
     }
     else if (range_mbc1_ext_ram(addr)) {
-        // Early exit if RAM is locked.
-        if (!controller_state.ram_enabled) {
+        // Early exit if RAM is locked or the cart has none.
+        if (!machine->controller.ram_enabled || machine->ram_bank_count == 0) {
             return;
         }
 
         // Offset from RAM start
         uint32_t relative_address = addr - MBC1_W_RANGE_EXT_RAM_LOW;
 
-        if (machine->ram_bank_count <= 1) {
-            // The mod operator here stops an out of bounds write
-            relative_address %= RAM_BANK_SIZE;
-        }
         // If mode flag is 0, we just use the offset.
-        if (controller_state.mode == 1) {
-            relative_address += (RAM_BANK_SIZE * controller_state.ram_bank);
+        if (machine->controller.mode == 1) {
+            relative_address += (RAM_BANK_SIZE * machine->controller.ram_bank);
         }
+        // The mod operator here stops an out of bounds write when the bank
+        // number is higher than the number of banks
+        relative_address %= RAM_BANK_SIZE * machine->ram_bank_count;
         machine->external_ram[relative_address] = value;
+        machine->stats.sram_writes++;
     }
 }
 
-void controller_write_8_bit(uint16_t addr, uint8_t value, const machine_state* machine) {
+void controller_write_8_bit(uint16_t addr, uint8_t value, machine_state* machine) {
     switch (machine->memory_controller) {
         case MBC1:
             write_mbc1_8(addr, value, machine);
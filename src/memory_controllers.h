@@ -6,7 +6,8 @@
 #include "machine.h"
 
 uint8_t* controller_read(uint16_t addr, const machine_state* machine);
-void controller_write_8_bit(uint16_t addr, uint8_t value, const machine_state* machine);
-controller_type get_controller_type(hardware_flags flags);
-bool init_memory_controller(cart_header* cart);
+void controller_write_8_bit(uint16_t addr, uint8_t value, machine_state* machine);
+bool init_memory_controller(machine_state* machine);
+// Returns the ROM bank currently mapped at 0x4000-0x7FFF.
+uint16_t controller_high_rom_bank(const machine_state* machine);
 
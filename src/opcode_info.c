@@ -0,0 +1,256 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "opcode_info.h"
+#include "registers.h"
+
+// Lets the flag and condition groups below pass through several macros as a
+// single argument
+#define UNPACK(...) __VA_ARGS__
+
+// Flag effects as (set, reset, changed)
+#define FLAGS_NONE (0, 0, 0)
+#define FLAGS_INC (0, FLAG_SUBTRACTION, FLAG_ZERO | FLAG_HALF_CARRY)
+#define FLAGS_DEC (FLAG_SUBTRACTION, 0, FLAG_ZERO | FLAG_HALF_CARRY)
+#define FLAGS_ADD (0, FLAG_SUBTRACTION, FLAG_ZERO | FLAG_HALF_CARRY | FLAG_CARRY)
+#define FLAGS_SUB (FLAG_SUBTRACTION, 0, FLAG_ZERO | FLAG_HALF_CARRY | FLAG_CARRY)
+#define FLAGS_AND (FLAG_HALF_CARRY, FLAG_SUBTRACTION | FLAG_CARRY, FLAG_ZERO)
+#define FLAGS_OR (0, FLAG_SUBTRACTION | FLAG_HALF_CARRY | FLAG_CARRY, FLAG_ZERO)
+#define FLAGS_ADD16 (0, FLAG_SUBTRACTION, FLAG_HALF_CARRY | FLAG_CARRY)
+#define FLAGS_ADD_SP (0, FLAG_ZERO | FLAG_SUBTRACTION, FLAG_HALF_CARRY | FLAG_CARRY)
+#define FLAGS_ROTATE_A (0, FLAG_ZERO | FLAG_SUBTRACTION | FLAG_HALF_CARRY, FLAG_CARRY)
+#define FLAGS_ROTATE (0, FLAG_SUBTRACTION | FLAG_HALF_CARRY, FLAG_ZERO | FLAG_CARRY)
+#define FLAGS_SWAP FLAGS_OR
+#define FLAGS_BIT (FLAG_HALF_CARRY, FLAG_SUBTRACTION, FLAG_ZERO)
+#define FLAGS_DAA (0, FLAG_HALF_CARRY, FLAG_ZERO | FLAG_CARRY)
+#define FLAGS_CPL (FLAG_SUBTRACTION | FLAG_HALF_CARRY, 0, 0)
+#define FLAGS_SCF (FLAG_CARRY, FLAG_SUBTRACTION | FLAG_HALF_CARRY, 0)
+#define FLAGS_CCF (0, FLAG_SUBTRACTION | FLAG_HALF_CARRY, FLAG_CARRY)
+#define FLAGS_ALL (0, 0, FLAG_ZERO | FLAG_SUBTRACTION | FLAG_HALF_CARRY | FLAG_CARRY)
+
+// Branch conditions as (mask, value)
+#define CONDITION_NZ (FLAG_ZERO, 0)
+#define CONDITION_Z (FLAG_ZERO, FLAG_ZERO)
+#define CONDITION_NC (FLAG_CARRY, 0)
+#define CONDITION_C (FLAG_CARRY, FLAG_CARRY)
+
+#define STACK_READ (MEMORY_STACK | MEMORY_READ)
+#define STACK_WRITE (MEMORY_STACK | MEMORY_WRITE)
+
+#define OP(name, length, cycles, flags, memory) \
+    {name, length, cycles, cycles, 0, 0, UNPACK flags, memory}
+#define BRANCH(name, length, cycles, taken, condition, memory) \
+    {name, length, cycles, taken, UNPACK condition, 0, 0, 0, memory}
+#define ILLEGAL \
+    {NULL, 1, 1, 1, 0, 0, 0, 0, 0, MEMORY_NONE}
+
+// Eight opcodes with the register operand in the low 3 bits, where (HL) is
+// the only one that touches memory
+#define REGISTER_ROW(prefix, length, cycles, hl_cycles, flags, hl_memory) \
+    OP(prefix "B", length, cycles, flags, MEMORY_NONE), \
+    OP(prefix "C", length, cycles, flags, MEMORY_NONE), \
+    OP(prefix "D", length, cycles, flags, MEMORY_NONE), \
+    OP(prefix "E", length, cycles, flags, MEMORY_NONE), \
+    OP(prefix "H", length, cycles, flags, MEMORY_NONE), \
+    OP(prefix "L", length, cycles, flags, MEMORY_NONE), \
+    OP(prefix "(HL)", length, hl_cycles, flags, hl_memory), \
+    OP(prefix "A", length, cycles, flags, MEMORY_NONE)
+
+#define LD_ROW(destination) REGISTER_ROW("LD " destination ", ", 1, 1, 2, FLAGS_NONE, MEMORY_READ)
+#define ALU_ROW(operation, flags) REGISTER_ROW(operation " A, ", 1, 1, 2, flags, MEMORY_READ)
+#define PREFIXED_ROW(operation, flags) REGISTER_ROW(operation " ", 2, 2, 4, flags, MEMORY_READ_WRITE)
+#define BIT_ROW(bit) REGISTER_ROW("BIT " #bit ", ", 2, 2, 3, FLAGS_BIT, MEMORY_READ)
+#define RES_ROW(bit) REGISTER_ROW("RES " #bit ", ", 2, 2, 4, FLAGS_NONE, MEMORY_READ_WRITE)
+#define SET_ROW(bit) REGISTER_ROW("SET " #bit ", ", 2, 2, 4, FLAGS_NONE, MEMORY_READ_WRITE)
+
+const opcode_info unprefixed_opcode_info[256] = {
+    [0x00] =
+    OP("NOP", 1, 1, FLAGS_NONE, MEMORY_NONE),
+    OP("LD BC, u16", 3, 3, FLAGS_NONE, MEMORY_NONE),
+    OP("LD (BC), A", 1, 2, FLAGS_NONE, MEMORY_WRITE),
+    OP("INC BC", 1, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("INC B", 1, 1, FLAGS_INC, MEMORY_NONE),
+    OP("DEC B", 1, 1, FLAGS_DEC, MEMORY_NONE),
+    OP("LD B, u8", 2, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("RLCA", 1, 1, FLAGS_ROTATE_A, MEMORY_NONE),
+    OP("LD (u16), SP", 3, 5, FLAGS_NONE, MEMORY_WRITE),
+    OP("ADD HL, BC", 1, 2, FLAGS_ADD16, MEMORY_NONE),
+    OP("LD A, (BC)", 1, 2, FLAGS_NONE, MEMORY_READ),
+    OP("DEC BC", 1, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("INC C", 1, 1, FLAGS_INC, MEMORY_NONE),
+    OP("DEC C", 1, 1, FLAGS_DEC, MEMORY_NONE),
+    OP("LD C, u8", 2, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("RRCA", 1, 1, FLAGS_ROTATE_A, MEMORY_NONE),
+
+    [0x10] =
+    OP("STOP", 2, 1, FLAGS_NONE, MEMORY_NONE),
+    OP("LD DE, u16", 3, 3, FLAGS_NONE, MEMORY_NONE),
+    OP("LD (DE), A", 1, 2, FLAGS_NONE, MEMORY_WRITE),
+    OP("INC DE", 1, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("INC D", 1, 1, FLAGS_INC, MEMORY_NONE),
+    OP("DEC D", 1, 1, FLAGS_DEC, MEMORY_NONE),
+    OP("LD D, u8", 2, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("RLA", 1, 1, FLAGS_ROTATE_A, MEMORY_NONE),
+    OP("JR i8", 2, 3, FLAGS_NONE, MEMORY_NONE),
+    OP("ADD HL, DE", 1, 2, FLAGS_ADD16, MEMORY_NONE),
+    OP("LD A, (DE)", 1, 2, FLAGS_NONE, MEMORY_READ),
+    OP("DEC DE", 1, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("INC E", 1, 1, FLAGS_INC, MEMORY_NONE),
+    OP("DEC E", 1, 1, FLAGS_DEC, MEMORY_NONE),
+    OP("LD E, u8", 2, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("RRA", 1, 1, FLAGS_ROTATE_A, MEMORY_NONE),
+
+    [0x20] =
+    BRANCH("JR NZ, i8", 2, 2, 3, CONDITION_NZ, MEMORY_NONE),
+    OP("LD HL, u16", 3, 3, FLAGS_NONE, MEMORY_NONE),
+    OP("LD (HL+), A", 1, 2, FLAGS_NONE, MEMORY_WRITE),
+    OP("INC HL", 1, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("INC H", 1, 1, FLAGS_INC, MEMORY_NONE),
+    OP("DEC H", 1, 1, FLAGS_DEC, MEMORY_NONE),
+    OP("LD H, u8", 2, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("DAA", 1, 1, FLAGS_DAA, MEMORY_NONE),
+    BRANCH("JR Z, i8", 2, 2, 3, CONDITION_Z, MEMORY_NONE),
+    OP("ADD HL, HL", 1, 2, FLAGS_ADD16, MEMORY_NONE),
+    OP("LD A, (HL+)", 1, 2, FLAGS_NONE, MEMORY_READ),
+    OP("DEC HL", 1, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("INC L", 1, 1, FLAGS_INC, MEMORY_NONE),
+    OP("DEC L", 1, 1, FLAGS_DEC, MEMORY_NONE),
+    OP("LD L, u8", 2, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("CPL", 1, 1, FLAGS_CPL, MEMORY_NONE),
+
+    [0x30] =
+    BRANCH("JR NC, i8", 2, 2, 3, CONDITION_NC, MEMORY_NONE),
+    OP("LD SP, u16", 3, 3, FLAGS_NONE, MEMORY_NONE),
+    OP("LD (HL-), A", 1, 2, FLAGS_NONE, MEMORY_WRITE),
+    OP("INC SP", 1, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("INC (HL)", 1, 3, FLAGS_INC, MEMORY_READ_WRITE),
+    OP("DEC (HL)", 1, 3, FLAGS_DEC, MEMORY_READ_WRITE),
+    OP("LD (HL), u8", 2, 3, FLAGS_NONE, MEMORY_WRITE),
+    OP("SCF", 1, 1, FLAGS_SCF, MEMORY_NONE),
+    BRANCH("JR C, i8", 2, 2, 3, CONDITION_C, MEMORY_NONE),
+    OP("ADD HL, SP", 1, 2, FLAGS_ADD16, MEMORY_NONE),
+    OP("LD A, (HL-)", 1, 2, FLAGS_NONE, MEMORY_READ),
+    OP("DEC SP", 1, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("INC A", 1, 1, FLAGS_INC, MEMORY_NONE),
+    OP("DEC A", 1, 1, FLAGS_DEC, MEMORY_NONE),
+    OP("LD A, u8", 2, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("CCF", 1, 1, FLAGS_CCF, MEMORY_NONE),
+
+    [0x40] = LD_ROW("B"),
+    [0x48] = LD_ROW("C"),
+    [0x50] = LD_ROW("D"),
+    [0x58] = LD_ROW("E"),
+    [0x60] = LD_ROW("H"),
+    [0x68] = LD_ROW("L"),
+    // LD (HL), (HL) would be here, it's HALT instead
+    [0x70] =
+    OP("LD (HL), B", 1, 2, FLAGS_NONE, MEMORY_WRITE),
+    OP("LD (HL), C", 1, 2, FLAGS_NONE, MEMORY_WRITE),
+    OP("LD (HL), D", 1, 2, FLAGS_NONE, MEMORY_WRITE),
+    OP("LD (HL), E", 1, 2, FLAGS_NONE, MEMORY_WRITE),
+    OP("LD (HL), H", 1, 2, FLAGS_NONE, MEMORY_WRITE),
+    OP("LD (HL), L", 1, 2, FLAGS_NONE, MEMORY_WRITE),
+    OP("HALT", 1, 1, FLAGS_NONE, MEMORY_NONE),
+    OP("LD (HL), A", 1, 2, FLAGS_NONE, MEMORY_WRITE),
+    [0x78] = LD_ROW("A"),
+
+    [0x80] = ALU_ROW("ADD", FLAGS_ADD),
+    [0x88] = ALU_ROW("ADC", FLAGS_ADD),
+    [0x90] = ALU_ROW("SUB", FLAGS_SUB),
+    [0x98] = ALU_ROW("SBC", FLAGS_SUB),
+    [0xA0] = ALU_ROW("AND", FLAGS_AND),
+    [0xA8] = ALU_ROW("XOR", FLAGS_OR),
+    [0xB0] = ALU_ROW("OR", FLAGS_OR),
+    [0xB8] = ALU_ROW("CP", FLAGS_SUB),
+
+    [0xC0] =
+    BRANCH("RET NZ", 1, 2, 5, CONDITION_NZ, STACK_READ),
+    OP("POP BC", 1, 3, FLAGS_NONE, STACK_READ),
+    BRANCH("JP NZ, u16", 3, 3, 4, CONDITION_NZ, MEMORY_NONE),
+    OP("JP u16", 3, 4, FLAGS_NONE, MEMORY_NONE),
+    BRANCH("CALL NZ, u16", 3, 3, 6, CONDITION_NZ, STACK_WRITE),
+    OP("PUSH BC", 1, 4, FLAGS_NONE, STACK_WRITE),
+    OP("ADD A, u8", 2, 2, FLAGS_ADD, MEMORY_NONE),
+    OP("RST 00h", 1, 4, FLAGS_NONE, STACK_WRITE),
+    BRANCH("RET Z", 1, 2, 5, CONDITION_Z, STACK_READ),
+    OP("RET", 1, 4, FLAGS_NONE, STACK_READ),
+    BRANCH("JP Z, u16", 3, 3, 4, CONDITION_Z, MEMORY_NONE),
+    // Only the prefix fetch, prefixed_opcode_info has the whole instruction
+    OP("PREFIX CB", 1, 1, FLAGS_NONE, MEMORY_NONE),
+    BRANCH("CALL Z, u16", 3, 3, 6, CONDITION_Z, STACK_WRITE),
+    OP("CALL u16", 3, 6, FLAGS_NONE, STACK_WRITE),
+    OP("ADC A, u8", 2, 2, FLAGS_ADD, MEMORY_NONE),
+    OP("RST 08h", 1, 4, FLAGS_NONE, STACK_WRITE),
+
+    [0xD0] =
+    BRANCH("RET NC", 1, 2, 5, CONDITION_NC, STACK_READ),
+    OP("POP DE", 1, 3, FLAGS_NONE, STACK_READ),
+    BRANCH("JP NC, u16", 3, 3, 4, CONDITION_NC, MEMORY_NONE),
+    ILLEGAL,
+    BRANCH("CALL NC, u16", 3, 3, 6, CONDITION_NC, STACK_WRITE),
+    OP("PUSH DE", 1, 4, FLAGS_NONE, STACK_WRITE),
+    OP("SUB A, u8", 2, 2, FLAGS_SUB, MEMORY_NONE),
+    OP("RST 10h", 1, 4, FLAGS_NONE, STACK_WRITE),
+    BRANCH("RET C", 1, 2, 5, CONDITION_C, STACK_READ),
+    OP("RETI", 1, 4, FLAGS_NONE, STACK_READ),
+    BRANCH("JP C, u16", 3, 3, 4, CONDITION_C, MEMORY_NONE),
+    ILLEGAL,
+    BRANCH("CALL C, u16", 3, 3, 6, CONDITION_C, STACK_WRITE),
+    ILLEGAL,
+    OP("SBC A, u8", 2, 2, FLAGS_SUB, MEMORY_NONE),
+    OP("RST 18h", 1, 4, FLAGS_NONE, STACK_WRITE),
+
+    [0xE0] =
+    OP("LD (FF00+u8), A", 2, 3, FLAGS_NONE, MEMORY_WRITE | MEMORY_HIGH),
+    OP("POP HL", 1, 3, FLAGS_NONE, STACK_READ),
+    OP("LD (FF00+C), A", 1, 2, FLAGS_NONE, MEMORY_WRITE | MEMORY_HIGH),
+    ILLEGAL,
+    ILLEGAL,
+    OP("PUSH HL", 1, 4, FLAGS_NONE, STACK_WRITE),
+    OP("AND A, u8", 2, 2, FLAGS_AND, MEMORY_NONE),
+    OP("RST 20h", 1, 4, FLAGS_NONE, STACK_WRITE),
+    OP("ADD SP, i8", 2, 4, FLAGS_ADD_SP, MEMORY_NONE),
+    OP("JP HL", 1, 1, FLAGS_NONE, MEMORY_NONE),
+    OP("LD (u16), A", 3, 4, FLAGS_NONE, MEMORY_WRITE),
+    ILLEGAL,
+    ILLEGAL,
+    ILLEGAL,
+    OP("XOR A, u8", 2, 2, FLAGS_OR, MEMORY_NONE),
+    OP("RST 28h", 1, 4, FLAGS_NONE, STACK_WRITE),
+
+    [0xF0] =
+    OP("LD A, (FF00+u8)", 2, 3, FLAGS_NONE, MEMORY_READ | MEMORY_HIGH),
+    OP("POP AF", 1, 3, FLAGS_ALL, STACK_READ),
+    OP("LD A, (FF00+C)", 1, 2, FLAGS_NONE, MEMORY_READ | MEMORY_HIGH),
+    OP("DI", 1, 1, FLAGS_NONE, MEMORY_NONE),
+    ILLEGAL,
+    OP("PUSH AF", 1, 4, FLAGS_NONE, STACK_WRITE),
+    OP("OR A, u8", 2, 2, FLAGS_OR, MEMORY_NONE),
+    OP("RST 30h", 1, 4, FLAGS_NONE, STACK_WRITE),
+    OP("LD HL, SP+i8", 2, 3, FLAGS_ADD_SP, MEMORY_NONE),
+    OP("LD SP, HL", 1, 2, FLAGS_NONE, MEMORY_NONE),
+    OP("LD A, (u16)", 3, 4, FLAGS_NONE, MEMORY_READ),
+    OP("EI", 1, 1, FLAGS_NONE, MEMORY_NONE),
+    ILLEGAL,
+    ILLEGAL,
+    OP("CP A, u8", 2, 2, FLAGS_SUB, MEMORY_NONE),
+    OP("RST 38h", 1, 4, FLAGS_NONE, STACK_WRITE)
+};
+
+const opcode_info prefixed_opcode_info[256] = {
+    [0x00] = PREFIXED_ROW("RLC", FLAGS_ROTATE),
+    [0x08] = PREFIXED_ROW("RRC", FLAGS_ROTATE),
+    [0x10] = PREFIXED_ROW("RL", FLAGS_ROTATE),
+    [0x18] = PREFIXED_ROW("RR", FLAGS_ROTATE),
+    [0x20] = PREFIXED_ROW("SLA", FLAGS_ROTATE),
+    [0x28] = PREFIXED_ROW("SRA", FLAGS_ROTATE),
+    [0x30] = PREFIXED_ROW("SWAP", FLAGS_SWAP),
+    [0x38] = PREFIXED_ROW("SRL", FLAGS_ROTATE),
+
+    [0x40] = BIT_ROW(0), BIT_ROW(1), BIT_ROW(2), BIT_ROW(3),
+    BIT_ROW(4), BIT_ROW(5), BIT_ROW(6), BIT_ROW(7),
+    [0x80] = RES_ROW(0), RES_ROW(1), RES_ROW(2), RES_ROW(3),
+    RES_ROW(4), RES_ROW(5), RES_ROW(6), RES_ROW(7),
+    [0xC0] = SET_ROW(0), SET_ROW(1), SET_ROW(2), SET_ROW(3),
+    SET_ROW(4), SET_ROW(5), SET_ROW(6), SET_ROW(7)
+};
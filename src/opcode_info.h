@@ -0,0 +1,46 @@
+// Static metadata for every opcode in both opcode maps, shared by everything
+// that needs to know about an instruction without executing it: timing in the
+// interpreter, lengths and mnemonics for disassembly, and memory access kinds
+// for profiling. The tables are built from macros in opcode_info.c, so the
+// regular parts of the maps are written once per row.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Memory accesses an instruction makes besides fetching itself
+typedef enum {
+    MEMORY_NONE = 0,
+    MEMORY_READ = 0b0001,
+    MEMORY_WRITE = 0b0010,
+    MEMORY_READ_WRITE = MEMORY_READ | MEMORY_WRITE,
+    MEMORY_STACK = 0b0100, // The access goes through SP
+    MEMORY_HIGH = 0b1000 // The access is to the 0xFF00 page
+}opcode_memory;
+
+typedef struct {
+    // Operands are written as u8, i8 and u16, for the disassembler to fill
+    // in. NULL for opcodes the CPU doesn't have.
+    const char* mnemonic;
+    uint8_t length; // Bytes including operands and the 0xCB prefix
+    uint8_t cycles; // M-cycles, with the branch not taken for conditional instructions
+    uint8_t taken_cycles; // M-cycles with the branch taken, the same as cycles when there's no branch
+    // Branch condition as a test on F, taken when (F & mask) == value. Both
+    // are 0 for unconditional instructions.
+    uint8_t condition_mask;
+    uint8_t condition_value;
+    // Effect on each flag_mask bit, bits in none of these are unchanged
+    uint8_t flags_set;
+    uint8_t flags_reset;
+    uint8_t flags_changed; // Depend on the result
+    uint8_t memory; // opcode_memory bits
+}opcode_info;
+
+extern const opcode_info unprefixed_opcode_info[256];
+extern const opcode_info prefixed_opcode_info[256]; // Opcodes after 0xCB
+
+// M-cycles an instruction takes given the current flags, without branching
+static inline uint8_t opcode_execution_time(const opcode_info* info, uint8_t flags) {
+    bool taken = (flags & info->condition_mask) == info->condition_value;
+    return info->cycles + taken * (info->taken_cycles - info->cycles);
+}
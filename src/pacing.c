@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+
+#include "logging.h"
+
+#include "pacing.h"
+#include "machine.h"
+
+#define NS_PER_SECOND 1000000000LL
+
+static int64_t now_ns(void) {
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+void pacer_start(pacer* pacer, double speed) {
+    pacer->speed = speed;
+    clock_gettime(CLOCK_MONOTONIC, &pacer->start);
+    pacer->base_ns = pacer->start.tv_sec * NS_PER_SECOND + pacer->start.tv_nsec;
+    pacer->base_cycles = 0;
+    pacer->slept_ns = 0;
+    pacer->resyncs = 0;
+}
+
+void pacer_wait(pacer* pacer, uint64_t clock) {
+    double seconds = (double) (clock - pacer->base_cycles) / (MACHINE_CYCLES_PER_SECOND * pacer->speed);
+    int64_t deadline = pacer->base_ns + (int64_t) (seconds * NS_PER_SECOND);
+    int64_t now = now_ns();
+
+    if (now - deadline > PACING_MAX_LAG_NS) {
+        // Too slow to keep up, carry on at the requested speed from here
+        pacer->base_ns = now;
+        pacer->base_cycles = clock;
+        pacer->resyncs++;
+        return;
+    }
+    if (deadline <= now) {
+        return;
+    }
+
+    struct timespec target = {
+        .tv_sec = deadline / NS_PER_SECOND,
+        .tv_nsec = deadline % NS_PER_SECOND
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL) == EINTR);
+    pacer->slept_ns += deadline - now;
+}
+
+static double elapsed_seconds(const pacer* pacer) {
+    struct timespec end = {0};
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - pacer->start.tv_sec) + (end.tv_nsec - pacer->start.tv_nsec) / 1e9;
+}
+
+double pacer_busy_seconds(const pacer* pacer) {
+    return elapsed_seconds(pacer) - (double) pacer->slept_ns / NS_PER_SECOND;
+}
+
+void pacer_report(const pacer* pacer, uint64_t clock) {
+    double wall = elapsed_seconds(pacer);
+    double emulated = (double) clock / MACHINE_CYCLES_PER_SECOND;
+    double frames = (double) clock / MACHINE_CYCLES_PER_FRAME;
+    if (wall <= 0) {
+        return;
+    }
+
+    if (pacer->speed == 0) {
+        LOG_MSG(info, "Uncapped: %.2fs emulated in %.3fs, %.2fx real time (%.1f fps)\n", emulated, wall, emulated / wall, frames / wall);
+    }
+    else {
+        LOG_MSG(info, "Target %.2fx: %.2fs emulated in %.3fs, %.3fx real time (%.2f fps), %.0f%% of the time asleep, %llu resyncs\n",
+                pacer->speed, emulated, wall, emulated / wall, frames / wall, 100.0 * pacer->slept_ns / (wall * 1e9), (unsigned long long) pacer->resyncs);
+    }
+}
@@ -0,0 +1,38 @@
+// Keeps emulation in step with real time. The machine runs flat out between
+// checks and then sleeps until the wall clock reaches the emulated clock, with
+// absolute deadlines so sleep overshoot doesn't add up over a long run.
+// Uncapped runs never call into this except for the final report.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+// How far behind the pacer can fall before it stops trying to catch up, so a
+// stall isn't followed by a burst of frames at full speed
+#define PACING_MAX_LAG_NS 100000000
+
+typedef struct {
+    double speed; // Multiple of real time, 0 for uncapped
+    struct timespec start; // Wall clock at the start of the run
+    int64_t base_ns; // Wall clock the current deadlines count from
+    uint64_t base_cycles; // Machine clock at base_ns
+    int64_t slept_ns; // Total time spent sleeping
+    uint64_t resyncs; // Times the pacer fell too far behind
+}pacer;
+
+/// Starts timing a run.
+/// \param speed 1 for real time, 2 for double speed and so on, 0 for uncapped
+void pacer_start(pacer* pacer, double speed);
+
+/// Sleeps until the wall clock catches up to the machine clock. Only useful
+/// when the speed isn't 0.
+/// \param clock Machine clock in M-cycles
+void pacer_wait(pacer* pacer, uint64_t clock);
+
+// Wall clock seconds since the start that weren't spent sleeping.
+double pacer_busy_seconds(const pacer* pacer);
+
+/// Logs the measured speed.
+/// \param clock Machine clock in M-cycles at the end of the run
+void pacer_report(const pacer* pacer, uint64_t clock);
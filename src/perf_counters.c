@@ -0,0 +1,164 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "logging.h"
+
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+}events[PERF_COUNTER_COUNT] = {
+    [PERF_TASK_CLOCK] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    [PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [PERF_CACHE_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}
+};
+
+static int open_event(perf_counter counter, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[counter].type;
+    attr.config = events[counter].config;
+    attr.disabled = (group == -1); // The group starts when its leader is enabled
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// Reads every counter in the group, scaled up if the kernel had to multiplex
+static bool read_sample(const perf_counters* perf, perf_sample* sample) {
+    uint64_t data[3 + PERF_COUNTER_COUNT] = {0}; // nr, time enabled, time running, values
+    ssize_t expected = (3 + __builtin_popcount(perf->available)) * sizeof(uint64_t);
+    if (read(perf->fds[PERF_TASK_CLOCK], data, sizeof(data)) < expected) {
+        return false;
+    }
+    double scale = (data[2] != 0 && data[2] < data[1]) ? (double) data[1] / data[2] : 1.0;
+    uint8_t index = 0;
+    for (uint8_t counter = 0; counter < PERF_COUNTER_COUNT; counter++) {
+        sample->values[counter] = 0;
+        if (perf_counter_available(perf, counter)) {
+            sample->values[counter] = (uint64_t) (data[3 + index++] * scale);
+        }
+    }
+    return true;
+}
+
+bool perf_counters_open(perf_counters* perf) {
+    memset(perf, 0, sizeof(*perf));
+    for (uint8_t counter = 0; counter < PERF_COUNTER_COUNT; counter++) {
+        perf->fds[counter] = -1;
+    }
+    perf->fds[PERF_TASK_CLOCK] = open_event(PERF_TASK_CLOCK, -1);
+    if (perf->fds[PERF_TASK_CLOCK] == -1) {
+        LOG_MSG(warning, "perf_event_open failed (%s), no host counters\n", strerror(errno));
+        return false;
+    }
+    perf->available = 1 << PERF_TASK_CLOCK;
+    for (uint8_t counter = PERF_TASK_CLOCK + 1; counter < PERF_COUNTER_COUNT; counter++) {
+        perf->fds[counter] = open_event(counter, perf->fds[PERF_TASK_CLOCK]);
+        if (perf->fds[counter] != -1) {
+            perf->available |= 1 << counter;
+        }
+    }
+    ioctl(perf->fds[PERF_TASK_CLOCK], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    read_sample(perf, &perf->last);
+    return true;
+}
+
+void perf_counters_close(perf_counters* perf) {
+    // Members go before the leader
+    for (int8_t counter = PERF_COUNTER_COUNT - 1; counter >= 0; counter--) {
+        if (perf->fds[counter] != -1) {
+            close(perf->fds[counter]);
+            perf->fds[counter] = -1;
+        }
+    }
+}
+
+void perf_counters_frame(perf_counters* perf) {
+    perf_sample now = {0};
+    if (perf->fds[PERF_TASK_CLOCK] == -1 || !read_sample(perf, &now)) {
+        return;
+    }
+    for (uint8_t counter = 0; counter < PERF_COUNTER_COUNT; counter++) {
+        // Scaled counts are estimates while counters are multiplexed, so they
+        // can go backwards
+        uint64_t last = perf->last.values[counter];
+        uint64_t delta = now.values[counter] > last ? now.values[counter] - last : 0;
+        perf->total.values[counter] += delta;
+        if (delta > perf->worst.values[counter]) {
+            perf->worst.values[counter] = delta;
+        }
+    }
+    perf->last = now;
+    perf->frames++;
+}
+
+#else
+
+bool perf_counters_open(perf_counters* perf) {
+    memset(perf, 0, sizeof(*perf));
+    for (uint8_t counter = 0; counter < PERF_COUNTER_COUNT; counter++) {
+        perf->fds[counter] = -1;
+    }
+    LOG_MSG(warning, "Host counters need Linux perf_event_open\n");
+    return false;
+}
+
+void perf_counters_close(perf_counters* perf) {
+    (void) perf;
+}
+
+void perf_counters_frame(perf_counters* perf) {
+    (void) perf;
+}
+
+#endif
+
+bool perf_counter_available(const perf_counters* perf, perf_counter counter) {
+    return perf->available & (1 << counter);
+}
+
+static const char* counter_names[PERF_COUNTER_COUNT] = {
+    [PERF_TASK_CLOCK] = "task-clock (ns)",
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_BRANCH_MISSES] = "branch-misses",
+    [PERF_CACHE_MISSES] = "cache-misses"
+};
+
+void perf_counters_report(const perf_counters* perf, const char* label, uint64_t guest_instructions) {
+    if (perf->frames == 0) {
+        return;
+    }
+    LOG_MSG(info, "Host counters for %s over %llu frames and %llu guest instructions:\n",
+            label, (unsigned long long) perf->frames, (unsigned long long) guest_instructions);
+    LOG_MSG(info, "  %-16s %16s %12s %12s %12s\n", "counter", "total", "per frame", "worst frame", "per instr");
+    for (uint8_t counter = 0; counter < PERF_COUNTER_COUNT; counter++) {
+        if (!perf_counter_available(perf, counter)) {
+            LOG_MSG(info, "  %-16s %16s\n", counter_names[counter], "unavailable");
+            continue;
+        }
+        uint64_t total = perf->total.values[counter];
+        LOG_MSG(info, "  %-16s %16llu %12.0f %12llu %12.3f\n", counter_names[counter], (unsigned long long) total,
+                (double) total / perf->frames, (unsigned long long) perf->worst.values[counter],
+                guest_instructions != 0 ? (double) total / guest_instructions : 0.0);
+    }
+    if (perf_counter_available(perf, PERF_CYCLES) && perf_counter_available(perf, PERF_INSTRUCTIONS) &&
+        perf->total.values[PERF_CYCLES] != 0) {
+        LOG_MSG(info, "  %.2f host instructions per cycle\n",
+                (double) perf->total.values[PERF_INSTRUCTIONS] / perf->total.values[PERF_CYCLES]);
+    }
+}
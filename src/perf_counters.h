@@ -0,0 +1,51 @@
+// Host hardware counters around the emulator's run loops, read with Linux
+// perf_event_open. The counters run as one group, so a single read gets all
+// of them at the same instant, and each frame boundary is one read() call.
+// Deltas are attributed to the guest frame they happened in.
+//
+// Only the process's own user space code is counted, which perf allows
+// unprivileged with the default perf_event_paranoid. Counters the host
+// doesn't have, like hardware events inside most VMs, are left out and
+// reported as unavailable. Task clock always works and anchors the group.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    PERF_TASK_CLOCK, // Nanoseconds on the CPU
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_CACHE_MISSES, // Last level cache
+    PERF_COUNTER_COUNT
+}perf_counter;
+
+typedef struct {
+    uint64_t values[PERF_COUNTER_COUNT];
+}perf_sample;
+
+typedef struct {
+    int fds[PERF_COUNTER_COUNT]; // -1 for counters that couldn't be opened
+    uint8_t available; // Bit per counter the host could count, kept after closing
+    perf_sample last; // Reading at the previous frame boundary
+    perf_sample total;
+    perf_sample worst; // Largest per frame delta of each counter
+    uint64_t frames;
+}perf_counters;
+
+/// Opens and starts the counters for the calling thread.
+/// \return false if perf_event_open isn't usable at all
+bool perf_counters_open(perf_counters* perf);
+void perf_counters_close(perf_counters* perf);
+
+// Ends a frame, attributing everything since the last boundary to it.
+void perf_counters_frame(perf_counters* perf);
+
+// Whether the host could count this.
+bool perf_counter_available(const perf_counters* perf, perf_counter counter);
+
+/// Logs totals, per frame averages and worst frames.
+/// \param label What was measured, like the core that ran
+/// \param guest_instructions Guest instructions retired, for per instruction costs
+void perf_counters_report(const perf_counters* perf, const char* label, uint64_t guest_instructions);
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+
+#include "png.h"
+#include "hash.h"
+
+// Largest stored deflate block
+#define DEFLATE_STORED_MAX 0xFFFF
+
+static void put_u32_be(uint8_t* dst, uint32_t value) {
+    dst[0] = value >> 24;
+    dst[1] = value >> 16;
+    dst[2] = value >> 8;
+    dst[3] = value;
+}
+
+static void write_chunk(FILE* file, const char* type, const uint8_t* data, uint32_t size) {
+    uint8_t length[4];
+    put_u32_be(length, size);
+    fwrite(length, 1, sizeof(length), file);
+    fwrite(type, 1, 4, file);
+    if (size != 0) {
+        fwrite(data, 1, size, file);
+    }
+    // The CRC covers the type and the data
+    uint8_t crc[4];
+    uint32_t value = crc32(0, (const uint8_t*) type, 4);
+    put_u32_be(crc, crc32(value, data, size));
+    fwrite(crc, 1, sizeof(crc), file);
+}
+
+static uint32_t adler32(const uint8_t* data, size_t size) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (size_t i = 0; i < size; i++) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+bool png_write_gray(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height) {
+    // Every row starts with filter type 0 (none)
+    size_t raw_size = (size_t) (width + 1) * height;
+    size_t block_count = raw_size / DEFLATE_STORED_MAX + 1;
+    // zlib header, 5 bytes per block header, data, Adler-32
+    size_t zlib_size = 2 + block_count * 5 + raw_size + 4;
+    uint8_t* raw = malloc(raw_size);
+    uint8_t* zlib = malloc(zlib_size);
+    if (raw == NULL || zlib == NULL) {
+        free(raw);
+        free(zlib);
+        return false;
+    }
+    for (uint32_t y = 0; y < height; y++) {
+        raw[y * (width + 1)] = 0;
+        memcpy(raw + y * (width + 1) + 1, pixels + y * width, width);
+    }
+
+    uint8_t* out = zlib;
+    *out++ = 0x78; // Deflate with a 32K window
+    *out++ = 0x01; // No dictionary, check bits
+    size_t offset = 0;
+    for (size_t block = 0; block < block_count; block++) {
+        uint16_t length = (raw_size - offset) < DEFLATE_STORED_MAX ? raw_size - offset : DEFLATE_STORED_MAX;
+        *out++ = (block == block_count - 1) ? 1 : 0; // BFINAL, BTYPE 00 (stored)
+        *out++ = length & 0xFF;
+        *out++ = length >> 8;
+        *out++ = ~length & 0xFF;
+        *out++ = (~length >> 8) & 0xFF;
+        memcpy(out, raw + offset, length);
+        out += length;
+        offset += length;
+    }
+    put_u32_be(out, adler32(raw, raw_size));
+    out += 4;
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        LOG_MSG(error, "Failed to create %s\n", path);
+        free(raw);
+        free(zlib);
+        return false;
+    }
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, sizeof(signature), file);
+
+    uint8_t header[13] = {0};
+    put_u32_be(header, width);
+    put_u32_be(header + 4, height);
+    header[8] = 8; // Bit depth
+    header[9] = 0; // Grayscale
+    write_chunk(file, "IHDR", header, sizeof(header));
+    write_chunk(file, "IDAT", zlib, out - zlib);
+    write_chunk(file, "IEND", NULL, 0);
+    bool ok = (ferror(file) == 0);
+    fclose(file);
+
+    free(raw);
+    free(zlib);
+    return ok;
+}
+
+bool png_write_shades(const char* path, const uint8_t* shades, uint32_t width, uint32_t height) {
+    static const uint8_t gray[4] = {0xFF, 0xAA, 0x55, 0x00};
+    size_t size = (size_t) width * height;
+    uint8_t* pixels = malloc(size);
+    if (pixels == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < size; i++) {
+        pixels[i] = gray[shades[i] & 0x3];
+    }
+    bool ok = png_write_gray(path, pixels, width, height);
+    free(pixels);
+    return ok;
+}
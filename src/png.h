@@ -0,0 +1,14 @@
+// Minimal PNG writer with no dependencies. Image data is stored with
+// uncompressed deflate blocks, which every decoder supports.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Writes an 8-bit grayscale PNG.
+/// \param pixels width * height bytes, row by row
+/// \return false if the file couldn't be written
+bool png_write_gray(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height);
+
+/// Writes a DMG framebuffer of shades 0-3 as a grayscale PNG, with 0 as white.
+bool png_write_shades(const char* path, const uint8_t* shades, uint32_t width, uint32_t height);
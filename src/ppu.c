@@ -0,0 +1,307 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "ppu.h"
+#include "registers.h"
+
+typedef enum {
+    LCDC_BG_ENABLE = 0b00000001,
+    LCDC_SPRITES = 0b00000010,
+    LCDC_TALL_SPRITES = 0b00000100,
+    LCDC_BG_MAP = 0b00001000,
+    LCDC_TILE_DATA = 0b00010000,
+    LCDC_WINDOW = 0b00100000,
+    LCDC_WINDOW_MAP = 0b01000000,
+    LCDC_ENABLE = 0b10000000
+}lcdc_bits;
+
+typedef enum {
+    STAT_MODE = 0b00000011,
+    STAT_COINCIDENCE = 0b00000100,
+    STAT_HBLANK_INTERRUPT = 0b00001000,
+    STAT_VBLANK_INTERRUPT = 0b00010000,
+    STAT_OAM_INTERRUPT = 0b00100000,
+    STAT_LYC_INTERRUPT = 0b01000000,
+    STAT_WRITABLE = 0b01111000,
+    STAT_UNUSED = 0b10000000
+}stat_bits;
+
+typedef enum {
+    SPRITE_ATTRIBUTES = 0xFE00,
+    SPRITE_COUNT = 40,
+    SPRITES_PER_LINE = 10,
+    SPRITE_BEHIND_BG = 0b10000000,
+    SPRITE_FLIP_Y = 0b01000000,
+    SPRITE_FLIP_X = 0b00100000,
+    SPRITE_PALETTE = 0b00010000
+}sprite_constants;
+
+static void update_stat(ppu_state* ppu, uint8_t* memory) {
+    bool enabled = memory[LCDC] & LCDC_ENABLE;
+    bool coincidence = (ppu->line == memory[LYC]);
+    uint8_t stat = (memory[STAT] & STAT_WRITABLE) | STAT_UNUSED | ppu->mode;
+    if (coincidence) {
+        stat |= STAT_COINCIDENCE;
+    }
+    memory[STAT] = stat;
+    memory[LY] = ppu->line;
+
+    // Every enabled source is ORed into one line, the interrupt is requested
+    // when it goes high
+    bool line = enabled && (
+            (coincidence && (stat & STAT_LYC_INTERRUPT)) ||
+            (ppu->mode == PPU_HBLANK && (stat & STAT_HBLANK_INTERRUPT)) ||
+            (ppu->mode == PPU_VBLANK && (stat & STAT_VBLANK_INTERRUPT)) ||
+            (ppu->mode == PPU_OAM_SCAN && (stat & STAT_OAM_INTERRUPT))
+    );
+    if (line && !ppu->stat_line) {
+        memory[INTERRUPT_REQUEST] |= INTERRUPT_STAT;
+    }
+    ppu->stat_line = line;
+}
+
+static void start_frame(ppu_state* ppu) {
+    ppu->line = 0;
+    ppu->window_line = 0;
+    ppu->mode = PPU_OAM_SCAN;
+    bool interval = ppu->render_interval != 0 && (ppu->frame % ppu->render_interval) == 0;
+    ppu->rendering = ppu->render_requested || interval;
+    ppu->render_requested = false;
+}
+
+static void finish_frame(ppu_state* ppu) {
+    if (ppu->rendering) {
+        ppu->frame_ready = true;
+        ppu->ready_frame = ppu->frame;
+        ppu->rendering = false;
+        ppu->rendered_frames++;
+    }
+    ppu->frame++;
+}
+
+// Fills in colour indices for one row of a tile map, from start_x to the
+// right edge of the screen
+static void draw_tiles(uint8_t* colors, uint8_t start_x, const uint8_t* memory, uint16_t map, uint8_t y, uint8_t scroll_x) {
+    bool unsigned_tiles = memory[LCDC] & LCDC_TILE_DATA;
+    const uint8_t* map_row = memory + map + (y / 8) * 32;
+    uint8_t tile_row = (y % 8) * 2;
+    for (uint16_t x = start_x; x < SCREEN_WIDTH; x++) {
+        uint8_t map_x = x + scroll_x;
+        uint8_t tile = map_row[map_x / 8];
+        // 0x8000 with unsigned tile numbers, otherwise signed from 0x9000
+        uint16_t address = unsigned_tiles ? 0x8000 + tile * 16 : 0x9000 + (int8_t) tile * 16;
+        address += tile_row;
+        uint8_t bit = 7 - (map_x % 8);
+        colors[x] = (((memory[address + 1] >> bit) & 1) << 1) | ((memory[address] >> bit) & 1);
+    }
+}
+
+static void draw_sprites(uint8_t* row, const uint8_t* bg_colors, const uint8_t* memory, uint8_t line) {
+    uint8_t height = (memory[LCDC] & LCDC_TALL_SPRITES) ? 16 : 8;
+    const uint8_t* oam = memory + SPRITE_ATTRIBUTES;
+
+    // The first 10 sprites in OAM that cover this line
+    uint8_t selected[SPRITES_PER_LINE];
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < SPRITE_COUNT && count < SPRITES_PER_LINE; i++) {
+        int16_t y = oam[i * 4] - 16;
+        if (line >= y && line < y + height) {
+            selected[count++] = i;
+        }
+    }
+    // Lower X wins, ties go to the earlier sprite. Insertion sort keeps OAM
+    // order for equal X.
+    for (uint8_t i = 1; i < count; i++) {
+        uint8_t sprite = selected[i];
+        int8_t j = i - 1;
+        while (j >= 0 && oam[selected[j] * 4 + 1] > oam[sprite * 4 + 1]) {
+            selected[j + 1] = selected[j];
+            j--;
+        }
+        selected[j + 1] = sprite;
+    }
+
+    bool taken[SCREEN_WIDTH] = {false};
+    for (uint8_t i = 0; i < count; i++) {
+        const uint8_t* sprite = oam + selected[i] * 4;
+        int16_t y = sprite[0] - 16;
+        int16_t x = sprite[1] - 8;
+        uint8_t tile = sprite[2];
+        uint8_t attributes = sprite[3];
+
+        uint8_t tile_row = line - y;
+        if (attributes & SPRITE_FLIP_Y) {
+            tile_row = height - 1 - tile_row;
+        }
+        if (height == 16) {
+            tile &= 0xFE;
+        }
+        uint16_t address = 0x8000 + tile * 16 + tile_row * 2;
+        uint8_t low = memory[address];
+        uint8_t high = memory[address + 1];
+        uint8_t palette = memory[(attributes & SPRITE_PALETTE) ? OBP1 : OBP0];
+
+        for (uint8_t p = 0; p < 8; p++) {
+            int16_t screen_x = x + p;
+            if (screen_x < 0 || screen_x >= SCREEN_WIDTH || taken[screen_x]) {
+                continue;
+            }
+            uint8_t bit = (attributes & SPRITE_FLIP_X) ? p : 7 - p;
+            uint8_t color = (((high >> bit) & 1) << 1) | ((low >> bit) & 1);
+            if (color == 0) {
+                continue;
+            }
+            // Higher priority sprites hide lower ones even when they're
+            // behind the background themselves
+            taken[screen_x] = true;
+            if ((attributes & SPRITE_BEHIND_BG) && bg_colors[screen_x] != 0) {
+                continue;
+            }
+            row[screen_x] = (palette >> (color * 2)) & 0x3;
+        }
+    }
+}
+
+static void render_line(ppu_state* ppu, const uint8_t* memory) {
+    uint8_t lcdc = memory[LCDC];
+    uint8_t* row = ppu->framebuffer[ppu->line];
+    uint8_t colors[SCREEN_WIDTH] = {0};
+
+    if (lcdc & LCDC_BG_ENABLE) {
+        uint16_t map = (lcdc & LCDC_BG_MAP) ? 0x9C00 : 0x9800;
+        draw_tiles(colors, 0, memory, map, ppu->line + memory[SCY], memory[SCX]);
+
+        int16_t window_x = memory[WX] - 7;
+        bool window = (lcdc & LCDC_WINDOW) && ppu->line >= memory[WY] && window_x < SCREEN_WIDTH;
+        if (window) {
+            uint16_t window_map = (lcdc & LCDC_WINDOW_MAP) ? 0x9C00 : 0x9800;
+            uint8_t start_x = window_x < 0 ? 0 : window_x;
+            draw_tiles(colors, start_x, memory, window_map, ppu->window_line, -window_x);
+            ppu->window_line++;
+        }
+        uint8_t palette = memory[BGP];
+        for (uint8_t x = 0; x < SCREEN_WIDTH; x++) {
+            row[x] = (palette >> (colors[x] * 2)) & 0x3;
+        }
+    }
+    else {
+        // Background and window are blank white on DMG
+        memset(row, 0, SCREEN_WIDTH);
+    }
+
+    if (lcdc & LCDC_SPRITES) {
+        draw_sprites(row, colors, memory, ppu->line);
+    }
+}
+
+void ppu_advance(ppu_state* ppu, uint8_t* memory, uint64_t clock) {
+    while (clock >= ppu->next_event) {
+        switch (ppu->mode) {
+            case PPU_OAM_SCAN:
+                ppu->mode = PPU_DRAWING;
+                ppu->next_event += PPU_DRAWING_CYCLES;
+                break;
+            case PPU_DRAWING:
+                // The only place pixels are produced
+                if (ppu->rendering) {
+                    render_line(ppu, memory);
+                }
+                ppu->mode = PPU_HBLANK;
+                ppu->next_event += PPU_HBLANK_CYCLES;
+                break;
+            case PPU_HBLANK:
+                ppu->line++;
+                if (ppu->line == SCREEN_HEIGHT) {
+                    ppu->mode = PPU_VBLANK;
+                    ppu->next_event += PPU_LINE_CYCLES;
+                    memory[INTERRUPT_REQUEST] |= INTERRUPT_VBLANK;
+                    finish_frame(ppu);
+                }
+                else {
+                    ppu->mode = PPU_OAM_SCAN;
+                    ppu->next_event += PPU_OAM_SCAN_CYCLES;
+                }
+                break;
+            case PPU_VBLANK:
+                ppu->line++;
+                if (ppu->line == PPU_LINES_PER_FRAME) {
+                    start_frame(ppu);
+                    ppu->next_event += PPU_OAM_SCAN_CYCLES;
+                }
+                else {
+                    ppu->next_event += PPU_LINE_CYCLES;
+                }
+                break;
+        }
+        update_stat(ppu, memory);
+    }
+}
+
+void ppu_write(ppu_state* ppu, uint8_t* memory, uint64_t clock, uint16_t address, uint8_t value) {
+    ppu_catch_up(ppu, memory, clock);
+    switch (address) {
+        case LCDC: {
+            bool was_enabled = memory[LCDC] & LCDC_ENABLE;
+            memory[LCDC] = value;
+            if (was_enabled && !(value & LCDC_ENABLE)) {
+                // LY stays at 0 in HBlank until the LCD comes back on
+                ppu->mode = PPU_HBLANK;
+                ppu->line = 0;
+                ppu->rendering = false;
+                ppu->next_event = UINT64_MAX;
+            }
+            else if (!was_enabled && (value & LCDC_ENABLE)) {
+                start_frame(ppu);
+                ppu->next_event = clock + PPU_OAM_SCAN_CYCLES;
+            }
+            break;
+        }
+        case STAT:
+            memory[STAT] = (value & STAT_WRITABLE) | (memory[STAT] & ~STAT_WRITABLE);
+            break;
+        case LYC:
+            memory[LYC] = value;
+            break;
+        default:
+            // LY is read only
+            break;
+    }
+    update_stat(ppu, memory);
+}
+
+void ppu_request_frame(ppu_state* ppu) {
+    ppu->render_requested = true;
+}
+
+void ppu_set_render_interval(ppu_state* ppu, uint32_t interval) {
+    ppu->render_interval = interval;
+}
+
+const uint8_t* ppu_take_frame(ppu_state* ppu, uint64_t* frame) {
+    if (!ppu->frame_ready) {
+        return NULL;
+    }
+    ppu->frame_ready = false;
+    if (frame != NULL) {
+        *frame = ppu->ready_frame;
+    }
+    return &ppu->framebuffer[0][0];
+}
+
+void ppu_reset(ppu_state* ppu, uint8_t* memory) {
+    // Power on has the LCD off until the boot ROM, or the post-boot state,
+    // turns it on through ppu_write()
+    memory[LCDC] = 0;
+    memory[BGP] = 0;
+    memory[STAT] = 0;
+    ppu->frame = 0;
+    ppu->frame_ready = false;
+    ppu->stat_line = false;
+    ppu->mode = PPU_HBLANK;
+    ppu->line = 0;
+    ppu->window_line = 0;
+    ppu->rendering = false;
+    ppu->next_event = UINT64_MAX;
+    update_stat(ppu, memory);
+}
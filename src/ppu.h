@@ -0,0 +1,94 @@
+// Pixel processing unit. Timing is event driven: LY, the STAT mode and the
+// interrupts are only updated at mode changes, which the CPU catches up to
+// after each instruction. Pixels are drawn one scanline at a time, and only
+// on frames somebody asked for, either with ppu_request_frame() or by
+// rendering every Nth frame. Other frames run the same timing with no pixel
+// work at all.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
+
+typedef enum {
+    LCDC = 0xFF40, // LCD control
+    STAT = 0xFF41, // LCD status
+    SCY = 0xFF42,
+    SCX = 0xFF43,
+    LY = 0xFF44, // Current scanline
+    LYC = 0xFF45, // Scanline compared against LY
+    BGP = 0xFF47, // Background palette
+    OBP0 = 0xFF48, // Sprite palettes
+    OBP1 = 0xFF49,
+    WY = 0xFF4A, // Window position
+    WX = 0xFF4B
+}ppu_registers;
+
+typedef enum {
+    PPU_HBLANK = 0,
+    PPU_VBLANK = 1,
+    PPU_OAM_SCAN = 2,
+    PPU_DRAWING = 3
+}ppu_mode;
+
+// Scanline timing in M-cycles
+typedef enum {
+    PPU_LINE_CYCLES = 114,
+    PPU_OAM_SCAN_CYCLES = 20,
+    PPU_DRAWING_CYCLES = 43,
+    PPU_HBLANK_CYCLES = PPU_LINE_CYCLES - PPU_OAM_SCAN_CYCLES - PPU_DRAWING_CYCLES,
+    PPU_LINES_PER_FRAME = 154
+}ppu_timing;
+
+typedef struct {
+    uint64_t next_event; // Machine clock of the next mode change, never while the LCD is off
+    ppu_mode mode;
+    uint8_t line;
+    uint8_t window_line; // Window row drawn next, it only advances on lines that show it
+    bool stat_line; // STAT interrupt only fires on a rising edge of this
+    uint64_t frame; // Frames started since power on
+    uint64_t rendered_frames; // Frames that had pixels drawn
+
+    // Rendering requests, kept across resets
+    uint32_t render_interval; // Render every Nth frame, 0 for only on request
+    bool render_requested; // Render the next frame to start
+
+    bool rendering; // The current frame is being drawn
+    bool frame_ready; // framebuffer holds a finished frame nobody has taken yet
+    uint64_t ready_frame; // Frame number of that frame
+    uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH]; // Shades from 0 (white) to 3 (black)
+}ppu_state;
+
+/// Puts the PPU at the start of a frame with the LCD off.
+/// \param memory Console address space, the PPU registers are reset too
+void ppu_reset(ppu_state* ppu, uint8_t* memory);
+
+/// Processes every mode change up to the given time.
+/// \param memory Console address space, holding the PPU registers and IF
+/// \param clock Machine clock in M-cycles
+void ppu_advance(ppu_state* ppu, uint8_t* memory, uint64_t clock);
+
+// Cheap check for the CPU to call after every instruction
+static inline void ppu_catch_up(ppu_state* ppu, uint8_t* memory, uint64_t clock) {
+    if (clock >= ppu->next_event) {
+        ppu_advance(ppu, memory, clock);
+    }
+}
+
+// Handles a write to LCDC, STAT, LY or LYC, which change the PPU's timing or
+// interrupt state. Other PPU registers are plain memory.
+void ppu_write(ppu_state* ppu, uint8_t* memory, uint64_t clock, uint16_t address, uint8_t value);
+
+// Renders the next frame that starts. Requests don't stack.
+void ppu_request_frame(ppu_state* ppu);
+
+// Renders every Nth frame, counting from power on. 0 turns it off.
+void ppu_set_render_interval(ppu_state* ppu, uint32_t interval);
+
+/// Takes the most recently finished frame. It stays valid until the next
+/// rendered frame starts drawing.
+/// \param frame Set to the frame's number, can be NULL
+/// \return The framebuffer, or NULL if no frame finished since the last call
+const uint8_t* ppu_take_frame(ppu_state* ppu, uint64_t* frame);
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint8_t register8;
+typedef uint16_t register16;
+
+// Bit masks for each flag in the F register, matching the bitfield layout of
+// cpu_state.F below. Used by code that handles F as a plain byte.
+typedef enum {
+    FLAG_ZERO = 0b10000000,
+    FLAG_SUBTRACTION = 0b01000000,
+    FLAG_HALF_CARRY = 0b00100000,
+    FLAG_CARRY = 0b00010000
+}flag_mask;
+
+// Interrupt request (IF) and enable (IE) registers, and each source's bit in them
+typedef enum {
+    INTERRUPT_REQUEST = 0xFF0F,
+    INTERRUPT_ENABLE = 0xFFFF,
+    INTERRUPT_VBLANK = 0b00000001,
+    INTERRUPT_STAT = 0b00000010,
+    INTERRUPT_TIMER = 0b00000100,
+    INTERRUPT_SERIAL = 0b00001000,
+    INTERRUPT_JOYPAD = 0b00010000,
+    INTERRUPT_ALL = 0b00011111
+}interrupt_registers;
+
+typedef struct {
+    union {
+        register16 AF;
+        struct {
+            // Bitfields are allocated from the lowest bit, so this puts
+            // the flags in the top 4 bits like on hardware (ZNHC----)
+            struct {
+                uint8_t unused: 4;
+                uint8_t carry: 1;
+                uint8_t half_carry: 1;
+                uint8_t subtraction: 1;
+                uint8_t zero: 1;
+            }F;
+            register8 A;
+        };
+    };
+    union {
+        register16 BC;
+        struct {
+            register8 C;
+            register8 B;
+        };
+    };
+    union {
+        register16 DE;
+        struct {
+            register8 E;
+            register8 D;
+        };
+    };
+    union {
+        register16 HL;
+        struct {
+            register8 L;
+            register8 H;
+        };
+    };
+    register16 SP;
+    register16 PC;
+    register8 IME;
+    bool ime_pending; // EI takes effect after the next instruction
+    bool halted; // Waiting for an interrupt
+    bool software_breakpoint; // Set by LD B, B, which test ROMs use as a breakpoint
+}cpu_state;
@@ -4,6 +4,7 @@
 #include "logging.h"
 
 #include "rom.h"
+#include "hash.h"
 
 static const char nintendo_logo[] = {
     0xCE, 0xED, 0x66, 0x66, 0xCC, 0x0D, 0x00, 0x0B,
@@ -14,7 +15,7 @@ static const char nintendo_logo[] = {
     0xDD, 0xDC, 0x99, 0x9F, 0xBB, 0xB9, 0x33, 0x3E
 };
 
-uint8_t ram_bank_count(cart_header* cart) {
+uint8_t ram_bank_count(const cart_header* cart) {
     switch (cart->ram_size) {
         case 2:
             return 1;
@@ -29,145 +30,171 @@ uint8_t ram_bank_count(cart_header* cart) {
     }
 }
 
-hardware_flags get_cart_hardware(cart_header* cart) {
-    hardware_flags output = {0};
-    switch (cart->cart_hardware_flags) {
-        case ROM_ONLY:
-            break;
-        case MBC1_ONLY:
-            output.MBC1 = true;
-            break;
-        case MBC1_RAM:
-            output.MBC1 = true;
-            output.has_ram = true;
-            break;
-        case MBC1_RAM_BATTERY:
-            output.MBC1 = true;
-            output.has_ram = true;
-            output.has_battery = true;
-            break;
-        case MBC2_ONLY:
-            output.MBC2 = true;
-        case MBC2_BATTERY:
-            output.MBC2 = true;
-            output.has_battery = true;
-        case ROM_RAM:
-            output.has_ram = true;
-        case ROM_RAM_BATTERY:
-            output.has_ram = true;
-            output.has_battery = true;
-        case MMM01_ONLY:
-            output.MMM01 = true;
-        case MMM01_RAM:
-            output.MMM01 = true;
-            output.has_ram = true;
-        case MMM01_RAM_BATTERY:
-            output.MMM01 = true;
-            output.has_ram = true;
-            output.has_battery = true;
-        case MBC3_TIMER_BATTERY:
-            output.MBC3 = true;
-            output.has_timer = true;
-            output.has_battery = true;
-        case MBC3_TIMER_RAM_BATTERY:
-            output.MBC3 = true;
-            output.has_ram = true;
-            output.has_timer = true;
-            output.has_battery = true;
-        case MBC3_ONLY:
-            output.MBC3 = true;
-        case MBC3_RAM:
-            output.MBC3 = true;
-            output.has_ram = true;
-        case MBC3_RAM_BATTERY:
-            output.MBC3 = true;
-            output.has_ram = true;
-            output.has_battery = true;
-        case MBC5_ONLY:
-            output.MBC5 = true;
-        case MBC5_RAM:
-            output.MBC5 = true;
-            output.has_ram = true;
-        case MBC5_RAM_BATTERY:
-            output.MBC5 = true;
-            output.has_battery = true;
-            output.has_ram = true;
-        case MBC5_RUMBLE:
-            output.MBC5 = true;
-            output.has_rumble = true;
-        case MBC5_RUMBLE_RAM:
-            output.MBC5 = true;
-            output.has_rumble = true;
-            output.has_ram = true;
-        case MBC5_RUMBLE_RAM_BATTERY:
-            output.MBC5 = true;
-            output.has_rumble = true;
-            output.has_ram = true;
-            output.has_battery = true;
-        case MBC6_ONLY:
-            output.MBC6 = true;
-        case MBC7_SENSOR_RUMBLE_RAM_BATTERY:
-            output.MBC7 = true;
-            output.has_sensor = true;
-            output.has_rumble = true;
-            output.has_ram = true;
-            output.has_battery = true;
-        case POCKET_CAMERA:
-            output.has_camera = true;
-        case BANDAI_TAMA5:
-            output.BANDAI_TAMA5 = true;
-        case HuC3_ONLY:
-            output.HuC3 = true;
-        case HuC1_RAM_BATTERY:
-            output.HuC3 = true;
-            output.has_ram = true;
-            output.has_battery = true;
-        default:
+uint16_t rom_header_bank_count(const cart_header* cart) {
+    // 0x00 is 32KiB (2 banks), and each step up doubles it until 8MiB
+    if (cart->rom_size > 8) {
+        return 2;
+    }
+    return 2 << cart->rom_size;
+}
+
+const char* controller_type_names[CONTROLLER_TYPE_COUNT] = {
+    [NONE] = "none",
+    [MBC1] = "MBC1",
+    [MBC2] = "MBC2",
+    [MBC3] = "MBC3",
+    [MBC5] = "MBC5",
+    [MBC6] = "MBC6",
+    [MBC7] = "MBC7",
+    [MMM01] = "MMM01",
+    [HUC1] = "HuC1",
+    [HUC3] = "HuC3",
+    [TAMA5] = "TAMA5",
+    [CAMERA] = "Pocket Camera"
+};
+
+// Every defined cart type, anything missing is unknown
+static const cart_type_info cart_types[256] = {
+    [ROM_ONLY] = {"ROM", NONE, {0}},
+    [MBC1_ONLY] = {"MBC1", MBC1, {.MBC1 = true}},
+    [MBC1_RAM] = {"MBC1+RAM", MBC1, {.MBC1 = true, .has_ram = true}},
+    [MBC1_RAM_BATTERY] = {"MBC1+RAM+BATTERY", MBC1, {.MBC1 = true, .has_ram = true, .has_battery = true}},
+    [MBC2_ONLY] = {"MBC2", MBC2, {.MBC2 = true}},
+    [MBC2_BATTERY] = {"MBC2+BATTERY", MBC2, {.MBC2 = true, .has_battery = true}},
+    [ROM_RAM] = {"ROM+RAM", NONE, {.has_ram = true}},
+    [ROM_RAM_BATTERY] = {"ROM+RAM+BATTERY", NONE, {.has_ram = true, .has_battery = true}},
+    [MMM01_ONLY] = {"MMM01", MMM01, {.MMM01 = true}},
+    [MMM01_RAM] = {"MMM01+RAM", MMM01, {.MMM01 = true, .has_ram = true}},
+    [MMM01_RAM_BATTERY] = {"MMM01+RAM+BATTERY", MMM01, {.MMM01 = true, .has_ram = true, .has_battery = true}},
+    [MBC3_TIMER_BATTERY] = {"MBC3+TIMER+BATTERY", MBC3, {.MBC3 = true, .has_timer = true, .has_battery = true}},
+    [MBC3_TIMER_RAM_BATTERY] = {"MBC3+TIMER+RAM+BATTERY", MBC3,
+                                {.MBC3 = true, .has_timer = true, .has_ram = true, .has_battery = true}},
+    [MBC3_ONLY] = {"MBC3", MBC3, {.MBC3 = true}},
+    [MBC3_RAM] = {"MBC3+RAM", MBC3, {.MBC3 = true, .has_ram = true}},
+    [MBC3_RAM_BATTERY] = {"MBC3+RAM+BATTERY", MBC3, {.MBC3 = true, .has_ram = true, .has_battery = true}},
+    [MBC5_ONLY] = {"MBC5", MBC5, {.MBC5 = true}},
+    [MBC5_RAM] = {"MBC5+RAM", MBC5, {.MBC5 = true, .has_ram = true}},
+    [MBC5_RAM_BATTERY] = {"MBC5+RAM+BATTERY", MBC5, {.MBC5 = true, .has_ram = true, .has_battery = true}},
+    [MBC5_RUMBLE] = {"MBC5+RUMBLE", MBC5, {.MBC5 = true, .has_rumble = true}},
+    [MBC5_RUMBLE_RAM] = {"MBC5+RUMBLE+RAM", MBC5, {.MBC5 = true, .has_rumble = true, .has_ram = true}},
+    [MBC5_RUMBLE_RAM_BATTERY] = {"MBC5+RUMBLE+RAM+BATTERY", MBC5,
+                                 {.MBC5 = true, .has_rumble = true, .has_ram = true, .has_battery = true}},
+    [MBC6_ONLY] = {"MBC6", MBC6, {.MBC6 = true}},
+    [MBC7_SENSOR_RUMBLE_RAM_BATTERY] = {"MBC7+SENSOR+RUMBLE+RAM+BATTERY", MBC7,
+                                        {.MBC7 = true, .has_sensor = true, .has_rumble = true, .has_ram = true,
+                                         .has_battery = true}},
+    [POCKET_CAMERA] = {"POCKET CAMERA", CAMERA, {.has_camera = true, .has_ram = true, .has_battery = true}},
+    [BANDAI_TAMA5] = {"BANDAI TAMA5", TAMA5, {.BANDAI_TAMA5 = true}},
+    [HuC3_ONLY] = {"HuC3", HUC3, {.HuC3 = true}},
+    [HuC1_RAM_BATTERY] = {"HuC1+RAM+BATTERY", HUC1, {.HuC1 = true, .has_ram = true, .has_battery = true}}
+};
+
+// Header offsets in the ROM
+#define TITLE_ADDRESS 0x134
+#define COLOR_FLAG_ADDRESS 0x143
+#define HEADER_CHECKSUM_ADDRESS 0x14D
+#define GLOBAL_CHECKSUM_ADDRESS 0x14E
+// 16KiB, the header counts the ROM size in these
+#define BANK_SIZE 0x4000u
+
+const cart_type_info* get_cart_type(const cart_header* cart) {
+    return &cart_types[cart->cart_hardware_flags];
+}
+
+hardware_flags get_cart_hardware(const cart_header* cart) {
+    return get_cart_type(cart)->flags;
+}
+
+controller_type get_cart_controller(const cart_header* cart) {
+    return get_cart_type(cart)->controller;
+}
+
+void rom_title(const cart_header* cart, char* title) {
+    // Color compatible carts use the last byte as the CGB flag
+    uint8_t length = (cart->color_support & 0x80) ? ROM_TITLE_SIZE - 1 : ROM_TITLE_SIZE;
+    uint8_t i = 0;
+    for (; i < length; i++) {
+        char c = cart->name_old_format[i];
+        if (c < ' ' || c > '~') {
             break;
+        }
+        title[i] = c;
     }
-    return output;
+    title[i] = '\0';
 }
 
-void print_rom_info(cart_header* rom_header) {
-    if (memcmp(&nintendo_logo, rom_header->nintendo_logo, sizeof(nintendo_logo)) != 0) {
-        LOG_MSG(warning, "Failed Nintendo logo check, proceeding anyway\n");
+uint8_t rom_header_checksum(const uint8_t* rom) {
+    uint8_t checksum = 0;
+    for (uint16_t address = TITLE_ADDRESS; address < HEADER_CHECKSUM_ADDRESS; address++) {
+        checksum = checksum - rom[address] - 1;
     }
-    // In older games, 16 bytes were used for the ROM name. In newer games,
-    // only 11 bytes are available (adding 1 to account for null terminator)
-    if (strlen(rom_header->name_old_format) + 1 > 11) {
-        LOG_MSG(info, "ROM Name: %s\n", rom_header->name_old_format);
+    return checksum;
+}
+
+uint16_t rom_global_checksum(const uint8_t* rom, uint32_t size) {
+    uint64_t sum = byte_sum(rom, size);
+    if (size > GLOBAL_CHECKSUM_ADDRESS + 1) {
+        sum -= rom[GLOBAL_CHECKSUM_ADDRESS] + rom[GLOBAL_CHECKSUM_ADDRESS + 1];
     }
-    else {
-        LOG_MSG(info, "ROM Name: %s\n", rom_header->name_new_format);
+    return (uint16_t) sum;
+}
 
-        LOG_MSG(info, "Publisher Code: %c%c%c%c\n", rom_header->manufacturer_code[0], rom_header->manufacturer_code[1], rom_header->manufacturer_code[2], rom_header->manufacturer_code[3]);
-        if (rom_header->color_support == 0x80 || rom_header->color_support == 0xC0) {
-            LOG_MSG(info, "This game supports color enhancements, but is compatible with an original Game Boy.\n");
-        }
-        else {
-            LOG_MSG(warning, "Unimplemented: Console should be in \"PGB\" mode (0x%x)\n", rom_header->color_support);
-        }
+uint8_t rom_validate(const uint8_t* rom, uint32_t size) {
+    if (size < ROM_HEADER_END) {
+        return ROM_TRUNCATED;
+    }
+    const cart_header* cart = (const cart_header*) (rom + ROM_HEADER_ADDRESS);
+    uint8_t problems = 0;
+    if (memcmp(nintendo_logo, cart->nintendo_logo, sizeof(nintendo_logo)) != 0) {
+        problems |= ROM_BAD_LOGO;
     }
-    if (rom_header->rom_size < 9) {
-        uint32_t rom_size = 2 * (1 << rom_header->rom_size);
-        LOG_MSG(info, "ROM Size: %d banks (%dKiB)\n", rom_size, rom_size * 16);
+    if (rom_header_checksum(rom) != rom[HEADER_CHECKSUM_ADDRESS]) {
+        problems |= ROM_BAD_HEADER_CHECKSUM;
     }
-    if (rom_header->ram_size != 0 && rom_header->ram_size != 1) {
-        uint8_t ram_banks = ram_bank_count(rom_header);
-        LOG_MSG(info, "Cart has %d 8KiB RAM bank(s) (%dKiB total)\n", ram_banks, ram_banks * 8);
+    // Stored big endian, unlike everything else
+    uint16_t global = (rom[GLOBAL_CHECKSUM_ADDRESS] << 8) | rom[GLOBAL_CHECKSUM_ADDRESS + 1];
+    if (rom_global_checksum(rom, size) != global) {
+        problems |= ROM_BAD_GLOBAL_CHECKSUM;
     }
-    else {
-        LOG_MSG(info, "Cart has no extra RAM.\n");
+    if (get_cart_type(cart)->name == NULL) {
+        problems |= ROM_UNKNOWN_CART_TYPE;
     }
+    if (cart->rom_size > 8 || size != rom_header_bank_count(cart) * BANK_SIZE) {
+        problems |= ROM_SIZE_MISMATCH;
+    }
+    return problems;
+}
 
-    LOG_MSG(info, "Card Hardware code: 0x%x\n", rom_header->cart_hardware_flags);
+void print_rom_info(const uint8_t* rom, uint32_t size) {
+    uint8_t problems = rom_validate(rom, size);
+    if (problems & ROM_TRUNCATED) {
+        LOG_MSG(warning, "ROM is too small to have a header\n");
+        return;
+    }
+    cart_header* cart = (cart_header*) (rom + ROM_HEADER_ADDRESS);
+    char title[ROM_TITLE_SIZE + 1];
+    rom_title(cart, title);
+    const cart_type_info* type = get_cart_type(cart);
+    uint8_t ram_banks = ram_bank_count(cart);
+    LOG_MSG(info, "%s: %s, %u KiB ROM, %u KiB RAM\n", title, type->name != NULL ? type->name : "unknown cart type",
+            rom_header_bank_count(cart) * 16, ram_banks * 8);
+    LOG_MSG(debug, "Cart type 0x%02x, region %s, version %u\n", cart->cart_hardware_flags,
+            cart->region == 0 ? "Japan" : "overseas", cart->game_version);
 
-    if (rom_header->region == 0) {
-        LOG_MSG(info, "ROM Region: World\n");
+    if (problems & ROM_BAD_LOGO) {
+        LOG_MSG(warning, "Failed Nintendo logo check, proceeding anyway\n");
     }
-    else {
-        LOG_MSG(info, "ROM Region: Overseas only\n");
+    if (problems & ROM_BAD_HEADER_CHECKSUM) {
+        LOG_MSG(warning, "Header checksum is 0x%02x, should be 0x%02x\n", rom[HEADER_CHECKSUM_ADDRESS],
+                rom_header_checksum(rom));
+    }
+    if (problems & ROM_BAD_GLOBAL_CHECKSUM) {
+        LOG_MSG(debug, "Global checksum doesn't match, which only matters for spotting bad dumps\n");
+    }
+    if (problems & ROM_UNKNOWN_CART_TYPE) {
+        LOG_MSG(warning, "Unknown cart type 0x%02x, running it without a memory controller\n", cart->cart_hardware_flags);
+    }
+    if (problems & ROM_SIZE_MISMATCH) {
+        LOG_MSG(warning, "ROM is %u bytes, the header declares %u\n", size, rom_header_bank_count(cart) * BANK_SIZE);
     }
-    LOG_MSG(info, "Game Version: %d\n", rom_header->game_version);
 }
-
@@ -1,7 +1,37 @@
+// Cartridge header decoding and validation. The cart type byte is looked up
+// in a constant table with the hardware and memory controller of every
+// defined code.
+
 #pragma once
 #include <stdint.h>
 #include <stdbool.h>
 
+// The header sits at 0x100-0x14F of bank 0
+#define ROM_HEADER_ADDRESS 0x100
+#define ROM_HEADER_END 0x150
+// Longest title, in headers that don't use its last bytes for other things
+#define ROM_TITLE_SIZE 16
+
+// Memory controller types
+typedef enum {
+    NONE,
+    MBC1,
+    MBC2,
+    MBC3,
+    MBC5,
+    MBC6,
+    MBC7,
+    MMM01,
+    HUC1,
+    HUC3,
+    TAMA5,
+    CAMERA,
+    CONTROLLER_TYPE_COUNT
+}controller_type;
+
+// Name of each controller type, "none" for carts without one
+extern const char* controller_type_names[CONTROLLER_TYPE_COUNT];
+
 typedef struct {
     uint8_t entry_point[4];
     uint8_t nintendo_logo[48];
@@ -73,10 +103,50 @@ typedef struct {
     bool MBC7: 1;
     bool MMM01: 1;
     bool BANDAI_TAMA5: 1;
+    bool HuC1: 1;
     bool HuC3: 1;
 }hardware_flags;
 
-uint8_t ram_bank_count(cart_header* cart);
-hardware_flags get_cart_hardware(cart_header* cart);
-void print_rom_info(cart_header* rom_header);
+// What a cart type byte stands for
+typedef struct {
+    const char* name; // NULL for codes no cartridge uses
+    controller_type controller;
+    hardware_flags flags;
+}cart_type_info;
+
+// Problems rom_validate() finds, as bits
+typedef enum {
+    ROM_TRUNCATED = 0b00000001, // Too short to hold a header, nothing else is checked
+    ROM_BAD_LOGO = 0b00000010, // The boot ROM would lock up
+    ROM_BAD_HEADER_CHECKSUM = 0b00000100, // Same
+    ROM_BAD_GLOBAL_CHECKSUM = 0b00001000, // Nothing checks this one on hardware
+    ROM_UNKNOWN_CART_TYPE = 0b00010000,
+    ROM_SIZE_MISMATCH = 0b00100000 // The file isn't the size the header declares
+}rom_problem;
+
+uint8_t ram_bank_count(const cart_header* cart);
+// Number of 16KiB ROM banks the header declares. Invalid sizes count as 2.
+uint16_t rom_header_bank_count(const cart_header* cart);
+// Looks up the header's cart type byte. Unknown codes have no name, no
+// controller and no flags.
+const cart_type_info* get_cart_type(const cart_header* cart);
+hardware_flags get_cart_hardware(const cart_header* cart);
+controller_type get_cart_controller(const cart_header* cart);
+
+/// Copies the printable part of the title, which ends early on color
+/// compatible carts.
+/// \param title At least ROM_TITLE_SIZE + 1 bytes, always NUL terminated
+void rom_title(const cart_header* cart, char* title);
+
+// Header checksum of 0x134-0x14C, as the boot ROM computes it
+uint8_t rom_header_checksum(const uint8_t* rom);
+// Global checksum, the 16-bit sum of every byte except the checksum itself
+uint16_t rom_global_checksum(const uint8_t* rom, uint32_t size);
+
+/// Checks a ROM file against its header.
+/// \return rom_problem bits, 0 if everything matches
+uint8_t rom_validate(const uint8_t* rom, uint32_t size);
+
+// Logs the title and cart type, and warns about anything rom_validate() finds.
+void print_rom_info(const uint8_t* rom, uint32_t size);
 
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "logging.h"
+#include "file.h"
+
+#include "screenshot.h"
+#include "machine.h"
+#include "cpu.h"
+#include "hash.h"
+#include "png.h"
+
+// Frames kept per hash file
+#define SCREENSHOT_MAX_FRAMES 64
+
+static const char* result_names[] = {
+    [SCREENSHOT_MATCH] = "PASS",
+    [SCREENSHOT_MISMATCH] = "FAIL",
+    [SCREENSHOT_MISSING] = "MISSING",
+    [SCREENSHOT_UPDATED] = "UPDATED",
+    [SCREENSHOT_TIMEOUT] = "TIMEOUT",
+    [SCREENSHOT_ERROR] = "ERROR"
+};
+
+// Hashes recorded for one ROM
+typedef struct {
+    uint64_t frames[SCREENSHOT_MAX_FRAMES];
+    uint32_t hashes[SCREENSHOT_MAX_FRAMES];
+    uint8_t count;
+}hash_file;
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static const char* base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+static void hash_file_path(char* out, size_t size, const char* rom_path, const char* expect_dir) {
+    if (expect_dir != NULL) {
+        snprintf(out, size, "%s/%s.hash", expect_dir, base_name(rom_path));
+    }
+    else {
+        snprintf(out, size, "%s.hash", rom_path);
+    }
+}
+
+static void hash_file_load(hash_file* hashes, const char* path) {
+    hashes->count = 0;
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return;
+    }
+    uint64_t frame = 0;
+    uint32_t hash = 0;
+    while (hashes->count < SCREENSHOT_MAX_FRAMES && fscanf(file, "%" SCNu64 " %" SCNx32, &frame, &hash) == 2) {
+        hashes->frames[hashes->count] = frame;
+        hashes->hashes[hashes->count] = hash;
+        hashes->count++;
+    }
+    fclose(file);
+}
+
+static bool hash_file_save(const hash_file* hashes, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        LOG_MSG(error, "Failed to write %s\n", path);
+        return false;
+    }
+    for (uint8_t i = 0; i < hashes->count; i++) {
+        fprintf(file, "%" PRIu64 " %08" PRIx32 "\n", hashes->frames[i], hashes->hashes[i]);
+    }
+    fclose(file);
+    return true;
+}
+
+// Returns the index of the frame's hash, or -1 if there isn't one
+static int hash_file_find(const hash_file* hashes, uint64_t frame) {
+    for (uint8_t i = 0; i < hashes->count; i++) {
+        if (hashes->frames[i] == frame) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool screenshot_capture(const uint8_t* rom_data, uint32_t rom_size, uint64_t frame, uint64_t max_cycles,
+                        uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH]) {
+    machine_state machine = {0};
+    // Frame 0 starts during reset, so it has to be asked for beforehand
+    bool requested = (frame == 0);
+    if (requested) {
+        ppu_request_frame(&machine.ppu);
+    }
+    if (!machine_init(&machine, rom_data, rom_size)) {
+        machine_free(&machine);
+        return false;
+    }
+
+    const uint8_t* pixels = NULL;
+    while (pixels == NULL && machine.clock < max_cycles) {
+        if (cpu_step(&machine) == 0) {
+            break;
+        }
+        // The frame before the one we want has finished, so ours starts next
+        if (!requested && machine.ppu.frame >= frame) {
+            ppu_request_frame(&machine.ppu);
+            requested = true;
+        }
+        pixels = ppu_take_frame(&machine.ppu, NULL);
+    }
+    if (pixels != NULL) {
+        memcpy(framebuffer, pixels, SCREEN_WIDTH * SCREEN_HEIGHT);
+    }
+    machine_free(&machine);
+    return pixels != NULL;
+}
+
+static screenshot_result check_rom(const char* path, const screenshot_options* options, uint32_t* hash) {
+    uint32_t rom_size = 0;
+    uint8_t* rom_data = file_load(path, &rom_size);
+    if (rom_data == NULL) {
+        return SCREENSHOT_ERROR;
+    }
+    static uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
+    bool captured = screenshot_capture(rom_data, rom_size, options->frame, options->max_cycles, framebuffer);
+    free(rom_data);
+    if (!captured) {
+        return SCREENSHOT_TIMEOUT;
+    }
+    *hash = crc32c(0, &framebuffer[0][0], sizeof(framebuffer));
+
+    char hash_path[4096];
+    hash_file_path(hash_path, sizeof(hash_path), path, options->expect_dir);
+    hash_file hashes = {0};
+    hash_file_load(&hashes, hash_path);
+    int index = hash_file_find(&hashes, options->frame);
+    if (index >= 0 && hashes.hashes[index] == *hash) {
+        return SCREENSHOT_MATCH;
+    }
+
+    if (options->update) {
+        if (index < 0) {
+            if (hashes.count == SCREENSHOT_MAX_FRAMES) {
+                LOG_MSG(error, "%s already has %d frames\n", hash_path, SCREENSHOT_MAX_FRAMES);
+                return SCREENSHOT_ERROR;
+            }
+            index = hashes.count++;
+        }
+        hashes.frames[index] = options->frame;
+        hashes.hashes[index] = *hash;
+        return hash_file_save(&hashes, hash_path) ? SCREENSHOT_UPDATED : SCREENSHOT_ERROR;
+    }
+    if (index < 0) {
+        return SCREENSHOT_MISSING;
+    }
+    if (options->png_dir != NULL) {
+        char png_path[4096];
+        snprintf(png_path, sizeof(png_path), "%s/%s.%" PRIu64 ".png", options->png_dir, base_name(path), options->frame);
+        png_write_shades(png_path, &framebuffer[0][0], SCREEN_WIDTH, SCREEN_HEIGHT);
+    }
+    return SCREENSHOT_MISMATCH;
+}
+
+int run_screenshot_suite(char** paths, int count, const screenshot_options* options) {
+    struct timespec suite_start = {0};
+    clock_gettime(CLOCK_MONOTONIC, &suite_start);
+
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        struct timespec start = {0};
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        uint32_t hash = 0;
+        screenshot_result result = check_rom(paths[i], options, &hash);
+        bool passed = (result == SCREENSHOT_MATCH || result == SCREENSHOT_UPDATED);
+        if (!passed) {
+            failures++;
+        }
+        LOG_MSG(passed ? info : error, "%-7s %s frame %" PRIu64 " %08" PRIx32 " (%.3fs)\n", result_names[result], paths[i], options->frame, hash, elapsed_seconds(&start));
+    }
+
+    LOG_MSG(info, "%d/%d matched in %.3fs\n", count - failures, count, elapsed_seconds(&suite_start));
+    return failures;
+}
@@ -0,0 +1,38 @@
+// Screenshot regression testing. Each ROM runs until a chosen frame, which is
+// the only one rendered, and the framebuffer's CRC32C is compared against the
+// hash recorded for that ROM. Images are only written for mismatches.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ppu.h"
+
+typedef enum {
+    SCREENSHOT_MATCH,
+    SCREENSHOT_MISMATCH,
+    SCREENSHOT_MISSING, // No hash recorded for this ROM and frame
+    SCREENSHOT_UPDATED, // Hash was missing or different and has been recorded
+    SCREENSHOT_TIMEOUT,
+    SCREENSHOT_ERROR // The CPU stopped or the ROM couldn't be loaded
+}screenshot_result;
+
+typedef struct {
+    uint64_t frame; // Frame to check, counting from 0 at power on
+    uint64_t max_cycles; // Machine cycles to run before giving up on the frame
+    const char* expect_dir; // Where hash files live, NULL to keep them next to each ROM
+    const char* png_dir; // Where mismatching frames are written, NULL to not write them
+    bool update; // Record new hashes instead of failing
+}screenshot_options;
+
+/// Runs a ROM and renders a single frame.
+/// \param frame Frame to render, counting from 0 at power on
+/// \param framebuffer Receives the frame's shades
+/// \return false if the CPU stopped or the frame didn't finish in time
+bool screenshot_capture(const uint8_t* rom_data, uint32_t rom_size, uint64_t frame, uint64_t max_cycles,
+                        uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH]);
+
+/// Checks every ROM in paths, printing a line per ROM and the suite runtime.
+/// Hashes are kept in <ROM name>.hash, one "<frame> <CRC32C>" line per frame.
+/// \return Number of ROMs that didn't match
+int run_screenshot_suite(char** paths, int count, const screenshot_options* options);
@@ -0,0 +1,50 @@
+#define _GNU_SOURCE // memmem()
+#include <string.h>
+
+#include "serial.h"
+#include "registers.h"
+
+enum {
+    SC_TRANSFER_START = 0b10000000,
+    SC_INTERNAL_CLOCK = 0b00000001
+};
+
+static void serial_append(serial_port* serial, uint8_t value) {
+    if (serial->length == SERIAL_BUFFER_SIZE) {
+        // Keep the newest half so the end of the output is still available
+        uint32_t half = SERIAL_BUFFER_SIZE / 2;
+        memmove(serial->buffer, serial->buffer + half, SERIAL_BUFFER_SIZE - half);
+        serial->length -= half;
+    }
+    serial->buffer[serial->length++] = value;
+    serial->total_bytes++;
+}
+
+void serial_write_control(serial_port* serial, uint8_t* memory, uint8_t value) {
+    uint8_t start = SC_TRANSFER_START | SC_INTERNAL_CLOCK;
+    if ((value & start) != start) {
+        // Waiting on an external clock that will never come
+        memory[SERIAL_CONTROL] = value;
+        return;
+    }
+
+    serial_append(serial, memory[SERIAL_DATA]);
+
+    // Nothing is connected, so the bits shifted in are all 1s
+    memory[SERIAL_DATA] = 0xFF;
+    memory[SERIAL_CONTROL] = value & ~SC_TRANSFER_START;
+    memory[INTERRUPT_REQUEST] |= INTERRUPT_SERIAL;
+}
+
+const uint8_t* serial_output(const serial_port* serial, uint32_t* length) {
+    *length = serial->length;
+    return serial->buffer;
+}
+
+bool serial_output_contains(const serial_port* serial, const char* text) {
+    return memmem(serial->buffer, serial->length, text, strlen(text)) != NULL;
+}
+
+void serial_clear(serial_port* serial) {
+    serial->length = 0;
+}
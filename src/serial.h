@@ -0,0 +1,40 @@
+// Serial port (SB/SC registers). There's never a link cable partner, so a
+// transfer completes as soon as it starts and every byte the game sends is
+// appended to an in-memory buffer. Test ROMs use this to report results.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Bytes kept from the serial output. When full, the oldest half is dropped.
+#define SERIAL_BUFFER_SIZE 0x1000
+
+typedef enum {
+    SERIAL_DATA = 0xFF01, // SB
+    SERIAL_CONTROL = 0xFF02, // SC
+}serial_registers;
+
+typedef struct {
+    uint8_t buffer[SERIAL_BUFFER_SIZE];
+    uint32_t length;
+    uint64_t total_bytes; // Bytes sent since power on, including dropped ones
+}serial_port;
+
+/// Handles a write to SC. Starting a transfer with the internal clock
+/// immediately shifts out SB into the buffer and raises the serial interrupt.
+/// \param serial Serial port to update
+/// \param memory Console address space, holding SB, SC and IF
+/// \param value Value written to SC
+void serial_write_control(serial_port* serial, uint8_t* memory, uint8_t value);
+
+/// Everything sent over serial so far.
+/// \param serial Serial port to read
+/// \param length Set to the number of valid bytes
+/// \return Pointer to the captured bytes, oldest first
+const uint8_t* serial_output(const serial_port* serial, uint32_t* length);
+
+// Returns true if the captured output contains the given text.
+bool serial_output_contains(const serial_port* serial, const char* text);
+
+// Discards everything captured so far.
+void serial_clear(serial_port* serial);
@@ -0,0 +1,70 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "logging.h"
+
+#include "telemetry.h"
+#include "rom.h"
+
+// Writes a JSON string, escaping what JSON requires
+static void write_string(FILE* out, const char* text, uint32_t max_length) {
+    fputc('"', out);
+    for (uint32_t i = 0; i < max_length && text[i] != '\0'; i++) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        }
+        else if (c < 0x20 || c >= 0x7F) {
+            fprintf(out, "\\u%04x", c);
+        }
+        else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+bool telemetry_append(const char* path, const machine_state* machine, const char* rom, double host_seconds) {
+    FILE* out = fopen(path, "a");
+    if (out == NULL) {
+        LOG_MSG(error, "Failed to open %s\n", path);
+        return false;
+    }
+    const machine_stats* stats = &machine->stats;
+    const cart_header* cart = (const cart_header*) (machine->cartridge_rom + 0x100);
+    uint64_t slow_accesses = stats->slow_reads + stats->slow_writes;
+
+    fprintf(out, "{\"rom\": ");
+    if (rom != NULL) {
+        write_string(out, rom, UINT32_MAX);
+    }
+    else {
+        fprintf(out, "null");
+    }
+    fprintf(out, ", \"rom_crc\": \"%08x\", \"title\": ", machine->rom_crc);
+    // The last byte is the color flag on newer carts
+    write_string(out, cart->name_old_format, sizeof(cart->name_old_format) - 1);
+    fprintf(out, ", \"cycles\": %llu, \"emulated_seconds\": %.6f", (unsigned long long) machine->clock,
+            (double) machine->clock / MACHINE_CYCLES_PER_SECOND);
+    if (host_seconds >= 0) {
+        fprintf(out, ", \"host_seconds\": %.6f", host_seconds);
+    }
+    fprintf(out, ", \"instructions\": %llu, \"interrupts\": %llu, \"halt_cycles\": %llu",
+            (unsigned long long) stats->instructions, (unsigned long long) stats->interrupts,
+            (unsigned long long) stats->halt_cycles);
+    fprintf(out, ", \"frames\": %llu, \"frames_rendered\": %llu",
+            (unsigned long long) machine->ppu.frame, (unsigned long long) machine->ppu.rendered_frames);
+    fprintf(out, ", \"bank_switches\": %llu, \"sram_writes\": %llu",
+            (unsigned long long) stats->bank_switches, (unsigned long long) stats->sram_writes);
+    fprintf(out, ", \"slow_reads\": %llu, \"slow_writes\": %llu, \"slow_accesses_per_instruction\": %.4f}\n",
+            (unsigned long long) stats->slow_reads, (unsigned long long) stats->slow_writes,
+            stats->instructions != 0 ? (double) slow_accesses / stats->instructions : 0.0);
+
+    bool written = !ferror(out);
+    written = (fclose(out) == 0) && written;
+    if (!written) {
+        LOG_MSG(error, "Failed to write %s\n", path);
+    }
+    return written;
+}
@@ -0,0 +1,20 @@
+// Per-run telemetry for dashboards, so it's visible which ROMs are expensive
+// to emulate and why without attaching a profiler. The counters are the
+// machine_stats every machine keeps. This writes them out as JSON lines, one
+// object per line, always appended so a fleet of runs can share a file:
+//   {"rom": "path", "rom_crc": "1a2b3c4d", "title": "TETRIS", "cycles": ...}
+// Besides the counters each line has the clock, emulated and host seconds,
+// frames started and rendered, and slow path accesses per instruction, the
+// closest thing to a miss rate the page tables have.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "machine.h"
+
+/// Appends a line with the machine's counters to a file.
+/// \param rom Label for the line, usually the ROM path. Can be NULL.
+/// \param host_seconds Wall clock time spent emulating, negative if unknown
+/// \return false if the file couldn't be written
+bool telemetry_append(const char* path, const machine_state* machine, const char* rom, double host_seconds);
@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <malloc.h>
+#include <time.h>
+
+#include "logging.h"
+#include "file.h"
+
+#include "test_runner.h"
+#include "machine.h"
+#include "cpu.h"
+#include "serial.h"
+#include "coverage.h"
+#include "telemetry.h"
+#include "boot_rom.h"
+
+static const char* result_names[] = {
+    [TEST_RUNNING] = "RUNNING",
+    [TEST_PASSED] = "PASS",
+    [TEST_FAILED] = "FAIL",
+    [TEST_TIMEOUT] = "TIMEOUT",
+    [TEST_ERROR] = "ERROR"
+};
+
+// Mooneye ROMs also send their result registers over serial
+static const char mooneye_pass_bytes[] = {3, 5, 8, 13, 21, 34, 0};
+static const char mooneye_fail_bytes[] = {0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0};
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static test_result check_breakpoint(const cpu_state* cpu) {
+    bool fibonacci = cpu->B == 3 && cpu->C == 5 && cpu->D == 8 &&
+                     cpu->E == 13 && cpu->H == 21 && cpu->L == 34;
+    if (fibonacci) {
+        return TEST_PASSED;
+    }
+    bool failed = cpu->B == 0x42 && cpu->C == 0x42 && cpu->D == 0x42 &&
+                  cpu->E == 0x42 && cpu->H == 0x42 && cpu->L == 0x42;
+    if (failed) {
+        return TEST_FAILED;
+    }
+    // Some ROMs use LD B, B for other things, keep going
+    return TEST_RUNNING;
+}
+
+static test_result check_serial(const serial_port* serial) {
+    if (serial_output_contains(serial, "Passed") || serial_output_contains(serial, mooneye_pass_bytes)) {
+        return TEST_PASSED;
+    }
+    if (serial_output_contains(serial, "Failed") || serial_output_contains(serial, mooneye_fail_bytes)) {
+        return TEST_FAILED;
+    }
+    return TEST_RUNNING;
+}
+
+test_result run_test_rom(const char* rom_path, const uint8_t* rom_data, uint32_t rom_size, uint64_t max_cycles,
+                         const run_options* options) {
+    struct timespec start = {0};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    machine_state machine = {.core = options->core};
+    if (!machine_init(&machine, rom_data, rom_size) ||
+        (options->boot_rom_path != NULL && !boot_rom_load(&machine, options->boot_rom_path))) {
+        machine_free(&machine);
+        return TEST_ERROR;
+    }
+    coverage_map coverage = {0};
+    bool covering = options->coverage_dir != NULL && coverage_init(&coverage, &machine);
+
+    test_result result = TEST_TIMEOUT;
+    uint64_t serial_bytes_seen = 0;
+    while (machine.clock < max_cycles) {
+        if (covering) {
+            coverage_record(&coverage, &machine);
+        }
+        if (cpu_step(&machine) == 0) {
+            result = TEST_ERROR;
+            break;
+        }
+        if (machine.cpu.software_breakpoint) {
+            machine.cpu.software_breakpoint = false;
+            test_result breakpoint_result = check_breakpoint(&machine.cpu);
+            if (breakpoint_result != TEST_RUNNING) {
+                result = breakpoint_result;
+                break;
+            }
+        }
+        // Only search the output again when something new was sent
+        if (machine.serial.total_bytes != serial_bytes_seen) {
+            serial_bytes_seen = machine.serial.total_bytes;
+            test_result serial_result = check_serial(&machine.serial);
+            if (serial_result != TEST_RUNNING) {
+                result = serial_result;
+                break;
+            }
+        }
+    }
+
+    if (covering) {
+        coverage_save(&coverage, options->coverage_dir);
+        coverage_free(&coverage);
+    }
+    if (options->stats_path != NULL) {
+        telemetry_append(options->stats_path, &machine, rom_path, elapsed_seconds(&start));
+    }
+    machine_free(&machine);
+    return result;
+}
+
+int run_test_suite(char** paths, int count, uint64_t max_cycles, const run_options* options) {
+    struct timespec suite_start = {0};
+    clock_gettime(CLOCK_MONOTONIC, &suite_start);
+
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        struct timespec start = {0};
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        test_result result = TEST_ERROR;
+        uint32_t rom_size = 0;
+        uint8_t* rom_data = file_load(paths[i], &rom_size);
+        if (rom_data != NULL) {
+            result = run_test_rom(paths[i], rom_data, rom_size, max_cycles, options);
+            free(rom_data);
+        }
+
+        if (result != TEST_PASSED) {
+            failures++;
+        }
+        LOG_MSG(result == TEST_PASSED ? info : error, "%-7s %s (%.3fs)\n", result_names[result], paths[i], elapsed_seconds(&start));
+    }
+
+    LOG_MSG(info, "%d/%d passed in %.3fs\n", count - failures, count, elapsed_seconds(&suite_start));
+    return failures;
+}
@@ -0,0 +1,30 @@
+// Headless runner for blargg and mooneye test ROMs. Each ROM runs at full
+// speed until it reports a result, instead of waiting for a fixed timeout.
+
+#pragma once
+#include <stdint.h>
+
+#include "machine.h"
+
+typedef enum {
+    TEST_RUNNING,
+    TEST_PASSED,
+    TEST_FAILED,
+    TEST_TIMEOUT,
+    TEST_ERROR // The CPU stopped or the ROM couldn't be loaded
+}test_result;
+
+/// Runs a test ROM until it passes, fails or runs out of time.
+/// Blargg ROMs are detected by "Passed"/"Failed" on the serial port, mooneye
+/// ROMs by the Fibonacci registers (or 0x42s) at an LD B, B breakpoint.
+/// \param rom_data ROM file contents
+/// \param rom_size Size of the ROM in bytes
+/// \param max_cycles Machine cycles to run before giving up
+/// \param rom_path Label for telemetry, can be NULL
+/// \param options Only the core, coverage directory and stats path are used
+test_result run_test_rom(const char* rom_path, const uint8_t* rom_data, uint32_t rom_size, uint64_t max_cycles,
+                         const run_options* options);
+
+/// Runs every ROM in paths, printing a line per ROM and the suite runtime.
+/// \return Number of ROMs that didn't pass
+int run_test_suite(char** paths, int count, uint64_t max_cycles, const run_options* options);
@@ -0,0 +1,274 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+
+#include "trace.h"
+#include "cpu.h"
+#include "bus.h"
+#include "rom.h"
+#include "disassembler.h"
+
+// Parsed lines are dropped from memory in chunks of this size, so a huge log
+// doesn't stay resident after we're done with it.
+#define TRACE_RELEASE_CHUNK (64 * 1024 * 1024)
+
+// Gameboy Doctor logs start in the state the boot ROM hands over in, which
+// machine_reset() already applies, and expect LY to always read 0x90 since
+// it doesn't emulate the PPU.
+static const uint16_t doctor_ly_address = 0xFF44;
+static const uint8_t doctor_ly_value = 0x90;
+
+static int8_t hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// Reads "<label><hex>" at the cursor, skipping spaces in front of it.
+static bool parse_field(const char** cursor, const char* end, const char* label, uint16_t* value) {
+    const char* c = *cursor;
+    while (c < end && *c == ' ') {
+        c++;
+    }
+    size_t label_length = strlen(label);
+    if ((size_t) (end - c) < label_length || memcmp(c, label, label_length) != 0) {
+        return false;
+    }
+    c += label_length;
+
+    uint16_t result = 0;
+    const char* digits = c;
+    while (c < end && hex_value(*c) >= 0) {
+        result = (result << 4) | hex_value(*c);
+        c++;
+    }
+    if (c == digits) {
+        return false;
+    }
+    *value = result;
+    *cursor = c;
+    return true;
+}
+
+static bool parse_line(const char* line, const char* end, trace_entry* entry) {
+    static const char* labels[] = {"A:", "F:", "B:", "C:", "D:", "E:", "H:", "L:"};
+    register8* registers[] = {
+            &entry->A, &entry->F, &entry->B, &entry->C,
+            &entry->D, &entry->E, &entry->H, &entry->L
+    };
+
+    uint16_t value = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+        if (!parse_field(&line, end, labels[i], &value)) {
+            return false;
+        }
+        *registers[i] = value;
+    }
+    if (!parse_field(&line, end, "SP:", &entry->SP) || !parse_field(&line, end, "PC:", &entry->PC)) {
+        return false;
+    }
+
+    const char* separators[] = {"PCMEM:", ",", ",", ","};
+    for (uint8_t i = 0; i < 4; i++) {
+        if (!parse_field(&line, end, separators[i], &value)) {
+            return false;
+        }
+        entry->pcmem[i] = value;
+    }
+    return true;
+}
+
+bool trace_open(trace_reference* trace, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_MSG(error, "Failed to open reference log %s\n", path);
+        return false;
+    }
+    struct stat st = {0};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        LOG_MSG(error, "Reference log %s is empty\n", path);
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive, we don't need the descriptor anymore
+    close(fd);
+    if (data == MAP_FAILED) {
+        LOG_MSG(error, "Failed to map reference log %s\n", path);
+        return false;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    trace_reference empty = {0};
+    *trace = empty;
+    trace->data = data;
+    trace->size = st.st_size;
+    return true;
+}
+
+void trace_close(trace_reference* trace) {
+    if (trace->data != NULL) {
+        munmap((void*) trace->data, trace->size);
+    }
+    trace->data = NULL;
+}
+
+void trace_capture(trace_entry* entry, machine_state* machine) {
+    const cpu_state* cpu = &machine->cpu;
+    entry->A = cpu->A;
+    entry->F = cpu->AF & 0xFF;
+    entry->B = cpu->B;
+    entry->C = cpu->C;
+    entry->D = cpu->D;
+    entry->E = cpu->E;
+    entry->H = cpu->H;
+    entry->L = cpu->L;
+    entry->SP = cpu->SP;
+    entry->PC = cpu->PC;
+    for (uint8_t i = 0; i < 4; i++) {
+        entry->pcmem[i] = *bus_read(cpu->PC + i, machine);
+    }
+}
+
+// Drops the pages we've already compared from memory
+static void trace_release(trace_reference* trace) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t done = (trace->offset / page_size) * page_size;
+    if (done - trace->released < TRACE_RELEASE_CHUNK) {
+        return;
+    }
+    // Keep the context lines mapped, they're at most a few hundred bytes back
+    done -= page_size;
+    madvise((void*) (trace->data + trace->released), done - trace->released, MADV_DONTNEED);
+    trace->released = done;
+}
+
+trace_status trace_compare(trace_reference* trace, machine_state* machine) {
+    // Skip blank lines
+    while (trace->offset < trace->size && (trace->data[trace->offset] == '\n' || trace->data[trace->offset] == '\r')) {
+        trace->offset++;
+    }
+    if (trace->offset >= trace->size) {
+        return TRACE_END;
+    }
+
+    const char* line = trace->data + trace->offset;
+    const char* end = memchr(line, '\n', trace->size - trace->offset);
+    if (end == NULL) {
+        end = trace->data + trace->size;
+    }
+    trace->offset = (end - trace->data) + 1;
+    trace->recent_lines[trace->line_number % TRACE_CONTEXT_LINES] = line;
+    trace->line_number++;
+    trace_release(trace);
+
+    if (!parse_line(line, end, &trace->expected)) {
+        return TRACE_PARSE_ERROR;
+    }
+
+    trace_entry actual = {0};
+    trace_capture(&actual, machine);
+    if (memcmp(&actual, &trace->expected, sizeof(actual)) != 0) {
+        return TRACE_MISMATCH;
+    }
+    return TRACE_MATCH;
+}
+
+static void print_entry(const char* name, const trace_entry* entry) {
+    LOG_MSG(info, "%s A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X\n",
+            name, entry->A, entry->F, entry->B, entry->C, entry->D, entry->E, entry->H, entry->L,
+            entry->SP, entry->PC, entry->pcmem[0], entry->pcmem[1], entry->pcmem[2], entry->pcmem[3]);
+}
+
+void trace_report_divergence(const trace_reference* trace, machine_state* machine) {
+    uint64_t context = trace->line_number < TRACE_CONTEXT_LINES ? trace->line_number : TRACE_CONTEXT_LINES;
+    LOG_MSG(error, "Diverged from the reference log at line %llu\n", (unsigned long long) trace->line_number);
+    for (uint64_t n = trace->line_number - context; n < trace->line_number; n++) {
+        const char* line = trace->recent_lines[n % TRACE_CONTEXT_LINES];
+        const char* end = memchr(line, '\n', (trace->data + trace->size) - line);
+        if (end == NULL) {
+            end = trace->data + trace->size;
+        }
+        LOG_MSG(info, "%8llu: %.*s\n", (unsigned long long) n + 1, (int) (end - line), line);
+    }
+
+    trace_entry actual = {0};
+    trace_capture(&actual, machine);
+    print_entry("Expected:", &trace->expected);
+    print_entry("Actual:  ", &actual);
+}
+
+// Shows the instruction that ran last, which is the one that went wrong
+static void report_instruction(disassembler* dis, uint16_t address) {
+    char location[DISASSEMBLY_TEXT_SIZE];
+    disassembler_symbolize(dis, address, location, sizeof(location));
+    LOG_MSG(info, "Last instruction: $%04X (%s) %s\n", address, location, disassemble(dis, address, NULL));
+}
+
+bool run_trace_compare(uint8_t* rom_data, uint32_t rom_size, const char* reference_path, const run_options* options) {
+    trace_reference trace = {0};
+    if (!trace_open(&trace, reference_path)) {
+        return true;
+    }
+    machine_state machine = {.core = options->core};
+    disassembler dis = {0};
+    if (!machine_init(&machine, rom_data, rom_size) || !disassembler_init(&dis, &machine)) {
+        LOG_MSG(error, "Failed to initialize the machine\n");
+        disassembler_free(&dis);
+        machine_free(&machine);
+        trace_close(&trace);
+        return true;
+    }
+    if (options->symbols_path != NULL) {
+        disassembler_load_symbols(&dis, options->symbols_path);
+    }
+
+    cpu_state* cpu = &machine.cpu;
+
+    bool diverged = true;
+    uint16_t previous_pc = cpu->PC;
+    while (true) {
+        machine.console_memory[doctor_ly_address] = doctor_ly_value;
+        trace_status status = trace_compare(&trace, &machine);
+        if (status == TRACE_END) {
+            LOG_MSG(info, "All %llu reference lines matched\n", (unsigned long long) trace.line_number);
+            diverged = false;
+            break;
+        }
+        if (status == TRACE_PARSE_ERROR) {
+            LOG_MSG(error, "Couldn't parse line %llu of the reference log\n", (unsigned long long) trace.line_number);
+            break;
+        }
+        if (status == TRACE_MISMATCH) {
+            trace_report_divergence(&trace, &machine);
+            report_instruction(&dis, previous_pc);
+            break;
+        }
+        previous_pc = cpu->PC;
+        if (cpu_step(&machine) == 0) {
+            LOG_MSG(error, "CPU stopped after line %llu of the reference log\n", (unsigned long long) trace.line_number);
+            trace_report_divergence(&trace, &machine);
+            report_instruction(&dis, previous_pc);
+            break;
+        }
+    }
+
+    disassembler_free(&dis);
+    machine_free(&machine);
+    trace_close(&trace);
+    return diverged;
+}
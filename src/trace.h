@@ -0,0 +1,60 @@
+// Compares every executed instruction against a Gameboy Doctor style
+// reference log ("A:01 F:B0 B:00 ... SP:FFFE PC:0100 PCMEM:00,C3,50,01").
+// The log is memory mapped and parsed in place, so logs of several gigabytes
+// can be checked without writing our own trace or allocating per line.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "machine.h"
+
+// Reference lines printed before the divergence
+#define TRACE_CONTEXT_LINES 8
+
+typedef struct {
+    register8 A, F, B, C, D, E, H, L;
+    register16 SP, PC;
+    uint8_t pcmem[4]; // The 4 bytes starting at PC
+}trace_entry;
+
+typedef enum {
+    TRACE_MATCH,
+    TRACE_MISMATCH,
+    TRACE_END, // Ran out of reference lines
+    TRACE_PARSE_ERROR
+}trace_status;
+
+typedef struct {
+    const char* data;
+    size_t size;
+    size_t offset; // Start of the next unread line
+    size_t released; // Everything before this was dropped from memory
+    uint64_t line_number;
+
+    // Ring buffer with the starts of the most recent lines, for context
+    const char* recent_lines[TRACE_CONTEXT_LINES];
+    trace_entry expected; // Most recently parsed line
+}trace_reference;
+
+/// Maps a reference log into memory.
+/// \return false if the file couldn't be opened or mapped
+bool trace_open(trace_reference* trace, const char* path);
+void trace_close(trace_reference* trace);
+
+// Fills an entry with the machine's state before the instruction at PC runs.
+void trace_capture(trace_entry* entry, machine_state* machine);
+
+/// Compares the machine against the next line of the reference log.
+/// \return TRACE_MATCH if every field is the same
+trace_status trace_compare(trace_reference* trace, machine_state* machine);
+
+// Prints the reference lines leading up to the last compared line, and how
+// the machine differs from it.
+void trace_report_divergence(const trace_reference* trace, machine_state* machine);
+
+/// Runs a ROM until it diverges from the reference log or the log ends.
+/// \param options Only the core and symbols are used
+/// \return false if every line matched
+bool run_trace_compare(uint8_t* rom_data, uint32_t rom_size, const char* reference_path, const run_options* options);
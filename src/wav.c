@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "logging.h"
+
+#include "wav.h"
+
+#define WAV_CHANNELS 2
+#define WAV_BYTES_PER_FRAME (WAV_CHANNELS * sizeof(int16_t))
+#define WAV_HEADER_SIZE 44
+
+// WAV is little endian no matter what the host is
+static void put_u16(uint8_t* dst, uint16_t value) {
+    dst[0] = value & 0xFF;
+    dst[1] = value >> 8;
+}
+
+static void put_u32(uint8_t* dst, uint32_t value) {
+    put_u16(dst, value & 0xFFFF);
+    put_u16(dst + 2, value >> 16);
+}
+
+static void write_header(wav_writer* wav) {
+    uint32_t data_size = wav->frames_written * WAV_BYTES_PER_FRAME;
+    uint8_t header[WAV_HEADER_SIZE] = {
+            'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+            'f', 'm', 't', ' ', 16, 0, 0, 0
+    };
+    put_u32(header + 4, WAV_HEADER_SIZE - 8 + data_size);
+    put_u16(header + 20, 1); // PCM
+    put_u16(header + 22, WAV_CHANNELS);
+    put_u32(header + 24, wav->sample_rate);
+    put_u32(header + 28, wav->sample_rate * WAV_BYTES_PER_FRAME);
+    put_u16(header + 32, WAV_BYTES_PER_FRAME);
+    put_u16(header + 34, 16);
+    header[36] = 'd';
+    header[37] = 'a';
+    header[38] = 't';
+    header[39] = 'a';
+    put_u32(header + 40, data_size);
+    fwrite(header, 1, sizeof(header), wav->file);
+}
+
+bool wav_open(wav_writer* wav, const char* path, uint32_t sample_rate) {
+    wav->file = fopen(path, "wb");
+    if (wav->file == NULL) {
+        LOG_MSG(error, "Failed to create %s\n", path);
+        return false;
+    }
+    wav->sample_rate = sample_rate;
+    wav->frames_written = 0;
+    write_header(wav);
+    return true;
+}
+
+void wav_write(wav_writer* wav, const int16_t* samples, uint32_t frame_count) {
+    uint8_t bytes[WAV_BYTES_PER_FRAME * 256];
+    while (frame_count != 0) {
+        uint32_t chunk = frame_count < 256 ? frame_count : 256;
+        for (uint32_t i = 0; i < chunk * WAV_CHANNELS; i++) {
+            put_u16(bytes + i * 2, (uint16_t) samples[i]);
+        }
+        fwrite(bytes, WAV_BYTES_PER_FRAME, chunk, wav->file);
+        wav->frames_written += chunk;
+        samples += chunk * WAV_CHANNELS;
+        frame_count -= chunk;
+    }
+}
+
+void wav_close(wav_writer* wav) {
+    if (wav->file == NULL) {
+        return;
+    }
+    fseek(wav->file, 0, SEEK_SET);
+    write_header(wav);
+    fclose(wav->file);
+    wav->file = NULL;
+}
@@ -0,0 +1,22 @@
+// Writes 16-bit stereo PCM WAV files, used to dump the APU output.
+
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    FILE* file;
+    uint32_t sample_rate;
+    uint64_t frames_written;
+}wav_writer;
+
+/// Creates the file and writes a header. Sizes are filled in by wav_close().
+/// \return false if the file couldn't be created
+bool wav_open(wav_writer* wav, const char* path, uint32_t sample_rate);
+
+// Appends interleaved left/right frames.
+void wav_write(wav_writer* wav, const int16_t* samples, uint32_t frame_count);
+
+// Patches the header sizes and closes the file.
+void wav_close(wav_writer* wav);